@@ -0,0 +1,342 @@
+//
+//
+// Raspidapter benchmark
+//
+//
+//
+// This file is part of raspidapter library.
+//
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Try to strike a balance between keep code simple for
+// novice programmers but still have reasonable quality code
+//
+// Measures the hot paths of the library and writes the results as JSON.
+//
+// usage: bench [-s] [-n iterations] [-b boards] [-o file]
+//   -s  use the simulator backend instead of the hardware
+//   -n  iterations per benchmark (default 2000)
+//   -b  boards of the rig for the DICE benchmarks (default 6)
+//   -o  write the JSON to a file instead of stdout
+//
+// Rig for the DICE benchmarks: board 1 has STK, TC, VN, TMC in slots 1-4,
+// board 2 has a 9555 in slot 1.
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_sim.h"
+#include "raspidapter_timing.h"
+#include "dice_stk.h"
+#include "dice_9555.h"
+#include "dice_vn.h"
+#include "dice_tc.h"
+#include "dice_tmc.h"
+#include "dice_motion.h"
+#include "dice_table.h"
+#include "dice_tc_sampler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_BOARDS 6
+
+struct DICE dice_stk;
+struct DICE dice_9555;
+struct DICE dice_vn;
+struct DICE dice_tmc;
+struct DICE dice_tc;
+
+// a rig with a STK in every slot
+struct DICE axes[4*DEFAULT_BOARDS];
+struct DICE* axes_ptr[4*DEFAULT_BOARDS];
+int axes_index[4*DEFAULT_BOARDS];
+struct DICE_TABLE axes_table;
+
+int tc_channel =0;
+
+int use_sim =0;
+int iterations = DEFAULT_ITERATIONS;
+unsigned long long* wall_ns =0;
+unsigned long long* sim_ns =0;
+int bench_counter =0;
+int first_result =1;
+FILE* out =0;
+
+//
+// the benchmarked operations
+//
+int op_iochain_update()
+{
+   //toggle a bit, unchanged frames are not shifted
+   if(bench_counter++ & 1)
+      iochain_setbit(0);
+   else
+      iochain_clearbit(0);
+   return iochain_update();
+}
+
+int op_stk_step()
+{
+   return dice_stk_step(&dice_stk);
+}
+
+int op_tmc_step()
+{
+   return dice_tmc_step(&dice_tmc);
+}
+
+int op_step_many()
+{
+   struct DICE* axes[2] = { &dice_stk, &dice_tmc };
+   return dice_step_many(axes,2);
+}
+
+int op_step_many_all()
+{
+   return dice_step_many(axes_ptr,4*DEFAULT_BOARDS);
+}
+
+int op_table_step_all()
+{
+   return dice_table_step(&axes_table,axes_index,4*DEFAULT_BOARDS);
+}
+
+int op_tmc_pollStatus()
+{
+   //without an age limit every poll resends the driver configuration - one datagram,
+   //the path of every TMC setting
+   return dice_tmc_pollStatus(&dice_tmc) == 1 ? 0 : ERR_INIT;
+}
+
+int op_tc_readCelsius()
+{
+   dice_tc_readCelsius(&dice_tc,1);
+   return 0;
+}
+
+int op_tc_readAll()
+{
+   struct DICE_TC_SAMPLE samples[DICE_TC_CHIPS];
+   return dice_tc_readAll(&dice_tc,samples);
+}
+
+int op_tcsampler_latest()
+{
+   struct TCSAMPLER_ENTRY entry;
+   return tcsampler_latest(tc_channel,&entry);
+}
+
+int op_vn_set()
+{
+   return dice_vn_set(&dice_vn,bench_counter++ & 0xff);
+}
+
+int op_9555_set()
+{
+   return dice_9555_set(&dice_9555,bench_counter++ & 0xffff);
+}
+
+int compare_ull(const void* a, const void* b)
+{
+   unsigned long long x = *(const unsigned long long*)a;
+   unsigned long long y = *(const unsigned long long*)b;
+   return x < y ? -1 : x > y;
+}
+
+unsigned long long percentile(unsigned long long* v, int n, int p)
+{
+   int i = (n*p)/100;
+   if(i >= n)
+      i = n-1;
+   return v[i];
+}
+
+//
+// run one operation and write its JSON record
+//
+void run(const char* name, int boards, int (*op)())
+{
+   int i;
+   int errors = 0;
+   unsigned long long total = 0;
+
+   //warm up
+   for(i=0; i < iterations/10; i++)
+      op();
+
+   for(i=0; i < iterations; i++)
+   {
+      unsigned long long sim_start = sim_now_ns();
+      unsigned long long start = timing_now_ns();
+      if(op() != 0)
+         errors++;
+      wall_ns[i] = timing_now_ns() - start;
+      sim_ns[i] = sim_now_ns() - sim_start;
+      total += wall_ns[i];
+   }
+
+   qsort(wall_ns,iterations,sizeof(unsigned long long),compare_ull);
+   qsort(sim_ns,iterations,sizeof(unsigned long long),compare_ull);
+
+   fprintf(out,"%s    {\"name\": \"%s\", \"boards\": %d, \"iterations\": %d, \"errors\": %d, "
+               "\"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu",
+           first_result ? "" : ",\n",name,boards,iterations,errors,
+           total ? iterations*1e9/total : 0.0,
+           percentile(wall_ns,iterations,50),percentile(wall_ns,iterations,99));
+   if(use_sim)
+   {
+      //the modeled bus time of the operation
+      fprintf(out,", \"sim_p50_ns\": %llu, \"sim_p99_ns\": %llu",
+              percentile(sim_ns,iterations,50),percentile(sim_ns,iterations,99));
+   }
+   fprintf(out,"}");
+   first_result = 0;
+}
+
+int setup(int boards)
+{
+   if(use_sim)
+      raspidapter_set_backend(&backend_sim);
+   return setup_raspidapter(boards);
+}
+
+int main(int argc, char** argv)
+{
+   const int chain_boards[] = { 1, 2, 4, 6, 8, 12, 16 };
+   int boards = DEFAULT_BOARDS;
+   const char* filename = NULL;
+   int c;
+   unsigned int i;
+
+#ifdef RASPIDAPTER_SIM
+   use_sim = 1;
+#endif
+
+   while((c = getopt(argc,argv,"sn:b:o:")) != -1)
+   {
+      switch(c)
+      {
+         case 's': use_sim = 1; break;
+         case 'n': iterations = atoi(optarg); break;
+         case 'b': boards = atoi(optarg); break;
+         case 'o': filename = optarg; break;
+         default:
+            fprintf(stderr,"usage: %s [-s] [-n iterations] [-b boards] [-o file]\n",argv[0]);
+            return -1;
+      }
+   }
+   if(iterations < 1 || boards < 2)
+   {
+      fprintf(stderr,"need at least 1 iteration and 2 boards\n");
+      return -1;
+   }
+
+   out = filename ? fopen(filename,"w") : stdout;
+   wall_ns = malloc(iterations*sizeof(unsigned long long));
+   sim_ns = malloc(iterations*sizeof(unsigned long long));
+   if(out == NULL || wall_ns == NULL || sim_ns == NULL)
+   {
+      fprintf(stderr,"can not open output\n");
+      return -1;
+   }
+
+   fprintf(out,"{\n  \"backend\": \"%s\",\n  \"results\": [\n",use_sim ? "sim" : "bcm2835");
+
+   //io chain length
+   for(i=0; i < sizeof(chain_boards)/sizeof(chain_boards[0]); i++)
+   {
+      if(setup(chain_boards[i]) != 0)
+      {
+         fprintf(stderr,"setup_raspidapter failed\n");
+         return -1;
+      }
+      run("iochain_update",chain_boards[i],op_iochain_update);
+      deinit_raspidapter();
+   }
+
+   //DICE operations on the rig
+   if(setup(boards) != 0)
+   {
+      fprintf(stderr,"setup_raspidapter failed\n");
+      return -1;
+   }
+   dice_stk_setup(&dice_stk,1,1);
+   dice_tc_setup(&dice_tc,1,2);
+   dice_vn_setup(&dice_vn,1,3,1);
+   dice_tmc_setup(&dice_tmc,1,4);
+   dice_9555_setup(&dice_9555,2,1,1);
+   if(use_sim)
+   {
+      sim_add_tc(iochain_default(),1,2);
+      sim_tc_set(iochain_default(),1,2,1,21.5,20.0,0);
+      sim_add_tmc(iochain_default(),1,4);
+   }
+   dice_stk_enable(&dice_stk,1);
+   dice_tmc_start(&dice_tmc);
+   dice_vn_setoutput(&dice_vn,0);
+   dice_9555_setoutput(&dice_9555,0);
+
+   run("dice_stk_step",boards,op_stk_step);
+   run("dice_tmc_step",boards,op_tmc_step);
+   run("dice_step_many_2",boards,op_step_many);
+   dice_tmc_setMaxAge(&dice_tmc,0);
+   run("dice_tmc_pollStatus",boards,op_tmc_pollStatus);
+   run("dice_tc_readCelsius",boards,op_tc_readCelsius);
+   run("dice_tc_readAll",boards,op_tc_readAll);
+   tc_channel = tcsampler_add(&dice_tc);
+   tcsampler_start(0);
+   while(tcsampler_count(tc_channel) == 0)
+      timing_delay_ns(100000);
+   run("tcsampler_latest",boards,op_tcsampler_latest);
+   tcsampler_stop();
+   run("dice_vn_set",boards,op_vn_set);
+   run("dice_9555_set",boards,op_9555_set);
+
+   deinit_raspidapter();
+
+   //stepping every slot of a rig
+   if(setup(DEFAULT_BOARDS) != 0)
+   {
+      fprintf(stderr,"setup_raspidapter failed\n");
+      return -1;
+   }
+   dice_table_init(&axes_table,4*DEFAULT_BOARDS);
+   for(i=0; i < 4*DEFAULT_BOARDS; i++)
+   {
+      dice_stk_setup(&axes[i],i/4+1,i%4+1);
+      axes_ptr[i] = &axes[i];
+      axes_index[i] = dice_table_add(&axes_table,&axes[i]);
+   }
+   run("dice_step_many_24",DEFAULT_BOARDS,op_step_many_all);
+   run("dice_table_step_24",DEFAULT_BOARDS,op_table_step_all);
+   dice_table_free(&axes_table);
+
+   deinit_raspidapter();
+
+   fprintf(out,"\n  ]\n}\n");
+   if(out != stdout)
+      fclose(out);
+
+   free(wall_ns);
+   free(sim_ns);
+   return 0;
+}
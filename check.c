@@ -0,0 +1,1475 @@
+//
+//
+// Raspidapter checks
+//
+//
+//
+// This file is part of raspidapter library.
+//
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Checks of the library against the simulator backend - runs without a raspberry pi
+// and terminates, the exit code is the number of failed checks.
+//
+// usage: check_sim [name ...]
+//   runs the named checks, all without a name
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_sim.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_sched.h"
+#include "raspidapter_estop.h"
+#include "raspidapter_wave.h"
+#include "raspidapter_program.h"
+#include "dice_stk.h"
+#include "dice_tmc.h"
+#include "dice_vn.h"
+#include "dice_9555.h"
+#include "dice_expander.h"
+#include "dice_tc.h"
+#include "dice_tc_sampler.h"
+#include "dice_table.h"
+#include "dice_profile.h"
+#include "dice_tmc_home.h"
+#include "dice_tmc_cooltune.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+
+int failures =0;
+const char* current ="";
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL %s:%d %s: %s\n",__FILE__,__LINE__,current,#cond); failures++; } } while(0)
+
+////////////////////////////////////////////
+//  simulator
+////////////////////////////////////////////
+
+struct DICE thread_stk;
+struct DICE thread_tc;
+struct DICE thread_vn;
+int thread_errors =0;
+
+// reads the thermocouples while the main thread steps and writes the expander
+static void* check_sim_reader(void* arg)
+{
+   struct DICE_TC_SAMPLE samples[DICE_TC_CHIPS];
+   int i, k;
+   (void)arg;
+
+   for(i=0; i < 200; i++)
+   {
+      dice_tc_readAll(&thread_tc,samples);
+      for(k=0; k < DICE_TC_CHIPS; k++)
+      {
+         if(samples[k].celsius != 20.0 + k || samples[k].fault != 0)
+            thread_errors++;
+      }
+   }
+   return 0;
+}
+
+static void check_sim_threads()
+{
+   struct SIM_STATS before, after;
+   pthread_t thread;
+   int i, k;
+
+   CHECK(setup_raspidapter(2) == 0);
+   CHECK(dice_stk_setup(&thread_stk,1,1) == 0);
+   CHECK(dice_tc_setup(&thread_tc,1,2) == 0);
+   CHECK(dice_vn_setup(&thread_vn,2,1,1) == 0);
+   CHECK(sim_add_tc(iochain_default(),1,2) == 0);
+   for(k=0; k < DICE_TC_CHIPS; k++)
+      sim_tc_set(iochain_default(),1,2,k+1,20.0 + k,25.0,0);
+
+   thread_errors = 0;
+   sim_get_stats(&before);
+   CHECK(pthread_create(&thread,0,check_sim_reader,0) == 0);
+   for(i=0; i < 400; i++)
+   {
+      dice_stk_step(&thread_stk);
+      dice_vn_set(&thread_vn,i & 0xff);
+   }
+   pthread_join(thread,0);
+   sim_get_stats(&after);
+
+   //no torn transfer and no lost count
+   CHECK(thread_errors == 0);
+   CHECK(after.spi_transfers - before.spi_transfers == 200*DICE_TC_CHIPS);
+   CHECK(sim_i2c_register(0x70,1) == (399 & 0xff));
+   deinit_raspidapter();
+}
+
+// the steps of an open transaction in another thread
+int tx_stage = 0;
+
+static void tx_wait_stage(int stage)
+{
+   while(__atomic_load_n(&tx_stage,__ATOMIC_ACQUIRE) != stage)
+      usleep(100);
+}
+
+static void* check_tx_writer(void* arg)
+{
+   struct IOCHAIN* chain = (struct IOCHAIN*)arg;
+
+   iochain_ctx_begin(chain);
+   iochain_ctx_setbit(chain,3);
+   iochain_ctx_setbit(chain,40);
+   iochain_ctx_update(chain);
+   __atomic_store_n(&tx_stage,1,__ATOMIC_RELEASE);
+   tx_wait_stage(2);
+   iochain_ctx_commit(chain);
+   __atomic_store_n(&tx_stage,3,__ATOMIC_RELEASE);
+   return 0;
+}
+
+// a transaction defers only the updates of its own thread, other threads do not latch its bits
+static void check_tx_threads()
+{
+   struct IOCHAIN* chain;
+   pthread_t thread;
+
+   CHECK(setup_raspidapter(2) == 0);
+   chain = iochain_default();
+   tx_stage = 0;
+   CHECK(pthread_create(&thread,0,check_tx_writer,chain) == 0);
+   tx_wait_stage(1);
+
+   //an update of this thread is latched at once, without the open bits
+   iochain_ctx_setbit(chain,5);
+   CHECK(iochain_ctx_update(chain) == 0);
+   CHECK(sim_output(chain,5) == 1);
+   CHECK(sim_output(chain,3) == 0 && sim_output(chain,40) == 0);
+   iochain_ctx_clearbit(chain,5);
+   CHECK(iochain_ctx_flush(chain) == 0);
+   CHECK(sim_output(chain,5) == 0);
+   CHECK(sim_output(chain,3) == 0 && sim_output(chain,40) == 0);
+
+   //the commit latches both words together
+   __atomic_store_n(&tx_stage,2,__ATOMIC_RELEASE);
+   tx_wait_stage(3);
+   pthread_join(thread,0);
+   CHECK(sim_output(chain,3) == 1 && sim_output(chain,40) == 1);
+   CHECK(iochain_ctx_commit(chain) == ERR_PARAM);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  spi
+////////////////////////////////////////////
+
+// the device profiles run at the fastest clock the device takes
+static void check_spi_profiles()
+{
+   const struct SPI_PROFILE* profiles[2];
+   const unsigned long max_hz[2] = { TMC262_SPI_MAX_HZ, MAX31855_SPI_MAX_HZ };
+   struct DICE tmc, tc;
+   int k;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(dice_tmc_setup(&tmc,1,1) == 0);
+   CHECK(dice_tc_setup(&tc,1,2) == 0);
+   profiles[0] = dice_tmc_getSpiProfile();
+   profiles[1] = dice_tc_getSpiProfile();
+   CHECK(profiles[0]->mode == SPI_MODE3);
+   CHECK(profiles[1]->mode == SPI_MODE0);
+   for(k=0; k < 2; k++)
+   {
+      CHECK(SPI_CORE_CLOCK_HZ/profiles[k]->divider <= max_hz[k]);
+      CHECK(SPI_CORE_CLOCK_HZ/(profiles[k]->divider/2) > max_hz[k]);
+   }
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  thermocouples
+////////////////////////////////////////////
+
+// MAX31855 frames: two's complement temperatures, bit 16 alone is still a fault
+static void check_tc_decode()
+{
+   struct DICE_TC_SAMPLE sample;
+   struct DICE_TC_SAMPLE samples[DICE_TC_CHIPS];
+   struct DICE tc;
+
+   //the datasheet examples: +1600.00 and +127.0, -250.00 and -55.0
+   dice_tc_decode((0x1900u << 18) | (0x7f0u << 4),&sample);
+   CHECK(sample.celsius == 1600.0 && sample.internal == 127.0 && sample.fault == 0);
+   dice_tc_decode((0x3c18u << 18) | (0xc90u << 4),&sample);
+   CHECK(sample.celsius == -250.0 && sample.internal == -55.0 && sample.fault == 0);
+
+   //the smallest steps below zero
+   dice_tc_decode((0x3fffu << 18) | (0xfffu << 4),&sample);
+   CHECK(sample.celsius == -0.25 && sample.internal == -0.0625);
+
+   //fault bit without a reason - every reason is assumed
+   dice_tc_decode(1u << 16,&sample);
+   CHECK(sample.fault == (DICE_TC_FAULT_OPEN|DICE_TC_FAULT_SHORT_GND|DICE_TC_FAULT_SHORT_VCC));
+   dice_tc_decode((1u << 16) | DICE_TC_FAULT_SHORT_GND,&sample);
+   CHECK(sample.fault == DICE_TC_FAULT_SHORT_GND);
+
+   //all three subchips as the simulator reports them
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tc(iochain_default(),1,2) == 0);
+   CHECK(dice_tc_setup(&tc,1,2) == 0);
+   CHECK(sim_tc_set(iochain_default(),1,2,1,-12.75,-3.5,0) == 0);
+   CHECK(sim_tc_set(iochain_default(),1,2,2,420.5,24.0625,0) == 0);
+   CHECK(sim_tc_set(iochain_default(),1,2,3,0.0,21.0,DICE_TC_FAULT_OPEN) == 0);
+   CHECK(dice_tc_readAll(&tc,samples) == 0);
+   CHECK(samples[0].celsius == -12.75 && samples[0].internal == -3.5 && samples[0].fault == 0);
+   CHECK(samples[1].celsius == 420.5 && samples[1].internal == 24.0625 && samples[1].fault == 0);
+   CHECK(samples[2].internal == 21.0 && samples[2].fault == DICE_TC_FAULT_OPEN);
+   CHECK(dice_tc_readAll(&tc,NULL) == ERR_PARAM);
+   deinit_raspidapter();
+}
+
+// poll the sampler once the virtual clock reaches its next deadline
+static void check_sampler_next(double celsius,int fault)
+{
+   unsigned long long next;
+
+   CHECK(sim_tc_set(iochain_default(),1,2,1,celsius,20.0,fault) == 0);
+   CHECK(tcsampler_poll(sim_now_ns,&next) == 0);
+   sim_advance_ns(next - sim_now_ns());
+   CHECK(tcsampler_poll(sim_now_ns,0) == 1);
+}
+
+// the sampler polled on the virtual clock: pacing, ring wrap, average and median
+static void check_tc_sampler()
+{
+   static const double values[5] = { 10.0, 20.0, 30.0, 1000.0, 40.0 };
+   struct TCSAMPLER_ENTRY first, entry;
+   struct SIM_STATS before, after;
+   struct DICE tc;
+   unsigned long long next;
+   double celsius;
+   int channel, k;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tc(iochain_default(),1,2) == 0);
+   CHECK(dice_tc_setup(&tc,1,2) == 0);
+   channel = tcsampler_add(&tc);
+   CHECK(channel == 0);
+   CHECK(tcsampler_set_period(0) == 0);
+   CHECK(tcsampler_latest(channel,&entry) == ERR_INIT);
+
+   //the first read is due at once, the next one a period after the chip select rose
+   CHECK(sim_tc_set(iochain_default(),1,2,1,25.0,20.0,0) == 0);
+   CHECK(tcsampler_poll(sim_now_ns,&next) == 1);
+   CHECK(tcsampler_latest(channel,&first) == 0);
+   CHECK(first.sample.celsius == 25.0);
+   CHECK(next >= first.time_ns + TCSAMPLER_PERIOD_NS);
+   CHECK(tcsampler_count(channel+1) == 1 && tcsampler_count(channel+2) == 1);
+
+   //no conversion is read twice - not even a ns early
+   sim_get_stats(&before);
+   sim_advance_ns(next - 1 - sim_now_ns());
+   CHECK(tcsampler_poll(sim_now_ns,0) == 0);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers == before.spi_transfers);
+   CHECK(tcsampler_count(channel) == 1);
+   sim_advance_ns(1);
+   CHECK(tcsampler_poll(sim_now_ns,0) == 1);
+   CHECK(tcsampler_latest(channel,&entry) == 0);
+   CHECK(entry.time_ns - first.time_ns >= TCSAMPLER_PERIOD_NS);
+
+   //past the ring: the oldest samples are overwritten, only a full ring is averaged
+   for(k=0; k < TCSAMPLER_HISTORY + 6; k++)
+      check_sampler_next(k,0);
+   CHECK(tcsampler_count(channel) == TCSAMPLER_HISTORY + 8);
+   CHECK(tcsampler_latest(channel,&entry) == 0);
+   CHECK(entry.sample.celsius == TCSAMPLER_HISTORY + 5);
+   CHECK(tcsampler_average(channel,TCSAMPLER_HISTORY,&celsius) == 0);
+   CHECK(celsius == 6 + (TCSAMPLER_HISTORY - 1)/2.0);
+   CHECK(tcsampler_median(channel,TCSAMPLER_HISTORY,&celsius) == 0);
+   CHECK(celsius == 6 + (TCSAMPLER_HISTORY - 1)/2.0);
+   CHECK(tcsampler_average(channel,TCSAMPLER_HISTORY + 1,&celsius) == ERR_PARAM);
+
+   //20 is faulted: the last five hold four valid samples, the last four three
+   for(k=0; k < 5; k++)
+      check_sampler_next(values[k],k == 1 ? DICE_TC_FAULT_OPEN : 0);
+   CHECK(tcsampler_average(channel,5,&celsius) == 0 && celsius == 270.0);
+   CHECK(tcsampler_median(channel,5,&celsius) == 0 && celsius == 35.0);
+   CHECK(tcsampler_average(channel,4,&celsius) == 0 && celsius == 1070.0/3);
+   CHECK(tcsampler_median(channel,4,&celsius) == 0 && celsius == 40.0);
+
+   //nothing valid
+   check_sampler_next(50.0,DICE_TC_FAULT_SHORT_VCC);
+   CHECK(tcsampler_average(channel,1,&celsius) == ERR_INIT);
+   CHECK(tcsampler_median(channel,1,&celsius) == ERR_INIT);
+
+   CHECK(tcsampler_stop() == 0);
+   CHECK(tcsampler_stop() == ERR_INIT);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  waveforms
+////////////////////////////////////////////
+
+// bit patterns of the wave checks - every board and both chains get bits
+static int check_wave_bit(int image, int bit)
+{
+   return ((bit*7 + image*3) % 5) < 2;
+}
+
+static void check_wave_image(struct IOCHAIN* chain, int image)
+{
+   int bit;
+   for(bit=0; bit < chain->num_io; bit++)
+   {
+      if(check_wave_bit(image,bit))
+         iochain_ctx_setbit(chain,bit);
+      else
+         iochain_ctx_clearbit(chain,bit);
+   }
+}
+
+// a played waveform latches the same outputs as the bit-bang player
+static void check_wave_replay()
+{
+   const int datapins[2] = { 18, 23 };
+   struct IOCHAIN* chain;
+   struct WAVE wave;
+   int played[3*32*2];
+   int image, bit;
+
+   CHECK(setup_raspidapter_chains(3,2,datapins) == 0);
+   chain = iochain_default();
+   CHECK(wave_init(&wave,chain,2,0) == 0);
+
+   for(image=0; image < 4; image++)
+   {
+      //the waveform of one frame
+      wave_clear(&wave);
+      check_wave_image(chain,image);
+      CHECK(wave_add_frame(&wave) == 0);
+      CHECK(wave_add_delay(&wave,1000) == 0);
+      CHECK(wave_check(&wave) == 0);
+      CHECK(wave_play(&wave) == 0);
+      wave_wait();
+      for(bit=0; bit < chain->num_io; bit++)
+         played[bit] = sim_output(chain,bit);
+
+      //the same image from the bit-bang player, after a different one
+      check_wave_image(chain,image+1);
+      iochain_ctx_update(chain);
+      check_wave_image(chain,image);
+      iochain_ctx_update(chain);
+      for(bit=0; bit < chain->num_io; bit++)
+      {
+         CHECK(played[bit] == sim_output(chain,bit));
+         CHECK(played[bit] == check_wave_bit(image,bit));
+      }
+   }
+
+   //two frames, then broken copies
+   wave_clear(&wave);
+   check_wave_image(chain,0);
+   CHECK(wave_add_frame(&wave) == 0);
+   check_wave_image(chain,1);
+   CHECK(wave_add_frame(&wave) == 0);
+   CHECK(wave_check(&wave) == 0);
+
+   //a frame image which the writes do not latch
+   wave.images[chain->num_words] ^= 0x10;
+   CHECK(wave_check(&wave) != 0);
+   wave.images[chain->num_words] ^= 0x10;
+
+   //a clock edge too close to the data
+   for(bit=0; bit < wave.count && wave.cb[bit].kind != WAVE_DELAY; bit++)
+      ;
+   CHECK(bit < wave.count);
+   wave.cb[bit].value = 0;
+   CHECK(wave_check(&wave) == bit+2);
+
+   wave_free(&wave);
+   deinit_raspidapter();
+}
+
+// a waveform built before a stop does not drive the held bits while stopped
+static void check_wave_estop()
+{
+   struct DICE stk;
+   struct DICE* armed[1];
+   struct WAVE wave;
+   struct IOCHAIN* chain;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   CHECK(dice_stk_setup(&stk,1,1) == 0);
+   armed[0] = &stk;
+   CHECK(estop_arm(armed,1) == 0);
+
+   CHECK(wave_init(&wave,chain,1,0) == 0);
+   iochain_ctx_setbit(chain,stk.enable);
+   iochain_ctx_setbit(chain,stk.step);
+   CHECK(wave_add_frame(&wave) == 0);
+   iochain_ctx_clearbit(chain,stk.step);
+
+   CHECK(estop_trigger() == 0);
+   estop_wait_done();
+   CHECK(wave_play(&wave) == ERR_ESTOP);
+   wave_wait();
+   CHECK(sim_output(chain,stk.enable) == 0);
+   CHECK(sim_output(chain,stk.step) == 0);
+
+   //played again after the release
+   CHECK(estop_disarm() == 0);
+   CHECK(wave_play(&wave) == 0);
+   wave_wait();
+   CHECK(sim_output(chain,stk.enable) == 1);
+   CHECK(sim_output(chain,stk.step) == 1);
+   wave_free(&wave);
+   deinit_raspidapter();
+}
+
+// the last frame of a waveform counts as latched only once the waveform is done
+static void check_wave_latch()
+{
+   struct WAVE wave;
+   struct IOCHAIN* chain;
+   struct SIM_STATS before, after;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   CHECK(wave_init(&wave,chain,1,0) == 0);
+   iochain_ctx_setbit(chain,3);
+   CHECK(wave_add_frame(&wave) == 0);
+   CHECK(wave_play(&wave) == 0);
+   CHECK(chain->wave_pending == 1);
+   wave_free(&wave);
+
+   //the buffer matches the played frame - nothing to shift
+   sim_get_stats(&before);
+   CHECK(iochain_ctx_update(chain) == 0);
+   sim_get_stats(&after);
+   CHECK(after.frames == before.frames);
+   CHECK(chain->wave_pending == 0);
+   CHECK(chain->latched[0] == 1u << 3);
+
+   iochain_ctx_clearbit(chain,3);
+   CHECK(iochain_ctx_update(chain) == 0);
+   sim_get_stats(&after);
+   CHECK(after.frames == before.frames + 1);
+   CHECK(sim_output(chain,3) == 0);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  i2c expanders
+////////////////////////////////////////////
+
+// unchanged registers cost nothing, a changed 9555 port is written alone
+static void check_expander_shadow()
+{
+   struct DICE vn, exp;
+   struct SIM_STATS before, after;
+
+   CHECK(setup_raspidapter(2) == 0);
+   CHECK(dice_vn_setup(&vn,1,1,1) == 0);
+   CHECK(dice_9555_setup(&exp,2,1,1) == 0);
+
+   //a repeated value is one transfer
+   sim_get_stats(&before);
+   CHECK(dice_vn_set(&vn,0x5a) == 0);
+   CHECK(dice_vn_set(&vn,0x5a) == 0);
+   sim_get_stats(&after);
+   CHECK(after.i2c_transfers - before.i2c_transfers == 1);
+   CHECK(sim_i2c_register(0x70,1) == 0x5a);
+
+   //both ports while the chip is unknown, then the changed port alone
+   sim_get_stats(&before);
+   CHECK(dice_9555_set(&exp,0x1234) == 0);
+   sim_get_stats(&after);
+   CHECK(after.i2c_transfers - before.i2c_transfers == 1);
+   CHECK(after.i2c_bytes - before.i2c_bytes == 3);
+   sim_get_stats(&before);
+   CHECK(dice_9555_set(&exp,0x5634) == 0);
+   CHECK(dice_9555_set(&exp,0x5678) == 0);
+   sim_get_stats(&after);
+   CHECK(after.i2c_transfers - before.i2c_transfers == 2);
+   CHECK(after.i2c_bytes - before.i2c_bytes == 4);
+   CHECK(sim_i2c_register(0x20,1) == 0x5678);
+
+   //a chip not answering: the outputs and polarity are tried, the config waits
+   dice_expander_set_window(&exp,1000000);
+   CHECK(dice_9555_set(&exp,0x0001) == 0);
+   CHECK(dice_9555_setpolarity(&exp,0x0100) == 0);
+   CHECK(dice_9555_setoutput(&exp,0x0000) == 0);
+   exp.i2c_addr = 0x30;
+   sim_get_stats(&before);
+   CHECK(dice_expander_flush(&exp) == ERR_I2C);
+   sim_get_stats(&after);
+   CHECK(after.i2c_transfers - before.i2c_transfers == 2);
+   CHECK(sim_i2c_register(0x20,3) == 0xffff);
+
+   //all three are written once it answers again
+   exp.i2c_addr = 0x20;
+   CHECK(dice_expander_flush(&exp) == 3);
+   CHECK(sim_i2c_register(0x20,1) == 0x0001);
+   CHECK(sim_i2c_register(0x20,2) == 0x0100);
+   CHECK(sim_i2c_register(0x20,3) == 0x0000);
+   CHECK(dice_expander_flush(&exp) == 0);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  TMC step modes
+////////////////////////////////////////////
+
+// every register is sent once at the start and only changed registers later
+static void check_tmc_shadow()
+{
+   struct DICE dice;
+   struct SIM_STATS before, after;
+   const struct IOCHAIN* chain;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   CHECK(sim_add_tmc(chain,1,1) == 0);
+   CHECK(dice_tmc_setup(&dice,1,1) == 0);
+
+   sim_get_stats(&before);
+   CHECK(dice_tmc_start(&dice) == 0);
+   sim_get_stats(&after);
+   CHECK(sim_tmc_datagrams(chain,1,1) == 5);
+   CHECK(after.spi_transfers - before.spi_transfers == 5);
+   CHECK(dice_tmc_getDirty(&dice) == 0);
+
+   //an unchanged value costs nothing - 32 microsteps is the default
+   dice_tmc_setCurrent(&dice,1000);
+   sim_get_stats(&before);
+   dice_tmc_setCurrent(&dice,1000);
+   dice_tmc_setMicrosteps(&dice,32);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers == before.spi_transfers);
+
+   //three changes of one register are one datagram
+   dice_tmc_setAutoFlush(&dice,0);
+   dice_tmc_setMicrosteps(&dice,8);
+   dice_tmc_setDoubleEdge(&dice,1);
+   dice_tmc_setMicrosteps(&dice,16);
+   CHECK(dice_tmc_getDirty(&dice) == 1);
+   sim_get_stats(&before);
+   CHECK(dice_tmc_flush(&dice) == 1);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers - before.spi_transfers == 1);
+   CHECK((sim_tmc_register(chain,1,1,0) & 0x10f) == 0x104);
+
+   //a register set back before the flush is not dirty
+   dice_tmc_setDoubleEdge(&dice,0);
+   dice_tmc_setDoubleEdge(&dice,1);
+   CHECK(dice_tmc_getDirty(&dice) == 0);
+   CHECK(dice_tmc_flush(&dice) == 0);
+   deinit_raspidapter();
+}
+
+// a group of equal drivers costs the transfers of one, different values their own
+static void check_tmc_broadcast()
+{
+   struct DICE tmc[16];
+   struct DICE* dice[16];
+   struct SIM_STATS before, after;
+   const struct IOCHAIN* chain;
+   int i;
+
+   CHECK(setup_raspidapter(4) == 0);
+   chain = iochain_default();
+   for(i=0; i < 16; i++)
+   {
+      CHECK(sim_add_tmc(chain,i/4+1,i%4+1) == 0);
+      CHECK(dice_tmc_setup(&tmc[i],i/4+1,i%4+1) == 0);
+      dice[i] = &tmc[i];
+   }
+
+   sim_get_stats(&before);
+   CHECK(dice_tmc_startMany(dice,16) == 5);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers - before.spi_transfers == 5);
+   for(i=0; i < 16; i++)
+   {
+      CHECK(sim_tmc_datagrams(chain,i/4+1,i%4+1) == 5);
+      CHECK(sim_tmc_register(chain,i/4+1,i%4+1,3) == sim_tmc_register(chain,1,1,3));
+      CHECK(dice_tmc_getDirty(&tmc[i]) == 0);
+   }
+
+   //one register of the whole group
+   sim_get_stats(&before);
+   dice_tmc_setCurrentMany(dice,16,800);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers - before.spi_transfers == 1);
+   for(i=0; i < 16; i++)
+      CHECK(sim_tmc_datagrams(chain,i/4+1,i%4+1) == 6);
+
+   //two values are two transfers
+   for(i=0; i < 16; i++)
+   {
+      dice_tmc_setAutoFlush(&tmc[i],0);
+      dice_tmc_setMicrosteps(&tmc[i],i < 4 ? 16 : 64);
+   }
+   sim_get_stats(&before);
+   CHECK(dice_tmc_flushMany(dice,16) == 2);
+   sim_get_stats(&after);
+   CHECK(after.spi_transfers - before.spi_transfers == 2);
+   CHECK((sim_tmc_register(chain,1,4,0) & 0xf) == 4);
+   CHECK((sim_tmc_register(chain,2,1,0) & 0xf) == 2);
+   CHECK((sim_tmc_register(chain,4,4,0) & 0xf) == 2);
+   deinit_raspidapter();
+}
+
+// readouts come from the RDSEL the driver holds, starting from its power on reset
+static void check_tmc_readout()
+{
+   struct DICE dice;
+   const struct IOCHAIN* chain;
+   int k;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   CHECK(sim_add_tmc(chain,1,1) == 0);
+   CHECK(dice_tmc_setup(&dice,1,1) == 0);
+   CHECK(sim_tmc_set_status(chain,1,1,300,0) == 0);
+
+   //the shadow selects StallGuard from the start, the driver after reset the position
+   CHECK((sim_tmc_register(chain,1,1,4) & 0x30) == 0);
+   dice_tmc_readStatus(&dice,TMC26X_READOUT_STALLGUARD);
+   CHECK(dice_tmc_getReadoutValue(&dice) == 300);
+   CHECK(dice_tmc_getReadoutAge(&dice,TMC26X_READOUT_POSITION) == ~0ul);
+
+   //every selection after the start
+   CHECK(dice_tmc_start(&dice) == 0);
+   dice_tmc_setMicrosteps(&dice,256);
+   for(k=0; k < 5; k++)
+      dice_tmc_step(&dice);
+   dice_tmc_readStatus(&dice,TMC26X_READOUT_POSITION);
+   CHECK(dice_tmc_getReadoutValue(&dice) == sim_tmc_position(chain,1,1));
+   dice_tmc_readStatus(&dice,TMC26X_READOUT_STALLGUARD);
+   CHECK(dice_tmc_getReadoutValue(&dice) == 300);
+   deinit_raspidapter();
+}
+
+// two steps inside one transaction are two edges on the driver, in both step modes
+static void check_tmc_transaction()
+{
+   struct DICE dice[2];
+   int start[2];
+   int k;
+
+   CHECK(setup_raspidapter(1) == 0);
+   for(k=0; k < 2; k++)
+   {
+      CHECK(sim_add_tmc(iochain_default(),1,k+1) == 0);
+      CHECK(dice_tmc_setup(&dice[k],1,k+1) == 0);
+      CHECK(dice_tmc_start(&dice[k]) == 0);
+      //double edge is opt-in
+      CHECK(dice_tmc_isDoubleEdge(&dice[k]) == 0);
+      dice_tmc_setMicrosteps(&dice[k],256);
+      dice_tmc_dir(&dice[k],1);
+   }
+   dice_tmc_setDoubleEdge(&dice[1],1);
+   CHECK(dice_tmc_isDoubleEdge(&dice[1]) == 1);
+
+   for(k=0; k < 2; k++)
+   {
+      start[k] = sim_tmc_position(iochain_default(),1,k+1);
+      iochain_ctx_begin(iochain_default());
+      dice_tmc_step(&dice[k]);
+      dice_tmc_step(&dice[k]);
+      iochain_ctx_commit(iochain_default());
+      CHECK(sim_tmc_position(iochain_default(),1,k+1) == ((start[k] + 2) & 0x3ff));
+      CHECK(dice_get_steps(&dice[k]) == 2);
+   }
+
+   //a pending mode change does not count until it is sent
+   dice_tmc_setAutoFlush(&dice[0],0);
+   dice_tmc_setDoubleEdge(&dice[0],1);
+   CHECK(dice_tmc_isDoubleEdge(&dice[0]) == 0);
+   dice_tmc_step(&dice[0]);
+   CHECK(sim_tmc_position(iochain_default(),1,1) == ((start[0] + 3) & 0x3ff));
+   deinit_raspidapter();
+}
+
+// the safe frame leaves the step input of a double edge axis where it is
+static void check_tmc_estop_keep()
+{
+   struct DICE toggle, stk;
+   struct DICE* armed[2];
+   int position, sent;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,1) == 0);
+   CHECK(dice_tmc_setup(&toggle,1,1) == 0);
+   CHECK(dice_tmc_start(&toggle) == 0);
+   dice_tmc_setDoubleEdge(&toggle,1);
+   CHECK(dice_stk_setup(&stk,1,2) == 0);
+   dice_stk_enable(&stk,1);
+
+   //step input high after an odd number of steps
+   dice_tmc_step(&toggle);
+   CHECK(sim_output(iochain_default(),toggle.step) == 1);
+   position = sim_tmc_position(iochain_default(),1,1);
+
+   armed[0] = &toggle;
+   armed[1] = &stk;
+   CHECK(estop_arm(armed,2) == 0);
+   sent = sim_tmc_datagrams(iochain_default(),1,1);
+   CHECK(estop_trigger() == 0);
+   estop_wait_done();
+
+   //the worker sends all five registers again, the chopper off
+   CHECK(sim_tmc_datagrams(iochain_default(),1,1) == sent + 5);
+   CHECK((sim_tmc_register(iochain_default(),1,1,1) & 0xf) == 0);
+   CHECK(dice_tmc_getDirty(&toggle) == 0);
+   CHECK(sim_output(iochain_default(),toggle.step) == 1);
+   CHECK(sim_output(iochain_default(),toggle.enable) == 1);
+   CHECK(sim_output(iochain_default(),stk.enable) == 0);
+   CHECK(sim_tmc_position(iochain_default(),1,1) == position);
+
+   //writers cannot move it while stopped, nor does the release
+   dice_tmc_step(&toggle);
+   iochain_ctx_update(iochain_default());
+   CHECK(sim_tmc_position(iochain_default(),1,1) == position);
+   CHECK(estop_release() == 0);
+   iochain_ctx_flush(iochain_default());
+   CHECK(sim_tmc_position(iochain_default(),1,1) == position);
+   CHECK(estop_disarm() == 0);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  emergency stop
+////////////////////////////////////////////
+
+struct CHECK_STOP
+{
+   struct DICE* stk;
+   struct DICE* tmc;
+   int cycles;                   // clock cycles since the hook was set
+   int trigger_cycle;
+   unsigned long long trigger_ns;
+   unsigned long long frames;    // strobes before the trigger
+   unsigned long long latched_ns;
+   int latched_frames;           // strobes between the trigger and the safe frame
+   int safe;                     // the outputs were the safe frame
+};
+
+// triggers the stop between two bits of a frame, then waits for the next strobe
+static void check_stop_hook(void* arg)
+{
+   struct CHECK_STOP* stop = (struct CHECK_STOP*)arg;
+   struct SIM_STATS stats;
+
+   stop->cycles++;
+   sim_get_stats(&stats);
+   if(stop->cycles == stop->trigger_cycle)
+   {
+      stop->trigger_ns = sim_now_ns();
+      stop->frames = stats.frames;
+      estop_trigger();
+   }
+   else if(stop->cycles > stop->trigger_cycle && stop->latched_ns == 0 && stats.frames != stop->frames)
+   {
+      stop->latched_ns = stats.strobe_ns;
+      stop->latched_frames = stats.frames - stop->frames;
+      stop->safe = sim_output(iochain_default(),stop->stk->enable) == 0
+                   && sim_output(iochain_default(),stop->stk->step) == 0
+                   && sim_output(iochain_default(),stop->stk->dir) == 0
+                   && sim_output(iochain_default(),stop->tmc->enable) == 1;
+   }
+}
+
+// a stop in the middle of a frame latches the safe frame within the stated bound
+static void check_estop_midframe()
+{
+   struct DICE stk, tmc;
+   struct DICE* armed[2];
+   struct CHECK_STOP stop;
+   struct ESTOP_STATS stats;
+
+   CHECK(setup_raspidapter(2) == 0);
+   CHECK(sim_add_tmc(iochain_default(),2,1) == 0);
+   CHECK(dice_tmc_setup(&tmc,2,1) == 0);
+   CHECK(dice_tmc_start(&tmc) == 0);
+   CHECK(dice_stk_setup(&stk,1,1) == 0);
+   dice_stk_enable(&stk,1);
+   armed[0] = &stk;
+   armed[1] = &tmc;
+   CHECK(estop_arm(armed,2) == 0);
+
+   memset(&stop,0,sizeof(stop));
+   stop.stk = &stk;
+   stop.tmc = &tmc;
+   stop.trigger_cycle = iochain_default()->chain_bits/2;
+   sim_set_clock_hook(check_stop_hook,&stop);
+
+   //the frame of the direction change is cut off by the stop
+   dice_stk_dir(&stk,1);
+   sim_set_clock_hook(0,0);
+   estop_wait_done();
+
+   CHECK(stop.trigger_ns != 0);
+   CHECK(stop.latched_ns != 0);
+   CHECK(stop.latched_frames == 1);
+   CHECK(stop.safe);
+   CHECK(stop.latched_ns - stop.trigger_ns <= estop_worst_ns());
+   CHECK(estop_get_stats(&stats) == 0);
+   CHECK(stats.triggers == 1);
+   CHECK((sim_tmc_register(iochain_default(),2,1,1) & 0xf) == 0);
+
+   //disarm drops the hold bits, the enable can be latched again
+   CHECK(estop_disarm() == 0);
+   CHECK(estop_active() == 0);
+   dice_stk_enable(&stk,1);
+   dice_stk_step(&stk);
+   CHECK(sim_output(iochain_default(),stk.enable) == 1);
+   CHECK(dice_get_steps(&stk) == 1);
+   deinit_raspidapter();
+}
+
+// every runner a stop ends returns ERR_ESTOP
+static void check_estop_runners()
+{
+   struct DICE stk;
+   struct DICE* armed[1];
+   struct DICE_PROFILE profile;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(dice_stk_setup(&stk,1,1) == 0);
+   dice_stk_enable(&stk,1);
+   CHECK(dice_profile_init(&profile,20000,1000000,0) == 0);
+   CHECK(stepsched_start(64,0) == 0);
+
+   armed[0] = &stk;
+   CHECK(estop_arm(armed,1) == 0);
+   CHECK(estop_trigger() == 0);
+   CHECK(dice_profile_move(&stk,&profile,10) == ERR_ESTOP);
+   CHECK(dice_get_steps(&stk) == 0);
+   CHECK(stepsched_step(&stk,timing_now_ns()) == ERR_ESTOP);
+   CHECK(stepsched_dir(&stk,1,timing_now_ns()) == ERR_ESTOP);
+   CHECK(stepsched_pending() == 0);
+
+   CHECK(stepsched_stop() == 0);
+   CHECK(estop_release() == 0);
+   CHECK(estop_disarm() == 0);
+   dice_profile_free(&profile);
+   deinit_raspidapter();
+}
+
+// an arm failing half way leaves no hold or safe bits behind
+static void check_estop_rollback()
+{
+   struct IOCHAIN chains[ESTOP_MAX_CHAINS+1];
+   struct DICE dice[ESTOP_MAX_CHAINS+1];
+   struct DICE* armed[ESTOP_MAX_CHAINS+1];
+   int k, w;
+
+   CHECK(setup_raspidapter(1) == 0);
+   for(k=0; k <= ESTOP_MAX_CHAINS; k++)
+   {
+      int data = 2 + k;
+      CHECK(iochain_init(&chains[k],1,1,&data,11 + k,20 + k,-1) == 0);
+      iochain_select(&chains[k]);
+      CHECK(dice_tmc_setup(&dice[k],1,1) == 0);
+      armed[k] = &dice[k];
+   }
+
+   //one group too many
+   CHECK(estop_arm(armed,ESTOP_MAX_CHAINS+1) == ERR_PARAM);
+   CHECK(estop_trigger() == ERR_INIT);
+   for(k=0; k <= ESTOP_MAX_CHAINS; k++)
+   {
+      for(w=0; w < chains[k].num_words; w++)
+      {
+         CHECK(chains[k].hold[w] == 0);
+         CHECK(chains[k].keep[w] == 0);
+         CHECK(chains[k].stop_image[w] == 0);
+      }
+      iochain_deinit(&chains[k]);
+   }
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  TMC homing
+////////////////////////////////////////////
+
+// triggers an emergency stop after a number of clock cycles
+static void check_trigger_hook(void* arg)
+{
+   int* cycles = (int*)arg;
+   if(--*cycles == 0)
+      estop_trigger();
+}
+
+// homing restores the StallGuard setup on every return but a stop, which is ERR_ESTOP
+static void check_tmc_home()
+{
+   struct DICE tmc;
+   struct DICE* dice[1];
+   struct TMC_HOME_CONFIG config;
+   struct TMC_HOME_RESULT result;
+   const struct IOCHAIN* chain;
+   unsigned long sgcsconf, drvconf;
+   int dir = 1;
+   int cycles;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   CHECK(sim_add_tmc(chain,1,1) == 0);
+   CHECK(dice_tmc_setup(&tmc,1,1) == 0);
+   CHECK(dice_tmc_start(&tmc) == 0);
+   dice_tmc_setStallGuardThreshold(&tmc,5,1);
+   dice_tmc_readStatus(&tmc,TMC26X_READOUT_POSITION);
+   sgcsconf = sim_tmc_register(chain,1,1,3);
+   drvconf = sim_tmc_register(chain,1,1,4);
+   dice[0] = &tmc;
+
+   dice_tmc_home_defaults(&config);
+   config.threshold = 10;
+   config.skip_steps = 8;
+   config.max_steps = 64;
+   config.step_ns = 10000;
+
+   //stalled at the first read
+   CHECK(sim_tmc_set_status(chain,1,1,0,0) == 0);
+   CHECK(dice_tmc_home(dice,&dir,1,&config,&result) == 0);
+   CHECK(result.homed[0] == 1);
+   CHECK(result.steps[0] == 8);
+   CHECK(dice_get_steps(&tmc) == 8);
+   CHECK(sim_tmc_register(chain,1,1,3) == sgcsconf);
+   CHECK(sim_tmc_register(chain,1,1,4) == drvconf);
+   CHECK(dice_tmc_getReadoutSelection(&tmc) == TMC26X_READOUT_POSITION);
+
+   //stopped while moving
+   CHECK(sim_tmc_set_status(chain,1,1,500,0) == 0);
+   CHECK(estop_arm(dice,1) == 0);
+   cycles = 20*chain->chain_bits;
+   sim_set_clock_hook(check_trigger_hook,&cycles);
+   CHECK(dice_tmc_home(dice,&dir,1,&config,&result) == ERR_ESTOP);
+   sim_set_clock_hook(0,0);
+   estop_wait_done();
+
+   //the drivers are the worker's - the homing threshold stays until the caller sets it again
+   CHECK((sim_tmc_register(chain,1,1,1) & 0xf) == 0);
+   CHECK(sim_tmc_register(chain,1,1,3) != sgcsconf);
+   CHECK(dice_tmc_getStallGuardThreshold(&tmc) == 10);
+   CHECK(dice_tmc_getDirty(&tmc) == 0);
+   CHECK(estop_release() == 0);
+   dice_tmc_setStallGuardThreshold(&tmc,5,1);
+   CHECK(sim_tmc_register(chain,1,1,3) == sgcsconf);
+   CHECK(estop_disarm() == 0);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  CoolStep tuning
+////////////////////////////////////////////
+
+// StallGuard readings per level: axis 1 follows the load, axis 2 hardly changes, axis 3 runs hot
+static void check_cooltune_load(int level,void* arg)
+{
+   static const int loaded[3] = { 700, 500, 300 };
+   const struct IOCHAIN* chain = arg;
+
+   sim_tmc_set_status(chain,1,1,loaded[level],0);
+   sim_tmc_set_status(chain,1,2,620 - level*10,0);
+   sim_tmc_set_status(chain,1,3,400,0x04);
+}
+
+// the derived setting of scripted readings, the former setting back on a warning
+static void check_cooltune()
+{
+   struct DICE tmc[3];
+   struct DICE* dice[3];
+   struct TMC_COOLTUNE_CONFIG config;
+   struct TMC_COOLTUNE_RESULT result[3];
+   const struct IOCHAIN* chain;
+   unsigned long smarten;
+   int i, cycles;
+
+   CHECK(setup_raspidapter(1) == 0);
+   chain = iochain_default();
+   for(i=0; i < 3; i++)
+   {
+      CHECK(sim_add_tmc(chain,1,i+1) == 0);
+      CHECK(dice_tmc_setup(&tmc[i],1,i+1) == 0);
+      CHECK(dice_tmc_start(&tmc[i]) == 0);
+      dice_tmc_setCoolStepConfiguration(&tmc[i],64,96,1,1,COOL_STEP_HALF_CS_LIMIT);
+      dice_tmc_setCoolStepEnabled(&tmc[i],0);
+      dice_tmc_readStatus(&tmc[i],TMC26X_READOUT_POSITION);
+      dice[i] = &tmc[i];
+   }
+   smarten = sim_tmc_register(chain,1,3,2);
+
+   dice_tmc_cooltune_defaults(&config);
+   config.levels = 3;
+   for(i=0; i < config.levels; i++)
+      config.step_ns[i] = 10000;
+   config.load = check_cooltune_load;
+   config.arg = (void*)chain;
+
+   CHECK(dice_tmc_cooltune(dice,3,&config,result) == 1);
+
+   //span 400 from 300: thresholds at a quarter and three quarters, a wide margin and no noise
+   CHECK(result[0].sg_low == 300 && result[0].sg_high == 700 && result[0].noise == 0);
+   CHECK(result[0].lower_threshold == 384);
+   CHECK(result[0].hysteresis == 184);
+   CHECK(result[0].increment == 0);
+   CHECK(result[0].decrement == 2);
+   CHECK(result[0].minimum == COOL_STEP_HALF_CS_LIMIT);
+   CHECK(sim_tmc_register(chain,1,1,2) == 0xA450C);
+
+   //flat at 600: half the loaded reading, a quarter current
+   CHECK(result[1].sg_low == 600 && result[1].sg_high == 620);
+   CHECK(result[1].lower_threshold == 288);
+   CHECK(result[1].hysteresis == 44);
+   CHECK(result[1].increment == 0);
+   CHECK(result[1].decrement == 2);
+   CHECK(result[1].minimum == COOL_STEP_QUARTDER_CS_LIMIT);
+   CHECK(sim_tmc_register(chain,1,2,2) == 0xAC109);
+
+   //the hot driver keeps CoolStep off
+   CHECK(result[2].overtemperature == 1);
+   CHECK(sim_tmc_register(chain,1,3,2) == smarten);
+   CHECK(dice_tmc_isCoolStepEnabled(&tmc[2]) == 0);
+
+   for(i=0; i < 3; i++)
+      CHECK(dice_tmc_getReadoutSelection(&tmc[i]) == TMC26X_READOUT_POSITION);
+
+   //stopped while measuring
+   CHECK(estop_arm(dice,1) == 0);
+   cycles = 20*chain->chain_bits;
+   sim_set_clock_hook(check_trigger_hook,&cycles);
+   CHECK(dice_tmc_cooltune(dice,1,&config,result) == ERR_ESTOP);
+   sim_set_clock_hook(0,0);
+   estop_wait_done();
+
+   //left to the worker: all registers sent again with the chopper off
+   CHECK((sim_tmc_register(chain,1,1,1) & 0xf) == 0);
+   CHECK(dice_tmc_getDirty(&tmc[0]) == 0);
+   CHECK(estop_release() == 0);
+   CHECK(estop_disarm() == 0);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  DICE table
+////////////////////////////////////////////
+
+// bad indexes and DICE which can not step are refused before anything is touched
+static void check_table_index()
+{
+   struct DICE_TABLE table;
+   struct DICE stk, vn;
+   struct IOCHAIN_PINSET set;
+   int index[2];
+
+   CHECK(setup_raspidapter(2) == 0);
+   CHECK(dice_stk_setup(&stk,1,1) == 0);
+   CHECK(dice_vn_setup(&vn,2,1,1) == 0);
+   CHECK(dice_table_init(&table,4) == 0);
+   CHECK(dice_table_add(&table,&stk) == 0);
+   CHECK(dice_table_add(&table,&vn) == 1);
+
+   index[0] = -1;
+   CHECK(dice_table_pinset(&table,DICE_PIN_STEP,index,1,&set) == ERR_PARAM);
+   index[0] = 2;
+   CHECK(dice_table_pinset(&table,DICE_PIN_STEP,index,1,&set) == ERR_PARAM);
+   index[0] = 0;
+   CHECK(dice_table_pinset(&table,DICE_PIN_STEP,index,1,&set) == 0);
+
+   index[1] = 1;
+   CHECK(dice_table_step(&table,index,2) == ERR_PARAM);
+   CHECK(dice_get_steps(&stk) == 0);
+   CHECK(dice_table_step(&table,index,1) == 0);
+   CHECK(dice_get_steps(&stk) == 1);
+   dice_table_free(&table);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  motion profiles
+////////////////////////////////////////////
+
+// the intervals of a move of steps steps
+static int check_move_intervals(const struct DICE_PROFILE* profile,long steps,unsigned int* interval)
+{
+   struct DICE_MOVE move;
+   int n = 0;
+
+   CHECK(dice_move_init(&move,profile,steps) == 0);
+   while((interval[n] = dice_move_next(&move)) != 0)
+      n++;
+   return n;
+}
+
+// ramp tables against the closed forms, deceleration mirrors acceleration,
+// short moves meet in the middle without running faster than cruise
+static void check_profile()
+{
+   struct DICE_PROFILE trapezoid, scurve;
+   static unsigned int interval[256];
+   double sum, expected;
+   unsigned int i;
+   int k, n;
+
+   //trapezoid: t(s) = sqrt(2s/a), v/a = 100ms for 50 steps
+   CHECK(dice_profile_init(&trapezoid,1000,10000,0) == 0);
+   CHECK(trapezoid.ramp_steps == 50);
+   CHECK(trapezoid.cruise_ns == 1000000);
+   sum = 0.0;
+   for(i=0; i < trapezoid.ramp_steps; i++)
+   {
+      expected = (sqrt(2.0*(i+1)/10000) - sqrt(2.0*i/10000))*1e9;
+      CHECK(fabs(trapezoid.ramp[i] - expected) <= 1.0);
+      CHECK(i == 0 || trapezoid.ramp[i] <= trapezoid.ramp[i-1]);
+      sum += trapezoid.ramp[i];
+   }
+   CHECK(fabs(sum - 100e6) <= trapezoid.ramp_steps);
+
+   //S-curve: jerk limited for a/j = 100ms, then jerked down again - 200ms, v*200ms/2 = 100 steps.
+   //the first step falls into the jerk phase, s = j t^3/6
+   CHECK(dice_profile_init(&scurve,1000,10000,100000) == 0);
+   CHECK(scurve.ramp_steps == 100);
+   CHECK(scurve.cruise_ns == 1000000);
+   CHECK(fabs(scurve.ramp[0] - cbrt(6.0/100000)*1e9) <= 2.0);
+   sum = 0.0;
+   for(i=0; i < scurve.ramp_steps; i++)
+   {
+      CHECK(scurve.ramp[i] >= scurve.cruise_ns);
+      CHECK(i == 0 || scurve.ramp[i] <= scurve.ramp[i-1]);
+      sum += scurve.ramp[i];
+   }
+   CHECK(fabs(sum - 200e6) <= scurve.ramp_steps);
+
+   //the S-curve starts softer and takes longer to cruise
+   CHECK(scurve.ramp[0] > trapezoid.ramp[0]);
+   CHECK(scurve.ramp_steps > trapezoid.ramp_steps);
+
+   //a long move: ramp, cruise, mirrored ramp
+   n = check_move_intervals(&trapezoid,200,interval);
+   CHECK(n == 200);
+   for(k=0; k < n; k++)
+   {
+      CHECK(interval[k] == interval[n-1-k]);
+      if(k < (int)trapezoid.ramp_steps)
+         CHECK(interval[k] == trapezoid.ramp[k]);
+      else if(k < n - (int)trapezoid.ramp_steps)
+         CHECK(interval[k] == trapezoid.cruise_ns);
+   }
+
+   //short moves, odd and even: never faster than cruise, the fastest step in the middle
+   for(k=0; k < 2; k++)
+   {
+      const struct DICE_PROFILE* profile = k == 0 ? &trapezoid : &scurve;
+      long steps;
+
+      for(steps=profile->ramp_steps-1; steps <= profile->ramp_steps; steps++)
+      {
+         unsigned int fastest = ~0u;
+         int j;
+
+         n = check_move_intervals(profile,steps,interval);
+         CHECK(n == steps);
+         for(j=0; j < n; j++)
+         {
+            CHECK(interval[j] >= profile->cruise_ns);
+            CHECK(interval[j] == interval[n-1-j]);
+            if(interval[j] < fastest)
+               fastest = interval[j];
+         }
+         CHECK(fastest == profile->ramp[(n-1)/2]);
+      }
+   }
+
+   dice_profile_free(&trapezoid);
+   dice_profile_free(&scurve);
+}
+
+////////////////////////////////////////////
+//  step tracking
+////////////////////////////////////////////
+
+// the velocity average follows a run and starts again after a pause
+static void check_track_pause()
+{
+   struct DICE tmc;
+   struct DICE_TRACK track;
+   int i;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,1) == 0);
+   CHECK(dice_tmc_setup(&tmc,1,1) == 0);
+   CHECK(dice_tmc_start(&tmc) == 0);
+   CHECK(dice_tmc_dir(&tmc,1) == 0);
+
+   for(i=0; i < 8; i++)
+   {
+      timing_wait_until(timing_now_ns() + 1000000);
+      CHECK(dice_tmc_step(&tmc) == 0);
+   }
+   CHECK(dice_get_track(&tmc,&track) == 0);
+   CHECK(track.interval_ns >= 1000000 && track.interval_ns < 4000000);
+   CHECK(dice_get_velocity(&tmc) > 0.0);
+
+   //the first step after a pause has no interval
+   timing_wait_until(timing_now_ns() + 20*track.interval_ns);
+   CHECK(dice_tmc_step(&tmc) == 0);
+   CHECK(dice_get_track(&tmc,&track) == 0);
+   CHECK(track.interval_ns == 0);
+   CHECK(dice_get_velocity(&tmc) == 0.0);
+
+   //the next one starts the average at its own interval
+   timing_wait_until(timing_now_ns() + 2000000);
+   CHECK(dice_tmc_step(&tmc) == 0);
+   CHECK(dice_get_track(&tmc,&track) == 0);
+   CHECK(track.interval_ns >= 2000000 && track.interval_ns < 8000000);
+   CHECK(track.steps == 10 && track.position == 10);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  step scheduler
+////////////////////////////////////////////
+
+// repeated events of one DICE inside the merge window must land in separate frames
+static void check_sched_merge()
+{
+   struct DICE toggle, pulse;
+   struct STEPSCHED_STATS stats;
+   unsigned long long t;
+   int toggle_start, pulse_start;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,2) == 0);
+   CHECK(dice_tmc_setup(&toggle,1,1) == 0);
+   CHECK(dice_tmc_setup(&pulse,1,2) == 0);
+   CHECK(dice_tmc_start(&toggle) == 0);
+   CHECK(dice_tmc_start(&pulse) == 0);
+   dice_tmc_setMicrosteps(&toggle,256);
+   dice_tmc_setMicrosteps(&pulse,256);
+   dice_tmc_setDoubleEdge(&toggle,1);
+   dice_tmc_setDoubleEdge(&pulse,0);
+   toggle_start = sim_tmc_position(iochain_default(),1,1);
+   pulse_start = sim_tmc_position(iochain_default(),1,2);
+
+   CHECK(stepsched_start(64,0) == 0);
+   t = timing_now_ns() + 1000000;
+   stepsched_dir(&toggle,1,t);
+   stepsched_dir(&pulse,1,t);
+   stepsched_step(&toggle,t);
+   stepsched_step(&pulse,t);
+   stepsched_step(&toggle,t+300);
+   stepsched_step(&pulse,t+300);
+   stepsched_dir(&toggle,0,t+600);
+   stepsched_step(&toggle,t+600);
+   stepsched_wait_idle();
+   stepsched_get_stats(&stats);
+   stepsched_stop();
+
+   //dirs | steps | steps | dir | step
+   CHECK(stats.events == 8);
+   CHECK(stats.frames == 5);
+   CHECK(stats.dropped == 0);
+   CHECK(sim_tmc_position(iochain_default(),1,1) == ((toggle_start + 1) & 0x3ff));
+   CHECK(sim_tmc_position(iochain_default(),1,2) == ((pulse_start + 2) & 0x3ff));
+   CHECK(dice_get_position(&toggle) == 1);
+   CHECK(dice_get_position(&pulse) == 2);
+   CHECK(dice_get_steps(&toggle) == 3);
+   deinit_raspidapter();
+}
+
+// a batch closes before it touches more chain groups than one frame can hold - nothing is lost
+static void check_sched_chains()
+{
+   struct IOCHAIN chains[IOCHAIN_MAX_CHAINS+1];
+   struct DICE dice[IOCHAIN_MAX_CHAINS+1];
+   struct STEPSCHED_STATS stats;
+   unsigned long long t;
+   int k;
+
+   CHECK(setup_raspidapter(1) == 0);
+   for(k=0; k <= IOCHAIN_MAX_CHAINS; k++)
+   {
+      int data = 2 + k;
+      CHECK(iochain_init(&chains[k],1,1,&data,11 + k,20 + k,-1) == 0);
+      iochain_select(&chains[k]);
+      CHECK(dice_stk_setup(&dice[k],1,1) == 0);
+   }
+
+   CHECK(stepsched_start(64,0) == 0);
+   t = timing_now_ns() + 1000000;
+   for(k=0; k <= IOCHAIN_MAX_CHAINS; k++)
+      stepsched_step(&dice[k],t);
+   stepsched_wait_idle();
+   stepsched_get_stats(&stats);
+   stepsched_stop();
+
+   CHECK(stats.events == IOCHAIN_MAX_CHAINS+1);
+   CHECK(stats.frames == 2);
+   for(k=0; k <= IOCHAIN_MAX_CHAINS; k++)
+   {
+      CHECK(dice_get_steps(&dice[k]) == 1);
+      iochain_deinit(&chains[k]);
+   }
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  programs
+////////////////////////////////////////////
+
+#define CHECK_PROGRAM_FILE "/tmp/raspidapter_check.prog"
+
+// repeated events of one DICE inside the merge window are compiled into separate frames,
+// the step mode is recorded and checked
+static void check_program_merge()
+{
+   struct DICE toggle, pulse;
+   struct DICE* dice[2];
+   struct PROGRAM_EVENT events[6];
+   struct PROGRAM program;
+   struct PROGRAM_STATS stats;
+   int toggle_start, pulse_start;
+
+   CHECK(setup_raspidapter(1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,1) == 0);
+   CHECK(sim_add_tmc(iochain_default(),1,2) == 0);
+   CHECK(dice_tmc_setup(&toggle,1,1) == 0);
+   CHECK(dice_tmc_setup(&pulse,1,2) == 0);
+   CHECK(dice_tmc_start(&toggle) == 0);
+   CHECK(dice_tmc_start(&pulse) == 0);
+   dice_tmc_setMicrosteps(&toggle,256);
+   dice_tmc_setMicrosteps(&pulse,256);
+   dice_tmc_setDoubleEdge(&toggle,1);
+   toggle_start = sim_tmc_position(iochain_default(),1,1);
+   pulse_start = sim_tmc_position(iochain_default(),1,2);
+
+   events[0] = (struct PROGRAM_EVENT){ 0, &toggle, PROGRAM_DIR, 1 };
+   events[1] = (struct PROGRAM_EVENT){ 0, &toggle, PROGRAM_STEP, 0 };
+   events[2] = (struct PROGRAM_EVENT){ 100, &toggle, PROGRAM_STEP, 0 };
+   events[3] = (struct PROGRAM_EVENT){ 0, &pulse, PROGRAM_DIR, 1 };
+   events[4] = (struct PROGRAM_EVENT){ 0, &pulse, PROGRAM_STEP, 0 };
+   events[5] = (struct PROGRAM_EVENT){ 100, &pulse, PROGRAM_STEP, 0 };
+   CHECK(program_compile(CHECK_PROGRAM_FILE,iochain_default(),events,6,2000,1000) == 0);
+   CHECK(program_open(&program,CHECK_PROGRAM_FILE) == 0);
+
+   //dirs | steps | pulse end | steps | pulse end
+   CHECK(program.header->num_records == 5);
+   dice[0] = &toggle;
+   dice[1] = &pulse;
+   CHECK(program_play(&program,iochain_default(),dice,2,&stats) == 0);
+   CHECK(stats.records == 5);
+   CHECK(sim_tmc_position(iochain_default(),1,1) == ((toggle_start + 2) & 0x3ff));
+   CHECK(sim_tmc_position(iochain_default(),1,2) == ((pulse_start + 2) & 0x3ff));
+   CHECK(dice_get_steps(&toggle) == 2 && dice_get_position(&toggle) == 2);
+   CHECK(dice_get_steps(&pulse) == 2 && dice_get_position(&pulse) == 2);
+
+   //every stepped DICE in the compiled mode
+   CHECK(program_play(&program,iochain_default(),dice,1,0) == ERR_PARAM);
+   dice_tmc_setDoubleEdge(&toggle,0);
+   CHECK(program_play(&program,iochain_default(),dice,2,0) == ERR_PARAM);
+
+   //a stop ends the program
+   dice_tmc_setDoubleEdge(&toggle,1);
+   CHECK(estop_arm(dice,2) == 0);
+   CHECK(estop_trigger() == 0);
+   CHECK(program_play(&program,iochain_default(),dice,2,0) == ERR_ESTOP);
+   CHECK(estop_release() == 0);
+   CHECK(estop_disarm() == 0);
+
+   program_close(&program);
+   unlink(CHECK_PROGRAM_FILE);
+   deinit_raspidapter();
+}
+
+////////////////////////////////////////////
+//  main
+////////////////////////////////////////////
+
+struct CHECK_ENTRY
+{
+   const char* name;
+   void (*run)();
+};
+
+const struct CHECK_ENTRY checks[] =
+{
+   { "sim_threads", check_sim_threads },
+   { "tx_threads", check_tx_threads },
+   { "spi_profiles", check_spi_profiles },
+   { "tc_decode", check_tc_decode },
+   { "tc_sampler", check_tc_sampler },
+   { "wave_replay", check_wave_replay },
+   { "wave_estop", check_wave_estop },
+   { "wave_latch", check_wave_latch },
+   { "expander_shadow", check_expander_shadow },
+   { "tmc_shadow", check_tmc_shadow },
+   { "tmc_broadcast", check_tmc_broadcast },
+   { "tmc_readout", check_tmc_readout },
+   { "tmc_transaction", check_tmc_transaction },
+   { "tmc_estop_keep", check_tmc_estop_keep },
+   { "estop_midframe", check_estop_midframe },
+   { "estop_runners", check_estop_runners },
+   { "estop_rollback", check_estop_rollback },
+   { "tmc_home", check_tmc_home },
+   { "cooltune", check_cooltune },
+   { "table_index", check_table_index },
+   { "profile", check_profile },
+   { "track_pause", check_track_pause },
+   { "sched_merge", check_sched_merge },
+   { "sched_chains", check_sched_chains },
+   { "program_merge", check_program_merge },
+};
+
+int main(int argc, char** argv)
+{
+   int i, a;
+   int n = sizeof(checks)/sizeof(checks[0]);
+
+   for(i=0; i < n; i++)
+   {
+      int selected = argc < 2;
+      int before = failures;
+
+      for(a=1; a < argc; a++)
+      {
+         if(strcmp(argv[a],checks[i].name) == 0)
+            selected = 1;
+      }
+      if(!selected)
+         continue;
+
+      current = checks[i].name;
+      checks[i].run();
+      printf("%s %s\n",failures == before ? "ok  " : "FAIL",checks[i].name);
+   }
+
+   printf("%d failed\n",failures);
+   return failures != 0;
+}
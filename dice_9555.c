@@ -23,6 +23,7 @@
 
 #include "raspidapter_common.h"
 #include "dice_9555.h"
+#include "dice_expander.h"
 
 #define PTR_INPUT_REG 0
 #define PTR_OUTPUT_REG 2
@@ -50,48 +51,46 @@ int dice_9555_setup(struct DICE* dice,int board, int slot,int number)
    dice->type = DICE_9555;
 
    //calc bit numbers
-   dice->enable = (board-1)*32 + (slot-1)*8 + 0;
-   dice->ms1 = (board-1)*32 + (slot-1)*8 + 4;
-   dice->ms2 = (board-1)*32 + (slot-1)*8 + 5;
-   dice->ms3 = (board-1)*32 + (slot-1)*8 + 1;
-   dice->rs = (board-1)*32 + (slot-1)*8 + 2;
-   dice->dir = (board-1)*32 + (slot-1)*8 + 3;
-   dice->step = (board-1)*32 + (slot-1)*8 + 6;
-   dice->slp = (board-1)*32 + (slot-1)*8 + 7;
+   int ret = dice_setup_pins(dice,board,slot);
+   if(ret != 0)
+     return ret;
 
    // set address bits
    if( (number-1) & (1<<0))
-     iochain_setbit(dice->ms1);
-   else iochain_clearbit(dice->ms1);
+     iochain_ctx_setbit(dice->chain,dice->ms1);
+   else iochain_ctx_clearbit(dice->chain,dice->ms1);
    if( (number-1) && (1<<1))
-     iochain_setbit(dice->ms2);
-   else iochain_clearbit(dice->ms1);
+     iochain_ctx_setbit(dice->chain,dice->ms2);
+   else iochain_ctx_clearbit(dice->chain,dice->ms1);
    if( (number-1) && (1<<2))
-     iochain_setbit(dice->ms3);
+     iochain_ctx_setbit(dice->chain,dice->ms3);
    else
-     iochain_clearbit(dice->ms1);
+     iochain_ctx_clearbit(dice->chain,dice->ms1);
 
-   iochain_update();
+   iochain_ctx_update(dice->chain);
    //store address
    dice->i2c_addr = DEV_BASE_ADDR | (number -1);
 
+   //the registers are written through the shadow
+   dice_expander_setup(dice,2,PTR_OUTPUT_REG,PTR_POL_REG,PTR_CONFIG_REG);
+
    return 0;
 }
 
 
 int dice_9555_setoutput(struct DICE* dice,int pins)
 {
-   return write_i2c(dice->i2c_addr,PTR_CONFIG_REG,2,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_CONFIG,pins);
 }
 
 int dice_9555_setpolarity(struct DICE* dice,int pins)
 {
-    return write_i2c(dice->i2c_addr,PTR_POL_REG,2,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_POLARITY,pins);
 }
 
 int dice_9555_set(struct DICE* dice, int pins)
 {
-   return write_i2c(dice->i2c_addr,PTR_OUTPUT_REG,2,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_OUTPUT,pins);
 }
 
 int dice_9555_read(struct DICE* dice, int pins)
@@ -0,0 +1,170 @@
+//
+// Raspidapter library
+//
+// common DICE implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "raspidapter_common.h"
+#include "dice_common.h"
+#include "raspidapter_timing.h"
+
+#include <string.h>
+
+// weight of a new step interval in the smoothed one: 1/2^DICE_TRACK_SMOOTH
+#define DICE_TRACK_SMOOTH 2
+// a step later than this many smoothed intervals ends a run, the next step starts a new average
+#define DICE_TRACK_PAUSE 4
+
+int dice_setup_pins(struct DICE* dice,int board, int slot)
+{
+   struct IOCHAIN* chain = iochain_selected();
+
+   if(chain == NULL)
+     return ERR_INIT;
+
+   //the bit numbers follow the chain topology
+   dice->chain = chain;
+   dice->enable = iochain_bit(chain,board,slot,0);
+   dice->ms1 = iochain_bit(chain,board,slot,4);
+   dice->ms2 = iochain_bit(chain,board,slot,5);
+   dice->ms3 = iochain_bit(chain,board,slot,1);
+   dice->rs = iochain_bit(chain,board,slot,2);
+   dice->dir = iochain_bit(chain,board,slot,3);
+   dice->step = iochain_bit(chain,board,slot,6);
+   dice->slp = iochain_bit(chain,board,slot,7);
+
+   //board or slot out of range
+   if(dice->enable < 0)
+     return dice->enable;
+
+   //the dir pin starts low
+   memset(&dice->track,0,sizeof(struct DICE_TRACK));
+   dice->track.direction = -1;
+   dice->track.last_direction = -1;
+
+   return 0;
+}
+
+static void dice_track_write_begin(struct DICE_TRACK* t)
+{
+   __atomic_add_fetch(&t->seq,1,__ATOMIC_ACQ_REL);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void dice_track_write_end(struct DICE_TRACK* t)
+{
+   __atomic_add_fetch(&t->seq,1,__ATOMIC_RELEASE);
+}
+
+void dice_track_step(struct DICE* dice)
+{
+   struct DICE_TRACK* t = &dice->track;
+   unsigned long long now = timing_now_ns();
+
+   dice_track_write_begin(t);
+   t->position += t->direction;
+   if(t->steps > 0)
+   {
+      unsigned long long dt = now - t->last_ns;
+      //the first step after a pause has no interval, a reversal starts the average again
+      if(t->interval_ns != 0 && dt > DICE_TRACK_PAUSE * t->interval_ns)
+         t->interval_ns = 0;
+      else if(t->interval_ns == 0 || t->last_direction != t->direction)
+         t->interval_ns = dt;
+      else
+         t->interval_ns += ((long long)dt - (long long)t->interval_ns) / (1 << DICE_TRACK_SMOOTH);
+   }
+   t->steps++;
+   t->last_ns = now;
+   t->last_direction = t->direction;
+   dice_track_write_end(t);
+}
+
+void dice_track_dir(struct DICE* dice,int dir)
+{
+   struct DICE_TRACK* t = &dice->track;
+
+   dice_track_write_begin(t);
+   t->direction = dir ? 1 : -1;
+   dice_track_write_end(t);
+}
+
+int dice_get_track(struct DICE* dice,struct DICE_TRACK* track)
+{
+   unsigned int seq;
+
+   if(dice == NULL || track == NULL)
+     return ERR_PARAM;
+
+   for(;;)
+   {
+     seq = __atomic_load_n(&dice->track.seq,__ATOMIC_ACQUIRE);
+     if(seq & 1)
+       continue;
+     *track = dice->track;
+     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+     if(__atomic_load_n(&dice->track.seq,__ATOMIC_RELAXED) == seq)
+       return 0;
+   }
+}
+
+long long dice_get_position(struct DICE* dice)
+{
+   struct DICE_TRACK t;
+
+   if(dice_get_track(dice,&t) != 0)
+     return 0;
+   return t.position;
+}
+
+int dice_set_position(struct DICE* dice,long long position)
+{
+   if(dice == NULL)
+     return ERR_PARAM;
+
+   dice_track_write_begin(&dice->track);
+   dice->track.position = position;
+   dice_track_write_end(&dice->track);
+   return 0;
+}
+
+unsigned long long dice_get_steps(struct DICE* dice)
+{
+   struct DICE_TRACK t;
+
+   if(dice_get_track(dice,&t) != 0)
+     return 0;
+   return t.steps;
+}
+
+double dice_get_velocity(struct DICE* dice)
+{
+   struct DICE_TRACK t;
+   unsigned long long since;
+   unsigned long long interval;
+
+   if(dice_get_track(dice,&t) != 0 || t.interval_ns == 0)
+     return 0.0;
+
+   //a step overdue slows the estimate down
+   since = timing_now_ns() - t.last_ns;
+   interval = since > t.interval_ns ? since : t.interval_ns;
+   return t.last_direction * 1e9 / (double)interval;
+}
@@ -30,18 +30,35 @@
 #define DICE_9555 2
 #define DICE_VN 3
 #define DICE_TMC 4
+#define DICE_TC 5
 
 
+struct IOCHAIN;
+
 // ERROR codes
 // ERR_PARAM and ERR_INIT are define in the rapidapter_common header
 
-#define NUM_USER_VALUES 8
+#define NUM_USER_VALUES 28
+
+// motion of a stepper DICE - written by the thread stepping it, read lock free
+// through dice_get_track (a seqlock: readers retry while seq is odd or changed)
+struct DICE_TRACK
+{
+   unsigned int seq;
+   int direction;                 // 1 or -1, the level of the dir pin
+   long long position;            // steps in direction 1 minus steps in direction -1
+   unsigned long long steps;      // all steps
+   unsigned long long last_ns;    // time of the last step
+   unsigned long long interval_ns; // smoothed time between steps, 0 before the second step of a run
+   int last_direction;            // direction of the last step
+};
 
 //common information for all dices
 struct DICE 
 {
    //general IOs
    char type;
+   struct IOCHAIN* chain;   // the chain group the IOs are on
    int enable;
    int ms1;
    int ms2;
@@ -53,7 +70,35 @@ struct DICE
 
    int i2c_addr;
 
+   struct DICE_TRACK track;
+
    unsigned long userValues[NUM_USER_VALUES];
 };
 
+// bind a DICE to the selected chain group and calc the bit numbers of its IOs
+// used by the dice_*_setup functions
+int dice_setup_pins(struct DICE* dice,int board, int slot);
+
+// the step and dir paths keep the track of a DICE
+// dice_stk/tmc_step, dice_step(_many), dice_table_step and the step scheduler count steps,
+// dice_stk/tmc_dir, dice_dir_many and dice_table_write of the dir pin set the direction.
+// program_play counts the steps and directions of the DICE it is given, a waveform is not counted.
+void dice_track_step(struct DICE* dice);
+void dice_track_dir(struct DICE* dice,int dir);
+
+// a consistent copy of the track
+int dice_get_track(struct DICE* dice,struct DICE_TRACK* track);
+
+// position in steps
+long long dice_get_position(struct DICE* dice);
+
+// set the position, e.g. after homing
+int dice_set_position(struct DICE* dice,long long position);
+
+// all steps since the setup
+unsigned long long dice_get_steps(struct DICE* dice);
+
+// estimated velocity in steps per second - falls off once the steps stop
+double dice_get_velocity(struct DICE* dice);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,223 @@
+//
+// Raspidapter library
+//
+// DICE IO expander shadow implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "dice_expander.h"
+
+#include <stdint.h>
+
+//the user values
+// 0-2 the shadow registers, DICE_EXPANDER_OUTPUT, _POLARITY, _CONFIG
+#define EXP_SENT 3            // 3-5: the values the chip holds, ~0 if not known
+#define EXP_POINTER 6         // 6-8: the register pointers
+#define EXP_WIDTH 9
+#define EXP_PENDING 10        // a change is not written yet
+#define EXP_PENDING_TIME 11   // time of the oldest change not written in us
+#define EXP_WINDOW 12
+#define EXP_TOUCHED 13        // bit n: register n was set - the others keep their power up value
+#define EXP_NUM_REGISTERS 3
+
+// written in this order - outputs and polarity settle before pins turn to outputs
+static const int exp_order[EXP_NUM_REGISTERS] = { DICE_EXPANDER_POLARITY, DICE_EXPANDER_OUTPUT, DICE_EXPANDER_CONFIG };
+
+static unsigned long exp_now_us()
+{
+   return (unsigned long)(uint32_t)(timing_now_ns()/1000);
+}
+
+static unsigned int exp_mask(struct DICE* dice)
+{
+   return dice->userValues[EXP_WIDTH] == 2 ? 0xffff : 0xff;
+}
+
+static int exp_changed(struct DICE* dice,int reg)
+{
+   return (dice->userValues[EXP_TOUCHED] & (1ul << reg)) && dice->userValues[reg] != dice->userValues[EXP_SENT+reg];
+}
+
+static int exp_dirty(struct DICE* dice)
+{
+   int reg;
+   for(reg=0; reg < EXP_NUM_REGISTERS; reg++)
+   {
+      if(exp_changed(dice,reg))
+         return 1;
+   }
+   return 0;
+}
+
+void dice_expander_setup(struct DICE* dice,int width,int output_reg,int polarity_reg,int config_reg)
+{
+   //the power up values: outputs high, no inversion, all pins inputs
+   dice->userValues[EXP_WIDTH] = width == 2 ? 2 : 1;
+   dice->userValues[DICE_EXPANDER_OUTPUT] = exp_mask(dice);
+   dice->userValues[DICE_EXPANDER_POLARITY] = 0;
+   dice->userValues[DICE_EXPANDER_CONFIG] = exp_mask(dice);
+   dice->userValues[EXP_POINTER+DICE_EXPANDER_OUTPUT] = output_reg;
+   dice->userValues[EXP_POINTER+DICE_EXPANDER_POLARITY] = polarity_reg;
+   dice->userValues[EXP_POINTER+DICE_EXPANDER_CONFIG] = config_reg;
+   dice->userValues[EXP_WINDOW] = 0;
+   dice->userValues[EXP_TOUCHED] = 0;
+   dice_expander_invalidate(dice);
+}
+
+void dice_expander_invalidate(struct DICE* dice)
+{
+   int reg;
+   for(reg=0; reg < EXP_NUM_REGISTERS; reg++)
+      dice->userValues[EXP_SENT+reg] = ~0ul;
+   dice->userValues[EXP_PENDING] = 0;
+}
+
+// write one register - on the 9555 only the port that changed if the other did not
+static int exp_write_register(struct DICE* dice,int reg)
+{
+   unsigned long value = dice->userValues[reg];
+   unsigned long sent = dice->userValues[EXP_SENT+reg];
+   char pointer = (char)dice->userValues[EXP_POINTER+reg];
+   char data[2];
+   int ret;
+
+   data[0] = value & 0xff;
+   data[1] = (value >> 8) & 0xff;
+
+   if(dice->userValues[EXP_WIDTH] == 2 && sent != ~0ul && ((value ^ sent) & 0xff) == 0)
+      ret = write_i2c(dice->i2c_addr,pointer+1,1,&data[1]);
+   else if(dice->userValues[EXP_WIDTH] == 2 && sent != ~0ul && ((value ^ sent) & 0xff00) == 0)
+      ret = write_i2c(dice->i2c_addr,pointer,1,&data[0]);
+   else
+      ret = write_i2c(dice->i2c_addr,pointer,dice->userValues[EXP_WIDTH],data);
+
+   if(ret == 0)
+      dice->userValues[EXP_SENT+reg] = value;
+   return ret;
+}
+
+int dice_expander_flush(struct DICE* dice)
+{
+   int i;
+   int written = 0;
+   int failed = 0;
+
+   //error checking
+   if(dice == NULL)
+      return ERR_PARAM;
+
+   for(i=0; i < EXP_NUM_REGISTERS; i++)
+   {
+      int reg = exp_order[i];
+      if(!exp_changed(dice,reg))
+         continue;
+      //pins only turn to outputs once their levels and polarity are written
+      if(reg == DICE_EXPANDER_CONFIG && failed)
+         continue;
+      //a failed register stays changed and is written again with the next flush
+      if(exp_write_register(dice,reg) != 0)
+      {
+         failed = 1;
+         continue;
+      }
+      written++;
+   }
+   if(failed)
+      return ERR_I2C;
+   dice->userValues[EXP_PENDING] = 0;
+   return written;
+}
+
+int dice_expander_poll(struct DICE* dice)
+{
+   //error checking
+   if(dice == NULL)
+      return ERR_PARAM;
+
+   if(!dice->userValues[EXP_PENDING])
+      return 0;
+   if((uint32_t)(exp_now_us() - dice->userValues[EXP_PENDING_TIME]) < dice->userValues[EXP_WINDOW])
+      return 0;
+   return dice_expander_flush(dice);
+}
+
+int dice_expander_write(struct DICE* dice,int reg,unsigned int value)
+{
+   //error checking
+   if(dice == NULL || reg < 0 || reg >= EXP_NUM_REGISTERS)
+      return ERR_PARAM;
+
+   dice->userValues[reg] = value & exp_mask(dice);
+   dice->userValues[EXP_TOUCHED] |= 1ul << reg;
+
+   //a change back to what the chip holds needs no write
+   if(!exp_dirty(dice))
+   {
+      dice->userValues[EXP_PENDING] = 0;
+      return 0;
+   }
+   if(!dice->userValues[EXP_PENDING])
+   {
+      dice->userValues[EXP_PENDING] = 1;
+      dice->userValues[EXP_PENDING_TIME] = exp_now_us();
+   }
+
+   if(dice_expander_poll(dice) < 0)
+      return ERR_I2C;
+   return 0;
+}
+
+int dice_expander_setbits(struct DICE* dice,int reg,unsigned int mask)
+{
+   if(dice == NULL || reg < 0 || reg >= EXP_NUM_REGISTERS)
+      return ERR_PARAM;
+   return dice_expander_write(dice,reg,dice->userValues[reg] | mask);
+}
+
+int dice_expander_clearbits(struct DICE* dice,int reg,unsigned int mask)
+{
+   if(dice == NULL || reg < 0 || reg >= EXP_NUM_REGISTERS)
+      return ERR_PARAM;
+   return dice_expander_write(dice,reg,dice->userValues[reg] & ~mask);
+}
+
+int dice_expander_togglebits(struct DICE* dice,int reg,unsigned int mask)
+{
+   if(dice == NULL || reg < 0 || reg >= EXP_NUM_REGISTERS)
+      return ERR_PARAM;
+   return dice_expander_write(dice,reg,dice->userValues[reg] ^ mask);
+}
+
+unsigned int dice_expander_get(struct DICE* dice,int reg)
+{
+   if(dice == NULL || reg < 0 || reg >= EXP_NUM_REGISTERS)
+      return 0;
+   return (unsigned int)dice->userValues[reg];
+}
+
+void dice_expander_set_window(struct DICE* dice,unsigned long window_us)
+{
+   dice->userValues[EXP_WINDOW] = window_us;
+}
+
+unsigned long dice_expander_get_window(struct DICE* dice)
+{
+   return dice->userValues[EXP_WINDOW];
+}
@@ -0,0 +1,72 @@
+//
+// Raspidapter Library Code
+//
+// DICE IO expander shadow header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef DICE_EXPANDER_H
+#define DICE_EXPANDER_H
+
+#include "dice_common.h"
+
+// Shadow of the output, polarity and config register of an i2c expander DICE
+// (DICE-VN, DICE-9555). The setters change the shadow, a flush writes only the
+// registers - on the 9555 only the ports - that differ from what the chip holds.
+// With a window set, changes are collected and written once the oldest of them is
+// older than the window; call dice_expander_poll regularly then to bound the delay.
+// With a window of 0 (the default) every change is written at once.
+// A register is written the first time it is set, registers never set keep the
+// power up value of the chip.
+
+#define DICE_EXPANDER_OUTPUT 0
+#define DICE_EXPANDER_POLARITY 1
+#define DICE_EXPANDER_CONFIG 2
+
+// used by the dice setup functions
+// width - register width in bytes, 1 or 2
+// output_reg, polarity_reg, config_reg - the register pointers of the chip
+void dice_expander_setup(struct DICE* dice,int width,int output_reg,int polarity_reg,int config_reg);
+
+// set a whole register
+int dice_expander_write(struct DICE* dice,int reg,unsigned int value);
+
+// set, clear or toggle the bits of mask in a register
+int dice_expander_setbits(struct DICE* dice,int reg,unsigned int mask);
+int dice_expander_clearbits(struct DICE* dice,int reg,unsigned int mask);
+int dice_expander_togglebits(struct DICE* dice,int reg,unsigned int mask);
+
+// the shadow value of a register
+unsigned int dice_expander_get(struct DICE* dice,int reg);
+
+// write the changed registers now - returns the number of i2c writes or ERR_I2C
+// A failed register does not stop the others, except that the config waits for the
+// outputs and polarity. The failed ones stay changed for the next flush or poll.
+int dice_expander_flush(struct DICE* dice);
+
+// write the changed registers if the oldest change is older than the window
+int dice_expander_poll(struct DICE* dice);
+
+// the window in us changes are collected for, 0 writes every change at once
+void dice_expander_set_window(struct DICE* dice,unsigned long window_us);
+unsigned long dice_expander_get_window(struct DICE* dice);
+
+// forget what the chip holds, e.g. after it was reset - the next flush writes everything
+void dice_expander_invalidate(struct DICE* dice);
+
+#endif
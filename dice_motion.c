@@ -0,0 +1,177 @@
+//
+// Raspidapter test suite
+//
+// dice motion implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+
+#include "raspidapter_common.h"
+#include "dice_motion.h"
+#include "dice_stk.h"
+#include "dice_tmc.h"
+
+static int dice_is_stepper(struct DICE* dice)
+{
+  return dice != NULL && (dice->type == DICE_STK || dice->type == DICE_TMC);
+}
+
+int dice_step(struct DICE* dice)
+{
+  //error checking
+  if(dice == NULL)
+    return ERR_PARAM;
+
+  if(dice->type == DICE_STK)
+    return dice_stk_step(dice);
+  if(dice->type == DICE_TMC)
+    return dice_tmc_step(dice);
+
+  return ERR_PARAM;
+}
+
+int dice_step_many(struct DICE** dice,int n)
+{
+  int i;
+  int ret = 0;
+
+  //error checking - before anything is touched
+  if(dice == NULL || n < 0)
+    return ERR_PARAM;
+  for(i=0; i < n; i++)
+  {
+    if(!dice_is_stepper(dice[i]))
+      return ERR_PARAM;
+  }
+
+  // transactions nest, so every chain group latches once at its last commit
+  // the step bits are pulse bits: one frame with all steps high, the next with all low
+  for(i=0; i < n; i++)
+    iochain_ctx_begin(dice[i]->chain);
+  for(i=0; i < n; i++)
+  {
+    int r = dice_step(dice[i]);
+    if(r != 0)
+      ret = r;
+  }
+  for(i=0; i < n; i++)
+  {
+    int r = iochain_ctx_commit(dice[i]->chain);
+    if(r != 0)
+      ret = r;
+  }
+
+  return ret;
+}
+
+int dice_dir_many(struct DICE** dice,const int* dir,int n)
+{
+  int i;
+  int ret = 0;
+
+  //error checking
+  if(dice == NULL || dir == NULL || n < 0)
+    return ERR_PARAM;
+  for(i=0; i < n; i++)
+  {
+    if(!dice_is_stepper(dice[i]))
+      return ERR_PARAM;
+  }
+
+  for(i=0; i < n; i++)
+    iochain_ctx_begin(dice[i]->chain);
+  for(i=0; i < n; i++)
+  {
+    int r = dice[i]->type == DICE_STK ? dice_stk_dir(dice[i],dir[i]) : dice_tmc_dir(dice[i],dir[i]);
+    if(r != 0)
+      ret = r;
+  }
+  for(i=0; i < n; i++)
+  {
+    int r = iochain_ctx_commit(dice[i]->chain);
+    if(r != 0)
+      ret = r;
+  }
+
+  return ret;
+}
+
+int dice_line_init(struct DICE_LINE* line,struct DICE** dice,const long* steps,int n)
+{
+  int dir[DICE_LINE_MAX_AXES];
+  int i;
+
+  //error checking
+  if(line == NULL || dice == NULL || steps == NULL)
+    return ERR_PARAM;
+  if(n < 1 || n > DICE_LINE_MAX_AXES)
+    return ERR_PARAM;
+
+  line->numaxes = n;
+  line->steps = 0;
+  line->tick = 0;
+  for(i=0; i < n; i++)
+  {
+    line->dice[i] = dice[i];
+    line->delta[i] = steps[i] < 0 ? -steps[i] : steps[i];
+    dir[i] = steps[i] >= 0;
+    if(line->delta[i] > line->steps)
+      line->steps = line->delta[i];
+  }
+
+  // start in the middle, so the steps of the slower axes are centered in the line
+  for(i=0; i < n; i++)
+    line->error[i] = line->steps/2;
+
+  return dice_dir_many(dice,dir,n);
+}
+
+int dice_line_tick(struct DICE_LINE* line)
+{
+  struct DICE* due[DICE_LINE_MAX_AXES];
+  int numdue = 0;
+  int i;
+
+  //error checking
+  if(line == NULL)
+    return ERR_PARAM;
+
+  if(line->tick >= line->steps)
+    return 0;
+
+  for(i=0; i < line->numaxes; i++)
+  {
+    line->error[i] += line->delta[i];
+    if(line->error[i] >= line->steps)
+    {
+      line->error[i] -= line->steps;
+      due[numdue++] = line->dice[i];
+    }
+  }
+  line->tick++;
+
+  if(numdue > 0)
+  {
+    int ret = dice_step_many(due,numdue);
+    if(ret != 0)
+      return ret;
+  }
+
+  return line->tick < line->steps;
+}
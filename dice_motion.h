@@ -0,0 +1,67 @@
+//
+// Raspidapter Library Code
+//
+// DICE motion header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef DICE_MOTION_H
+#define DICE_MOTION_H
+
+#include "dice_common.h"
+
+// coordinated stepping of STK and TMC DICE
+// all due axes step in the same latched frame, so the chain traffic of a move
+// does not depend on the number of axes
+
+#define DICE_LINE_MAX_AXES 16
+
+// step a single STK or TMC DICE
+int dice_step(struct DICE* dice);
+
+// step several STK or TMC DICE in one frame
+// dice - array of the DICE to step, may span boards and chain groups
+// n - number of DICE
+int dice_step_many(struct DICE** dice,int n);
+
+// set the direction of several STK or TMC DICE in one frame
+int dice_dir_many(struct DICE** dice,const int* dir,int n);
+
+// a straight multi axis line - bresenham/DDA over the axis with the most steps
+struct DICE_LINE
+{
+   struct DICE* dice[DICE_LINE_MAX_AXES];
+   long delta[DICE_LINE_MAX_AXES];   // steps of each axis, always positive
+   long error[DICE_LINE_MAX_AXES];
+   long steps;                       // ticks of the line - the largest delta
+   long tick;                        // ticks done
+   int numaxes;
+};
+
+// prepare a line and set the directions of all axes
+// dice - the axes, STK or TMC DICE
+// steps - signed number of steps for each axis, negative steps use direction 0
+// n - number of axes, up to DICE_LINE_MAX_AXES
+int dice_line_init(struct DICE_LINE* line,struct DICE** dice,const long* steps,int n);
+
+// do one tick of the line - steps every due axis in one frame
+// returns 1 while ticks remain, 0 when the line is done, or an error
+int dice_line_tick(struct DICE_LINE* line);
+
+#endif
@@ -0,0 +1,246 @@
+//
+// Raspidapter test suite
+//
+// dice motion profile implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_estop.h"
+#include "dice_profile.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// time limit of a single ramp interval
+#define MAX_INTERVAL_NS 4000000000.0
+
+// phases of the acceleration from standstill to max_velocity
+// jerk up for tj, constant acceleration for ta, jerk down for tj
+struct RAMP_SHAPE
+{
+   double jerk;
+   double accel;     // reached acceleration
+   double tj;
+   double ta;
+};
+
+// position at time t of the acceleration ramp
+static double ramp_position(const struct RAMP_SHAPE* r,double t)
+{
+   double s = 0.0;
+   double v = 0.0;
+   double dt;
+
+   //trapezoidal - constant acceleration only
+   if(r->tj == 0.0)
+     return r->accel*t*t/2.0;
+
+   //jerk up
+   dt = t < r->tj ? t : r->tj;
+   s = r->jerk*dt*dt*dt/6.0;
+   v = r->jerk*dt*dt/2.0;
+   t -= dt;
+   if(t <= 0.0)
+     return s;
+
+   //constant acceleration
+   dt = t < r->ta ? t : r->ta;
+   s += v*dt + r->accel*dt*dt/2.0;
+   v += r->accel*dt;
+   t -= dt;
+   if(t <= 0.0)
+     return s;
+
+   //jerk down
+   dt = t < r->tj ? t : r->tj;
+   s += v*dt + r->accel*dt*dt/2.0 - r->jerk*dt*dt*dt/6.0;
+   return s;
+}
+
+// time at which the ramp reaches position pos - the ramp is monotonic, so bisect
+static double ramp_time(const struct RAMP_SHAPE* r,double pos,double lo,double hi)
+{
+   int i;
+   for(i=0; i < 64; i++)
+   {
+     double mid = (lo+hi)/2.0;
+     if(ramp_position(r,mid) < pos)
+       lo = mid;
+     else
+       hi = mid;
+   }
+   return hi;
+}
+
+int dice_profile_init(struct DICE_PROFILE* profile,double max_velocity,double acceleration,double jerk)
+{
+   struct RAMP_SHAPE r;
+   double duration;
+   double ramp_end;
+   double last;
+   unsigned int i;
+
+   //error checking
+   if(profile == NULL)
+     return ERR_PARAM;
+   if(max_velocity <= 0.0 || acceleration <= 0.0 || jerk < 0.0)
+     return ERR_PARAM;
+   if(1e9/max_velocity > MAX_INTERVAL_NS)
+     return ERR_PARAM;
+
+   r.jerk = jerk;
+   if(jerk == 0.0)
+   {
+     r.accel = acceleration;
+     r.tj = 0.0;
+     r.ta = max_velocity/acceleration;
+   }
+   else if(max_velocity >= acceleration*acceleration/jerk)
+   {
+     r.accel = acceleration;
+     r.tj = acceleration/jerk;
+     r.ta = (max_velocity - acceleration*acceleration/jerk)/acceleration;
+   }
+   else
+   {
+     //max_velocity is reached before the full acceleration
+     r.accel = sqrt(max_velocity*jerk);
+     r.tj = r.accel/jerk;
+     r.ta = 0.0;
+   }
+   duration = 2.0*r.tj + r.ta;
+   ramp_end = ramp_position(&r,duration);
+
+   //steps until the axis runs at max_velocity
+   double ramp_steps = ceil(ramp_end);
+   if(ramp_steps < 1.0)
+     ramp_steps = 1.0;
+   if(ramp_steps > DICE_PROFILE_MAX_RAMP)
+     return ERR_PARAM;
+
+   profile->max_velocity = max_velocity;
+   profile->acceleration = acceleration;
+   profile->jerk = jerk;
+   profile->ramp_steps = (unsigned int)ramp_steps;
+   profile->cruise_ns = (unsigned int)(1e9/max_velocity + 0.5);
+   profile->ramp = malloc(sizeof(unsigned int)*profile->ramp_steps);
+   if(profile->ramp == NULL)
+     return ERR_INIT;
+
+   // the steps past the end of the ramp happen at max_velocity
+   last = 0.0;
+   for(i=0; i < profile->ramp_steps; i++)
+   {
+     double t;
+     double pos = i+1;
+     if(pos <= ramp_end)
+       t = ramp_time(&r,pos,last,duration);
+     else
+       t = duration + (pos - ramp_end)/max_velocity;
+
+     double interval = (t - last)*1e9;
+     if(interval > MAX_INTERVAL_NS)
+       interval = MAX_INTERVAL_NS;
+     if(interval < profile->cruise_ns)
+       interval = profile->cruise_ns;
+     profile->ramp[i] = (unsigned int)(interval + 0.5);
+     last = t;
+   }
+
+   return 0;
+}
+
+void dice_profile_free(struct DICE_PROFILE* profile)
+{
+   if(profile == NULL)
+     return;
+   free(profile->ramp);
+   profile->ramp = NULL;
+   profile->ramp_steps = 0;
+}
+
+int dice_move_init(struct DICE_MOVE* move,const struct DICE_PROFILE* profile,long steps)
+{
+   //error checking
+   if(move == NULL || profile == NULL || profile->ramp == NULL || steps < 0)
+     return ERR_PARAM;
+
+   move->profile = profile;
+   move->steps = steps;
+   move->step = 0;
+   return 0;
+}
+
+unsigned int dice_move_next(struct DICE_MOVE* move)
+{
+   long k = move->step;
+   long index;
+
+   if(k >= move->steps)
+     return 0;
+   move->step++;
+
+   // accelerate along the ramp, decelerate along the mirrored ramp
+   // short moves meet in the middle and never reach max_velocity
+   index = k < move->steps-1-k ? k : move->steps-1-k;
+   if(index < move->profile->ramp_steps)
+     return move->profile->ramp[index];
+   return move->profile->cruise_ns;
+}
+
+int dice_profile_move(struct DICE* dice,const struct DICE_PROFILE* profile,long steps)
+{
+   struct DICE_LINE line;
+   long s = steps;
+
+   int ret = dice_line_init(&line,&dice,&s,1);
+   if(ret != 0)
+     return ret;
+
+   return dice_profile_line(&line,profile);
+}
+
+int dice_profile_line(struct DICE_LINE* line,const struct DICE_PROFILE* profile)
+{
+   struct DICE_MOVE move;
+   unsigned long long deadline;
+   unsigned int interval;
+
+   int ret = dice_move_init(&move,profile,line == NULL ? 0 : line->steps);
+   if(line == NULL || ret != 0)
+     return ERR_PARAM;
+
+   // absolute deadlines, so the time a tick takes does not add up
+   deadline = timing_now_ns();
+   while((interval = dice_move_next(&move)) != 0)
+   {
+     deadline += interval;
+     timing_wait_until(deadline);
+     if(estop_active())
+       return ERR_ESTOP;
+     ret = dice_line_tick(line);
+     if(ret < 0)
+       return ret;
+   }
+
+   return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Raspidapter Library Code
+//
+// DICE motion profile header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef DICE_PROFILE_H
+#define DICE_PROFILE_H
+
+#include "dice_common.h"
+#include "dice_motion.h"
+
+// motion profiles for STK and TMC axes
+// The acceleration ramp of an axis is precomputed as a table of step intervals,
+// so stepping only needs a table lookup per step. Deceleration mirrors the ramp.
+
+// longest acceleration ramp a profile can hold
+#define DICE_PROFILE_MAX_RAMP 65536
+
+struct DICE_PROFILE
+{
+   double max_velocity;        // steps/s
+   double acceleration;        // steps/s^2
+   double jerk;                // steps/s^3, 0 for a trapezoidal profile
+   unsigned int* ramp;         // ns between step i and i+1 while accelerating from standstill
+   unsigned int ramp_steps;    // steps until max_velocity is reached
+   unsigned int cruise_ns;     // ns between steps at max_velocity
+};
+
+// a move of one axis (or one line) along a profile
+struct DICE_MOVE
+{
+   const struct DICE_PROFILE* profile;
+   long steps;                 // steps of the move
+   long step;                  // steps done
+};
+
+// precompute the ramp table of a profile
+// jerk 0 gives a trapezoidal profile, otherwise an S-curve
+int dice_profile_init(struct DICE_PROFILE* profile,double max_velocity,double acceleration,double jerk);
+
+// free the ramp table
+void dice_profile_free(struct DICE_PROFILE* profile);
+
+// start a move of steps steps
+int dice_move_init(struct DICE_MOVE* move,const struct DICE_PROFILE* profile,long steps);
+
+// ns to wait before the next step of the move, 0 if the move is done
+// advances the move by one step
+unsigned int dice_move_next(struct DICE_MOVE* move);
+
+// move a single STK or TMC DICE - blocks until the move is done
+// steps - signed number of steps, negative steps use direction 0
+// returns ERR_ESTOP if an emergency stop ended the move
+int dice_profile_move(struct DICE* dice,const struct DICE_PROFILE* profile,long steps);
+
+// run a prepared line, timing the ticks of its longest axis along the profile - blocks
+// returns ERR_ESTOP if an emergency stop ended the line
+int dice_profile_line(struct DICE_LINE* line,const struct DICE_PROFILE* profile);
+
+#endif
@@ -40,14 +40,9 @@ int dice_stk_setup(struct DICE* dice,int board, int slot)
    dice->type = DICE_STK;
 
    //calc bit numbers
-   dice->enable = (board-1)*32 + (slot-1)*8 + 0;
-   dice->ms1 = (board-1)*32 + (slot-1)*8 + 4;
-   dice->ms2 = (board-1)*32 + (slot-1)*8 + 5;
-   dice->ms3 = (board-1)*32 + (slot-1)*8 + 1;
-   dice->rs = (board-1)*32 + (slot-1)*8 + 2;
-   dice->dir = (board-1)*32 + (slot-1)*8 + 3;
-   dice->step = (board-1)*32 + (slot-1)*8 + 6;
-   dice->slp = (board-1)*32 + (slot-1)*8 + 7;
+   int ret = dice_setup_pins(dice,board,slot);
+   if(ret != 0)
+     return ret;
 
    return 0;
 }
@@ -60,14 +55,9 @@ int dice_stk_step(struct DICE* dice)
   if(dice->type != DICE_STK)
     return ERR_PARAM;
 
-  iochain_setbit(dice->step);
-  iochain_update();
-    
-    
-  // wait ?
-  iochain_clearbit(dice->step);
-  
-  return iochain_update();
+  dice_track_step(dice);
+  // the step bit is only high for one latched frame
+  return iochain_ctx_pulsebit(dice->chain,dice->step);
 }
 
 int dice_stk_dir(struct DICE* dice,int dir)
@@ -78,10 +68,11 @@ int dice_stk_dir(struct DICE* dice,int dir)
   if(dice->type != DICE_STK)
     return ERR_PARAM;
 
-  if(dir) iochain_setbit(dice->dir);
-  else iochain_clearbit(dice->dir);
+  if(dir) iochain_ctx_setbit(dice->chain,dice->dir);
+  else iochain_ctx_clearbit(dice->chain,dice->dir);
+  dice_track_dir(dice,dir);
   
-  return iochain_update();
+  return iochain_ctx_update(dice->chain);
 }
 
 int dice_stk_enable(struct DICE* dice,int enable)
@@ -92,10 +83,10 @@ int dice_stk_enable(struct DICE* dice,int enable)
   if(dice->type != DICE_STK)
     return ERR_PARAM;
 
-  if(enable) iochain_setbit(dice->enable);
-  else iochain_clearbit(dice->enable);
+  if(enable) iochain_ctx_setbit(dice->chain,dice->enable);
+  else iochain_ctx_clearbit(dice->chain,dice->enable);
   
-  return iochain_update();
+  return iochain_ctx_update(dice->chain);
 }
 
 int dice_stk_substepping(struct DICE* dice,int substepping)
@@ -112,65 +103,65 @@ int dice_stk_substepping(struct DICE* dice,int substepping)
       case 1:
       {
          // no substepping
-         iochain_clearbit(dice->ms1);
-         iochain_clearbit(dice->ms2);
-         iochain_clearbit(dice->ms3);
+         iochain_ctx_clearbit(dice->chain,dice->ms1);
+         iochain_ctx_clearbit(dice->chain,dice->ms2);
+         iochain_ctx_clearbit(dice->chain,dice->ms3);
          break;
       }
       case 2:
       {
          // 1/2 substepping
-         iochain_setbit(dice->ms1);
-         iochain_clearbit(dice->ms2);
-         iochain_clearbit(dice->ms3);
+         iochain_ctx_setbit(dice->chain,dice->ms1);
+         iochain_ctx_clearbit(dice->chain,dice->ms2);
+         iochain_ctx_clearbit(dice->chain,dice->ms3);
          break;
       }
       case 4:
       {
          // 1/4 substepping
-         iochain_clearbit(dice->ms1);
-         iochain_setbit(dice->ms2);
-         iochain_clearbit(dice->ms3);
+         iochain_ctx_clearbit(dice->chain,dice->ms1);
+         iochain_ctx_setbit(dice->chain,dice->ms2);
+         iochain_ctx_clearbit(dice->chain,dice->ms3);
          break;
       }
       case 8:
       {
          // 1/8 substepping
-         iochain_setbit(dice->ms1);
-         iochain_setbit(dice->ms2);
-         iochain_clearbit(dice->ms3);
+         iochain_ctx_setbit(dice->chain,dice->ms1);
+         iochain_ctx_setbit(dice->chain,dice->ms2);
+         iochain_ctx_clearbit(dice->chain,dice->ms3);
          break;
       }
       case 16:
       {
          // 1/16 substepping
-         iochain_clearbit(dice->ms1);
-         iochain_clearbit(dice->ms2);
-         iochain_setbit(dice->ms3);
+         iochain_ctx_clearbit(dice->chain,dice->ms1);
+         iochain_ctx_clearbit(dice->chain,dice->ms2);
+         iochain_ctx_setbit(dice->chain,dice->ms3);
          break;
       }
       case 32:
       {
          // 1/32 substepping
-         iochain_setbit(dice->ms1);
-         iochain_clearbit(dice->ms2);
-         iochain_setbit(dice->ms3);
+         iochain_ctx_setbit(dice->chain,dice->ms1);
+         iochain_ctx_clearbit(dice->chain,dice->ms2);
+         iochain_ctx_setbit(dice->chain,dice->ms3);
          break;
       }
       case 64:
       {
          // 1/64 substepping
-         iochain_clearbit(dice->ms1);
-         iochain_setbit(dice->ms2);
-         iochain_setbit(dice->ms3);
+         iochain_ctx_clearbit(dice->chain,dice->ms1);
+         iochain_ctx_setbit(dice->chain,dice->ms2);
+         iochain_ctx_setbit(dice->chain,dice->ms3);
          break;
       }
       case 128:
       {
          // 1/64 substepping
-         iochain_setbit(dice->ms1);
-         iochain_setbit(dice->ms2);
-         iochain_setbit(dice->ms3);
+         iochain_ctx_setbit(dice->chain,dice->ms1);
+         iochain_ctx_setbit(dice->chain,dice->ms2);
+         iochain_ctx_setbit(dice->chain,dice->ms3);
          break;
       }
       default:
@@ -178,5 +169,5 @@ int dice_stk_substepping(struct DICE* dice,int substepping)
   }
 
   //write to ios
-  return iochain_update();
+  return iochain_ctx_update(dice->chain);
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+//
+// Raspidapter test suite
+//
+// dice table implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+
+#include "raspidapter_common.h"
+#include "dice_table.h"
+#include "dice_tmc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int dice_table_init(struct DICE_TABLE* table,int capacity)
+{
+   int p;
+   int failed = 0;
+
+   //error checking
+   if(table == NULL || capacity < 1)
+     return ERR_PARAM;
+
+   memset(table,0,sizeof(struct DICE_TABLE));
+   table->capacity = capacity;
+   table->dice = calloc(capacity,sizeof(struct DICE*));
+   table->chain = calloc(capacity,sizeof(struct IOCHAIN*));
+   table->toggle_step = calloc(capacity,1);
+   failed = table->dice == NULL || table->chain == NULL || table->toggle_step == NULL;
+   for(p=0; p < DICE_NUM_PINS; p++)
+   {
+     table->word[p] = calloc(capacity,sizeof(int));
+     table->mask[p] = calloc(capacity,sizeof(uint32_t));
+     failed |= table->word[p] == NULL || table->mask[p] == NULL;
+   }
+   if(failed)
+   {
+     dice_table_free(table);
+     return ERR_INIT;
+   }
+
+   return 0;
+}
+
+void dice_table_free(struct DICE_TABLE* table)
+{
+   int p;
+
+   if(table == NULL)
+     return;
+
+   free(table->dice);
+   free(table->chain);
+   free(table->toggle_step);
+   for(p=0; p < DICE_NUM_PINS; p++)
+   {
+     free(table->word[p]);
+     free(table->mask[p]);
+   }
+   memset(table,0,sizeof(struct DICE_TABLE));
+}
+
+int dice_table_add(struct DICE_TABLE* table,struct DICE* dice)
+{
+   int bits[DICE_NUM_PINS];
+   int i;
+   int p;
+
+   //error checking
+   if(table == NULL || dice == NULL || dice->chain == NULL)
+     return ERR_PARAM;
+   if(table->count == table->capacity)
+     return ERR_PARAM;
+
+   bits[DICE_PIN_ENABLE] = dice->enable;
+   bits[DICE_PIN_MS3] = dice->ms3;
+   bits[DICE_PIN_RS] = dice->rs;
+   bits[DICE_PIN_DIR] = dice->dir;
+   bits[DICE_PIN_MS1] = dice->ms1;
+   bits[DICE_PIN_MS2] = dice->ms2;
+   bits[DICE_PIN_STEP] = dice->step;
+   bits[DICE_PIN_SLP] = dice->slp;
+
+   i = table->count++;
+   table->dice[i] = dice;
+   table->chain[i] = dice->chain;
+   table->toggle_step[i] = dice->type == DICE_TMC && dice_tmc_isDoubleEdge(dice);
+   for(p=0; p < DICE_NUM_PINS; p++)
+   {
+     table->word[p][i] = bits[p] >> 5;
+     table->mask[p][i] = 1u << (bits[p] & 31);
+   }
+
+   return i;
+}
+
+int dice_table_refresh(struct DICE_TABLE* table)
+{
+   int i;
+
+   if(table == NULL)
+     return ERR_PARAM;
+
+   for(i=0; i < table->count; i++)
+   {
+     struct DICE* dice = table->dice[i];
+     table->toggle_step[i] = dice->type == DICE_TMC && dice_tmc_isDoubleEdge(dice);
+   }
+   return 0;
+}
+
+int dice_table_pinset(const struct DICE_TABLE* table,int pin,const int* index,int n,struct IOCHAIN_PINSET* set)
+{
+   int i;
+   int ret;
+
+   //error checking
+   if(table == NULL || index == NULL || set == NULL || n < 1)
+     return ERR_PARAM;
+   if(pin < 0 || pin >= DICE_NUM_PINS)
+     return ERR_PARAM;
+   if(index[0] < 0 || index[0] >= table->count)
+     return ERR_PARAM;
+
+   ret = iochain_pinset_init(set,table->chain[index[0]]);
+   for(i=0; i < n && ret == 0; i++)
+   {
+     if(index[i] < 0 || index[i] >= table->count || table->chain[index[i]] != set->chain)
+       return ERR_PARAM;
+     ret = iochain_pinset_add_mask(set,table->word[pin][index[i]],table->mask[pin][index[i]]);
+   }
+   return ret;
+}
+
+//
+// sort a pin of the DICE into one pin set per chain group - sets[k*2+toggle]
+//
+static int dice_table_collect(const struct DICE_TABLE* table,int pin,const int* index,int n,int split_toggle,
+                              struct IOCHAIN_PINSET* sets,int* numchains)
+{
+   int i, k;
+   int ret;
+
+   *numchains = 0;
+   for(i=0; i < n; i++)
+   {
+     int d = index[i];
+     if(d < 0 || d >= table->count)
+       return ERR_PARAM;
+
+     for(k=0; k < *numchains; k++)
+     {
+       if(sets[k*2].chain == table->chain[d])
+         break;
+     }
+     if(k == *numchains)
+     {
+       if(k == DICE_TABLE_MAX_CHAINS)
+         return ERR_PARAM;
+       iochain_pinset_init(&sets[k*2],table->chain[d]);
+       iochain_pinset_init(&sets[k*2+1],table->chain[d]);
+       (*numchains)++;
+     }
+
+     ret = iochain_pinset_add_mask(&sets[k*2 + (split_toggle && table->toggle_step[d])],table->word[pin][d],table->mask[pin][d]);
+     if(ret != 0)
+       return ret;
+   }
+   return 0;
+}
+
+int dice_table_step(const struct DICE_TABLE* table,const int* index,int n)
+{
+   struct IOCHAIN_PINSET sets[DICE_TABLE_MAX_CHAINS*2];
+   int numchains;
+   int i, k;
+   int ret;
+
+   //error checking - only stepper DICE, before anything is touched
+   if(table == NULL || index == NULL || n < 0)
+     return ERR_PARAM;
+   for(i=0; i < n; i++)
+   {
+     if(index[i] < 0 || index[i] >= table->count)
+       return ERR_PARAM;
+     if(table->dice[index[i]]->type != DICE_STK && table->dice[index[i]]->type != DICE_TMC)
+       return ERR_PARAM;
+   }
+
+   ret = dice_table_collect(table,DICE_PIN_STEP,index,n,1,sets,&numchains);
+   if(ret != 0)
+     return ret;
+   for(i=0; i < n; i++)
+     dice_track_step(table->dice[index[i]]);
+
+   // pulses and toggles of a chain group go out in the same frame
+   for(k=0; k < numchains; k++)
+   {
+     iochain_ctx_begin(sets[k*2].chain);
+     if(sets[k*2].count)
+       iochain_pulse_pins(&sets[k*2]);
+     if(sets[k*2+1].count)
+       iochain_toggle_pins(&sets[k*2+1]);
+     ret = iochain_ctx_commit(sets[k*2].chain);
+     if(ret != 0)
+       return ret;
+   }
+   return 0;
+}
+
+int dice_table_write(const struct DICE_TABLE* table,int pin,const int* index,int n,int level)
+{
+   struct IOCHAIN_PINSET sets[DICE_TABLE_MAX_CHAINS*2];
+   int numchains;
+   int i, k;
+   int ret;
+
+   //error checking
+   if(table == NULL || index == NULL || n < 0)
+     return ERR_PARAM;
+   if(pin < 0 || pin >= DICE_NUM_PINS)
+     return ERR_PARAM;
+
+   ret = dice_table_collect(table,pin,index,n,0,sets,&numchains);
+   if(ret != 0)
+     return ret;
+   if(pin == DICE_PIN_DIR)
+   {
+     for(i=0; i < n; i++)
+       dice_track_dir(table->dice[index[i]],level);
+   }
+
+   for(k=0; k < numchains; k++)
+   {
+     if(level)
+       iochain_set_pins(&sets[k*2]);
+     else
+       iochain_clear_pins(&sets[k*2]);
+     ret = iochain_ctx_update(sets[k*2].chain);
+     if(ret != 0)
+       return ret;
+   }
+   return 0;
+}
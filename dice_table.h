@@ -0,0 +1,78 @@
+//
+// Raspidapter Library Code
+//
+// DICE table header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef DICE_TABLE_H
+#define DICE_TABLE_H
+
+#include "dice_common.h"
+#include "raspidapter_common.h"
+
+// a table of DICE with the chain address of every pin precomputed
+// The pins are stored struct-of-arrays: word[pin][i] and mask[pin][i] of all DICE are
+// contiguous, so a pin of many DICE is set with a few word ORs.
+
+// pin numbers within a slot
+#define DICE_PIN_ENABLE 0
+#define DICE_PIN_MS3 1
+#define DICE_PIN_RS 2
+#define DICE_PIN_DIR 3
+#define DICE_PIN_MS1 4
+#define DICE_PIN_MS2 5
+#define DICE_PIN_STEP 6
+#define DICE_PIN_SLP 7
+#define DICE_NUM_PINS 8
+
+// chain groups a single table operation can span
+#define DICE_TABLE_MAX_CHAINS 8
+
+struct DICE_TABLE
+{
+   int count;
+   int capacity;
+   struct DICE** dice;
+   struct IOCHAIN** chain;
+   char* toggle_step;                 // steps are toggles (TMC double edge) instead of pulses
+   int* word[DICE_NUM_PINS];
+   uint32_t* mask[DICE_NUM_PINS];
+};
+
+// allocate a table for up to capacity DICE
+int dice_table_init(struct DICE_TABLE* table,int capacity);
+void dice_table_free(struct DICE_TABLE* table);
+
+// add a set up DICE - returns its index in the table or an error
+int dice_table_add(struct DICE_TABLE* table,struct DICE* dice);
+
+// read the step mode of all DICE again - after dice_tmc_setDoubleEdge
+int dice_table_refresh(struct DICE_TABLE* table);
+
+// collect a pin of several DICE (by table index) into a pin set of one chain group
+int dice_table_pinset(const struct DICE_TABLE* table,int pin,const int* index,int n,struct IOCHAIN_PINSET* set);
+
+// step several STK or TMC DICE (by table index) in one frame per chain group
+int dice_table_step(const struct DICE_TABLE* table,const int* index,int n);
+
+// set a pin of several DICE (by table index) to a level, one update per chain group
+int dice_table_write(const struct DICE_TABLE* table,int pin,const int* index,int n,int level);
+
+#endif
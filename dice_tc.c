@@ -22,10 +22,14 @@
 
 
 #include "raspidapter_common.h"
+#include "raspidapter_backend.h"
 #include "dice_tc.h"
 
 #define ERROR_MASK 0x7
 
+// the MAX31855 takes the data on the rising edge
+static struct SPI_PROFILE max31855_spi;
+
 //internal function definitions
 unsigned int spiread32(struct DICE* dice,unsigned char chipnum);
 
@@ -45,62 +49,50 @@ int dice_tc_setup(struct DICE* dice,int board, int slot)
 
    //set type
    dice->type = DICE_TC;
+   spi_profile_init(&max31855_spi,SPI_MODE0,SPI_BIT_ORDER_MSBFIRST,MAX31855_SPI_MAX_HZ);
 
    //calc bit numbers
-   dice->enable = (board-1)*32 + (slot-1)*8 + 0;
-   dice->ms1 = (board-1)*32 + (slot-1)*8 + 4;
-   dice->ms2 = (board-1)*32 + (slot-1)*8 + 5;
-   dice->ms3 = (board-1)*32 + (slot-1)*8 + 1;
-   dice->rs = (board-1)*32 + (slot-1)*8 + 2;
-   dice->dir = (board-1)*32 + (slot-1)*8 + 3;
-   dice->step = (board-1)*32 + (slot-1)*8 + 6;
-   dice->slp = (board-1)*32 + (slot-1)*8 + 7;
+   int ret = dice_setup_pins(dice,board,slot);
+   if(ret != 0)
+     return ret;
 	
    //unselect CS
-   iochain_setbit(dice->enable);
-   iochain_update();
+   iochain_ctx_setbit(dice->chain,dice->enable);
+   iochain_ctx_update(dice->chain);
 
    return 0;
 }
 
+const struct SPI_PROFILE* dice_tc_getSpiProfile()
+{
+   return &max31855_spi;
+}
+
 
 double dice_tc_readInternalTemp(struct DICE* dice,unsigned char chipnum)
 {
-  unsigned int v;
-  v=spiread32(dice,chipnum);
- //ignore bottom 4 bits
-  v = v >> 4;
-//pull the bottom 11 bits off
-  double internal = v & 0x7ff;
-  internal = internal* 0.0625; //LSB = 0.0625
-
-  if(v&0x800) internal = internal * -1;
- return internal;
+  struct DICE_TC_SAMPLE sample;
+
+  if(dice_tc_readSample(dice,chipnum,&sample) != 0)
+    return 0;
+  return sample.internal;
 }
 
 double dice_tc_readCelsius(struct DICE* dice,unsigned char chipnum)
 {
-  unsigned int v;
+  struct DICE_TC_SAMPLE sample;
 
-  v= spiread32(dice, chipnum);
+  if(dice_tc_readSample(dice,chipnum,&sample) != 0)
+    return 0;
 
-  if(v & ERROR_MASK) 
+  if(sample.fault) 
   {
-    printf("error reading temp: %x\n",v & ERROR_MASK);
+    printf("error reading temp: %x\n",sample.fault);
     //chip return errors
     return 0;  
   }
 
-  //get rid of internal temp
-  v >>= 18;
-
-  double centigrade = v;
-
-  //LSB = 0.25 degree C
-  centigrade *= 0.25;
-
-  return centigrade;
-
+  return sample.celsius;
 }
 
 double dice_tc_readFarenheit(struct DICE* dice,unsigned char chipnum)
@@ -117,46 +109,89 @@ unsigned char dice_tc_readError(struct DICE* dice,unsigned char chipnum)
    return spiread32(dice,chipnum) & ERROR_MASK;
 }
 
+//
+// split a MAX31855 frame - both temperatures are two's complement
+//
+void dice_tc_decode(uint32_t raw,struct DICE_TC_SAMPLE* sample)
+{
+  sample->raw = raw;
+  //thermocouple: bits 31-18, LSB = 0.25 degree C
+  sample->celsius = ((int32_t)raw >> 18) * 0.25;
+  //cold junction: bits 15-4, LSB = 0.0625 degree C
+  sample->internal = ((int32_t)(raw << 16) >> 20) * 0.0625;
+  sample->fault = raw & ERROR_MASK;
+  //bit 16 is set with any fault, the faults themself are in bits 0-2
+  if((raw & (1u << 16)) && sample->fault == 0)
+    sample->fault = ERROR_MASK;
+}
+
+int dice_tc_readSample(struct DICE* dice,unsigned char chipnum,struct DICE_TC_SAMPLE* sample)
+{
+  if(dice == NULL || sample == NULL || chipnum < 1 || chipnum > DICE_TC_CHIPS)
+    return ERR_PARAM;
+
+  dice_tc_decode(spiread32(dice,chipnum),sample);
+  return 0;
+}
+
+//
+// all subchips in one spi session - two frames and one transfer each
+//
+int dice_tc_readAll(struct DICE* dice,struct DICE_TC_SAMPLE* samples)
+{
+  int i;
+
+  if(dice == NULL || samples == NULL)
+    return ERR_PARAM;
+
+  spi_session_begin(&max31855_spi);
+  for(i=0; i < DICE_TC_CHIPS; i++)
+    dice_tc_decode(spiread32(dice,i+1),&samples[i]);
+  spi_session_end();
+  return 0;
+}
+
+//
+// select the subchip and the chip in one frame, read the 32 bit frame in one transfer
+//
 unsigned int spiread32(struct DICE* dice,unsigned char chipnum)
 {
-   unsigned int d=0;
-   
-   //select correct subchip
+  unsigned char rx[4];
+  unsigned char tx[4] = { 0, 0, 0, 0 };
+
+  //select correct subchip
   switch(chipnum)
   {
      case 1:
-        iochain_clearbit(dice->step);
-        iochain_clearbit(dice->dir);
+        iochain_ctx_clearbit(dice->chain,dice->step);
+        iochain_ctx_clearbit(dice->chain,dice->dir);
       break;
      case 2:
-        iochain_setbit(dice->step);
-        iochain_clearbit(dice->dir);
+        iochain_ctx_setbit(dice->chain,dice->step);
+        iochain_ctx_clearbit(dice->chain,dice->dir);
       break;
      case 3:
-        iochain_clearbit(dice->step);
-        iochain_setbit(dice->dir);
+        iochain_ctx_clearbit(dice->chain,dice->step);
+        iochain_ctx_setbit(dice->chain,dice->dir);
       break;
      default:
       printf("wrong chipnum\n");
       return 0;
   }
-  iochain_update();
-
-  // select chip
-  iochain_clearbit(dice->enable);
-  iochain_update();
-
-   d= spi_transfer(0);
-   d= d << 8;
-   d |= spi_transfer(0);
-   d= d << 8;
-   d |= spi_transfer(0);
-   d= d << 8;
-   d |= spi_transfer(0);
+
+  spi_session_begin(&max31855_spi);
+
+  // select chip together with the mux - the CS has to be latched even inside a transaction
+  iochain_ctx_clearbit(dice->chain,dice->enable);
+  iochain_ctx_flush(dice->chain);
+
+  spi_transfernb(tx,rx,4);
    
   //deselect chip
-  iochain_setbit(dice->enable);
-  iochain_update();
+  iochain_ctx_setbit(dice->chain,dice->enable);
+  iochain_ctx_flush(dice->chain);
 
-  return d;
-}
\ No newline at end of file
+  spi_session_end();
+
+  return ((unsigned int)rx[0] << 24) | ((unsigned int)rx[1] << 16) | ((unsigned int)rx[2] << 8) | rx[3];
+}
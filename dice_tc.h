@@ -25,12 +25,49 @@
 
 #include "dice_common.h"
 
+#include <stdint.h>
+
+// fastest SPI clock of the MAX31855
+#define MAX31855_SPI_MAX_HZ 5000000ul
+
+struct SPI_PROFILE;
+
 // Setup a DICE in a specific slot  
 // dice  - the dice struct to set up
 // board - the board number where the dice is, counting from 1
 // slot - the slot where the dice is on the board. Values between 1 and 4 are valid.
 int dice_tc_setup(struct DICE* dice,int board, int slot);
 
+// the spi profile of the MAX31855 - set up by dice_tc_setup
+const struct SPI_PROFILE* dice_tc_getSpiProfile();
+
+// a DICE-TC has three MAX31855 subchips, chipnum 1 to 3
+#define DICE_TC_CHIPS 3
+
+// fault bits of a sample
+#define DICE_TC_FAULT_OPEN 0x1          // thermocouple not connected
+#define DICE_TC_FAULT_SHORT_GND 0x2     // thermocouple shorted to GND
+#define DICE_TC_FAULT_SHORT_VCC 0x4     // thermocouple shorted to VCC
+
+// a decoded MAX31855 frame
+struct DICE_TC_SAMPLE
+{
+   uint32_t raw;
+   double celsius;          // thermocouple temperature
+   double internal;         // cold junction temperature
+   unsigned char fault;     // DICE_TC_FAULT_* bits, 0 if the temperatures are valid
+};
+
+// read a subchip: mux and CS in one chain frame, the frame in one spi transfer
+int dice_tc_readSample(struct DICE* dice,unsigned char chipnum,struct DICE_TC_SAMPLE* sample);
+
+// read all three subchips back to back - samples holds DICE_TC_CHIPS entries
+int dice_tc_readAll(struct DICE* dice,struct DICE_TC_SAMPLE* samples);
+
+// decode a raw 32 bit MAX31855 frame
+void dice_tc_decode(uint32_t raw,struct DICE_TC_SAMPLE* sample);
+
+// single values - each call reads the subchip
 double dice_tc_readInternalTemp(struct DICE* dice,unsigned char chipnum);
 double dice_tc_readCelsius(struct DICE* dice,unsigned char chipnum);
 double dice_tc_readFarenheit(struct DICE* dice,unsigned char chipnum);
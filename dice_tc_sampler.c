@@ -0,0 +1,293 @@
+//
+// Raspidapter library
+//
+// DICE TC sampler implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "dice_tc_sampler.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// the ring of a channel - one writer, readers retry while seq is odd or changed
+struct TCSAMPLER_CHANNEL
+{
+   unsigned int seq;
+   unsigned long count;
+   struct TCSAMPLER_ENTRY ring[TCSAMPLER_HISTORY];
+};
+
+pthread_t tcsampler_thread;
+int tcsampler_running = 0;
+unsigned long long tcsampler_period_ns = TCSAMPLER_PERIOD_NS;
+
+struct DICE* tcsampler_dice[TCSAMPLER_MAX_DICE];
+unsigned long long tcsampler_deadline[TCSAMPLER_MAX_DICE];
+int tcsampler_numdice = 0;
+struct TCSAMPLER_CHANNEL tcsampler_channels[TCSAMPLER_MAX_CHANNELS];
+
+static void tcsampler_store(struct TCSAMPLER_CHANNEL* ch, unsigned long long time_ns, const struct DICE_TC_SAMPLE* sample)
+{
+   struct TCSAMPLER_ENTRY* e = &ch->ring[ch->count & (TCSAMPLER_HISTORY-1)];
+
+   __atomic_add_fetch(&ch->seq,1,__ATOMIC_ACQ_REL);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   e->time_ns = time_ns;
+   e->sample = *sample;
+   __atomic_store_n(&ch->count,ch->count+1,__ATOMIC_RELAXED);
+   __atomic_add_fetch(&ch->seq,1,__ATOMIC_RELEASE);
+}
+
+// copy the last n entries, newest first - returns how many there are
+static int tcsampler_copy(int channel, int n, struct TCSAMPLER_ENTRY* out)
+{
+   struct TCSAMPLER_CHANNEL* ch = &tcsampler_channels[channel];
+   unsigned int seq;
+   unsigned long count;
+   int i;
+
+   for(;;)
+   {
+      seq = __atomic_load_n(&ch->seq,__ATOMIC_ACQUIRE);
+      if(seq & 1)
+         continue;
+
+      count = __atomic_load_n(&ch->count,__ATOMIC_RELAXED);
+      if((unsigned long)n > count)
+         n = count;
+      for(i=0; i < n; i++)
+         out[i] = ch->ring[(count-1-i) & (TCSAMPLER_HISTORY-1)];
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&ch->seq,__ATOMIC_RELAXED) == seq)
+         return n;
+   }
+}
+
+static void tcsampler_sleep_until(unsigned long long time_ns)
+{
+   struct timespec ts;
+   ts.tv_sec = time_ns / 1000000000ull;
+   ts.tv_nsec = time_ns % 1000000000ull;
+   clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0);
+}
+
+// read every DICE whose conversion is done - returns the number read, next is the
+// earliest deadline
+static int tcsampler_read_due(unsigned long long (*clock)(), unsigned long long* next)
+{
+   int i, k, read = 0;
+
+   *next = 0;
+   for(i=0; i < tcsampler_numdice; i++)
+   {
+      struct DICE_TC_SAMPLE samples[DICE_TC_CHIPS];
+      unsigned long long now = clock();
+
+      if(now >= tcsampler_deadline[i])
+      {
+         dice_tc_readAll(tcsampler_dice[i],samples);
+         for(k=0; k < DICE_TC_CHIPS; k++)
+            tcsampler_store(&tcsampler_channels[i*DICE_TC_CHIPS+k],now,&samples[k]);
+
+         //the next conversion is done one period after the chip select rose
+         tcsampler_deadline[i] = clock() + tcsampler_period_ns;
+         read++;
+      }
+      if(*next == 0 || tcsampler_deadline[i] < *next)
+         *next = tcsampler_deadline[i];
+   }
+   return read;
+}
+
+static void* tcsampler_main(void* arg)
+{
+   (void)arg;
+
+   while(__atomic_load_n(&tcsampler_running,__ATOMIC_ACQUIRE))
+   {
+      unsigned long long next;
+
+      tcsampler_read_due(timing_now_ns,&next);
+      //wake up regularly, so stop does not wait a whole period
+      if(next > timing_now_ns() + TCSAMPLER_PERIOD_NS/10)
+         next = timing_now_ns() + TCSAMPLER_PERIOD_NS/10;
+      tcsampler_sleep_until(next);
+   }
+   return 0;
+}
+
+int tcsampler_add(struct DICE* dice)
+{
+   int channel;
+
+   if(dice == 0 || dice->type != DICE_TC)
+      return ERR_PARAM;
+   if(tcsampler_running || tcsampler_numdice == TCSAMPLER_MAX_DICE)
+      return ERR_INIT;
+
+   channel = tcsampler_numdice*DICE_TC_CHIPS;
+   memset(&tcsampler_channels[channel],0,DICE_TC_CHIPS*sizeof(struct TCSAMPLER_CHANNEL));
+   tcsampler_deadline[tcsampler_numdice] = 0;
+   tcsampler_dice[tcsampler_numdice++] = dice;
+   return channel;
+}
+
+int tcsampler_set_period(unsigned long long period_ns)
+{
+   if(tcsampler_running)
+      return ERR_INIT;
+   tcsampler_period_ns = period_ns ? period_ns : TCSAMPLER_PERIOD_NS;
+   return 0;
+}
+
+int tcsampler_poll(unsigned long long (*clock)(), unsigned long long* next_ns)
+{
+   unsigned long long next;
+   int read;
+
+   if(clock == 0)
+      return ERR_PARAM;
+   if(tcsampler_running)
+      return ERR_INIT;
+
+   read = tcsampler_read_due(clock,&next);
+   if(next_ns != 0)
+      *next_ns = next;
+   return read;
+}
+
+int tcsampler_start(unsigned long long period_ns)
+{
+   int i;
+
+   if(tcsampler_running)
+      return ERR_INIT;
+   if(tcsampler_numdice == 0)
+      return ERR_PARAM;
+
+   tcsampler_period_ns = period_ns ? period_ns : TCSAMPLER_PERIOD_NS;
+   for(i=0; i < tcsampler_numdice; i++)
+      tcsampler_deadline[i] = timing_now_ns();
+   tcsampler_running = 1;
+   if(pthread_create(&tcsampler_thread,0,tcsampler_main,0) != 0)
+   {
+      tcsampler_running = 0;
+      return ERR_INIT;
+   }
+   return 0;
+}
+
+int tcsampler_stop()
+{
+   if(!tcsampler_running && tcsampler_numdice == 0)
+      return ERR_INIT;
+
+   if(tcsampler_running)
+   {
+      __atomic_store_n(&tcsampler_running,0,__ATOMIC_RELEASE);
+      pthread_join(tcsampler_thread,0);
+   }
+   tcsampler_numdice = 0;
+   return 0;
+}
+
+int tcsampler_latest(int channel, struct TCSAMPLER_ENTRY* entry)
+{
+   if(channel < 0 || channel >= tcsampler_numdice*DICE_TC_CHIPS || entry == 0)
+      return ERR_PARAM;
+
+   return tcsampler_copy(channel,1,entry) == 1 ? 0 : ERR_INIT;
+}
+
+unsigned long tcsampler_count(int channel)
+{
+   if(channel < 0 || channel >= tcsampler_numdice*DICE_TC_CHIPS)
+      return 0;
+   return __atomic_load_n(&tcsampler_channels[channel].count,__ATOMIC_ACQUIRE);
+}
+
+// the valid temperatures of the last n samples
+static int tcsampler_valid(int channel, int n, double* celsius)
+{
+   struct TCSAMPLER_ENTRY entries[TCSAMPLER_HISTORY];
+   int i, valid = 0;
+
+   if(channel < 0 || channel >= tcsampler_numdice*DICE_TC_CHIPS || n < 1 || n > TCSAMPLER_HISTORY)
+      return ERR_PARAM;
+
+   n = tcsampler_copy(channel,n,entries);
+   for(i=0; i < n; i++)
+   {
+      if(entries[i].sample.fault == 0)
+         celsius[valid++] = entries[i].sample.celsius;
+   }
+   return valid;
+}
+
+int tcsampler_average(int channel, int n, double* celsius)
+{
+   double values[TCSAMPLER_HISTORY];
+   double sum = 0;
+   int i, valid;
+
+   if(celsius == 0)
+      return ERR_PARAM;
+   valid = tcsampler_valid(channel,n,values);
+   if(valid < 0)
+      return valid;
+   if(valid == 0)
+      return ERR_INIT;
+
+   for(i=0; i < valid; i++)
+      sum += values[i];
+   *celsius = sum/valid;
+   return 0;
+}
+
+int tcsampler_median(int channel, int n, double* celsius)
+{
+   double values[TCSAMPLER_HISTORY];
+   int i, j, valid;
+
+   if(celsius == 0)
+      return ERR_PARAM;
+   valid = tcsampler_valid(channel,n,values);
+   if(valid < 0)
+      return valid;
+   if(valid == 0)
+      return ERR_INIT;
+
+   //insertion sort - at most TCSAMPLER_HISTORY values
+   for(i=1; i < valid; i++)
+   {
+      double v = values[i];
+      for(j=i; j > 0 && values[j-1] > v; j--)
+         values[j] = values[j-1];
+      values[j] = v;
+   }
+   if(valid & 1)
+      *celsius = values[valid/2];
+   else
+      *celsius = (values[valid/2-1] + values[valid/2])/2;
+   return 0;
+}
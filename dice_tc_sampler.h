@@ -0,0 +1,77 @@
+//
+// Raspidapter Library Code
+//
+// DICE TC sampler header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef DICE_TC_SAMPLER_H
+#define DICE_TC_SAMPLER_H
+
+#include "dice_common.h"
+#include "dice_tc.h"
+
+// The sampler reads every subchip of the registered DICE-TC from its own thread and
+// keeps the samples in a ring per channel. A MAX31855 stops converting while it is
+// read and needs up to 100ms for the next conversion, so every DICE is read one
+// period after its last read - no conversion is read twice.
+// The readers never touch the bus and do not block the sampler.
+
+#define TCSAMPLER_MAX_DICE 8
+#define TCSAMPLER_MAX_CHANNELS (TCSAMPLER_MAX_DICE*DICE_TC_CHIPS)
+#define TCSAMPLER_HISTORY 64               // samples per channel, a power of two
+#define TCSAMPLER_PERIOD_NS 100000000ull   // conversion time of the MAX31855
+
+// a timestamped sample
+struct TCSAMPLER_ENTRY
+{
+   unsigned long long time_ns;     // CLOCK_MONOTONIC time of the read, see timing_now_ns
+   struct DICE_TC_SAMPLE sample;
+};
+
+// register a DICE-TC - returns the channel of subchip 1, subchip k is channel+k-1
+// Must be called before tcsampler_start.
+int tcsampler_add(struct DICE* dice);
+
+// start the sampler thread - period_ns 0 for TCSAMPLER_PERIOD_NS
+int tcsampler_start(unsigned long long period_ns);
+
+// stop the thread and forget the registered DICE
+int tcsampler_stop();
+
+// Without the thread the caller samples from its own loop: tcsampler_poll reads every
+// DICE whose conversion is done on the given clock - timing_now_ns, or sim_now_ns in
+// the simulator - and stamps the samples with it. next_ns (may be NULL) gets the time
+// the next DICE is due. Returns the number of DICE read, ERR_INIT while the thread runs.
+int tcsampler_poll(unsigned long long (*clock)(), unsigned long long* next_ns);
+
+// the period of tcsampler_poll - 0 for TCSAMPLER_PERIOD_NS, tcsampler_start sets its own
+int tcsampler_set_period(unsigned long long period_ns);
+
+// the newest sample of a channel - ERR_INIT if there is none yet
+int tcsampler_latest(int channel, struct TCSAMPLER_ENTRY* entry);
+
+// number of samples taken of a channel
+unsigned long tcsampler_count(int channel);
+
+// mean and median temperature of the last n samples without fault (n <= TCSAMPLER_HISTORY)
+// ERR_INIT if there is no valid sample among them
+int tcsampler_average(int channel, int n, double* celsius);
+int tcsampler_median(int channel, int n, double* celsius);
+
+#endif
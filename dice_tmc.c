@@ -22,13 +22,20 @@
 
 
 #include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_timing.h"
 #include "dice_tmc.h"
 
+#include <stdint.h>
+
 // common defines
 #define SENSE_RESISTOR 91  // in mOhm
 #define DEFAULT_CURRENT 1000  //in mAmps
 #define DEFAULT_MICROSTEPPING 32
 
+// the TMC262 takes the data on the rising edge with the clock idle high
+static struct SPI_PROFILE tmc262_spi;
+
 //register buffers are in the user value of the DICE structs
 #define DRIVER_CONTROL_REGISTER_VALUE 0
 #define CHOPPER_CONFIG_REGISTER_VALUE 1
@@ -100,12 +107,100 @@
 
 //default values
 #define INITIAL_MICROSTEPPING 0x3ul //32th microstepping
+#define INITIAL_DOUBLE_EDGE 0 //step on rising edges like the chip after reset - double edge is opt-in
+
 
+//the shadow cache of the registers
+#define TMC_DIRTY 8                  // bit n: register value n differs from the driver
+#define TMC_AUTOFLUSH 9              // send changed registers from the setters
+#define TMC_SENT_REGISTER_VALUE 10   // 10-14: the register values the driver holds
+#define TMC_NUM_REGISTERS 5
+
+//telemetry - the decoded status words with 64 bit time stamps in us, low and high word
+#define TMC_READOUT_VALUE 15         // 15-17: readout value of RDSEL 0, 1, 2
+#define TMC_TELEMETRY_VALID 18       // bit n: a readout of RDSEL n was seen, bit 3: a status word was seen
+#define TMC_MAX_AGE 19               // age limit of the getters in us, 0 reads every time
+#define TMC_STATUS_TIME 20           // 20-21: time of the last status word, the flags are in DRIVER_STATUS_RESULT
+#define TMC_READOUT_TIME 22          // 22-27: time of the readout of RDSEL 0, 1, 2
+#define TMC_STATUS_VALID 0x8ul
 
 //internal function defines
 void send262(struct DICE* dice,unsigned long datagram);
 int getReadoutValue(struct DICE* dice);
 
+// the register value a datagram writes
+static int tmc_register_index(unsigned long datagram)
+{
+   if(!(datagram & 0x80000ul))
+      return DRIVER_CONTROL_REGISTER_VALUE;
+   return CHOPPER_CONFIG_REGISTER_VALUE + ((datagram >> 17) & 0x3);
+}
+
+// a setter changed a register value - it is dirty unless the driver holds it already
+static void tmc_mark(struct DICE* dice,int reg)
+{
+   if(dice->userValues[reg] != dice->userValues[TMC_SENT_REGISTER_VALUE+reg])
+      dice->userValues[TMC_DIRTY] |= 1ul << reg;
+   else
+      dice->userValues[TMC_DIRTY] &= ~(1ul << reg);
+}
+
+static void tmc_autoflush(struct DICE* dice)
+{
+   if(dice->userValues[TMC_AUTOFLUSH])
+      dice_tmc_flush(dice);
+}
+
+static void tmc_update(struct DICE* dice,int reg)
+{
+   tmc_mark(dice,reg);
+   tmc_autoflush(dice);
+}
+
+static unsigned long long tmc_now_us()
+{
+   return timing_now_ns()/1000;
+}
+
+// a time stamp in two user values - unsigned long is 32 bit on the Pi
+static void tmc_set_stamp(struct DICE* dice,int index,unsigned long long us)
+{
+   dice->userValues[index] = (uint32_t)us;
+   dice->userValues[index+1] = (uint32_t)(us >> 32);
+}
+
+static unsigned long long tmc_get_stamp(struct DICE* dice,int index)
+{
+   return ((unsigned long long)(uint32_t)dice->userValues[index+1] << 32) | (uint32_t)dice->userValues[index];
+}
+
+// the RDSEL bits of a readout selection
+static int tmc_rdsel(char read_value)
+{
+   if(read_value == TMC26X_READOUT_STALLGUARD)
+      return 1;
+   if(read_value == TMC26X_READOUT_CURRENT)
+      return 2;
+   return 0;
+}
+
+// age of a time stamp in us - an age beyond the range of unsigned long is ~0ul
+static unsigned long tmc_age(unsigned long long now, unsigned long long stamp)
+{
+   unsigned long long age = now - stamp;
+   return age > ~0ul ? ~0ul : (unsigned long)age;
+}
+
+// the readout value of a selection - read only if the cached one is too old
+static int tmc_readout(struct DICE* dice,char read_value)
+{
+   int rdsel = tmc_rdsel(read_value);
+
+   if(dice_tmc_getReadoutAge(dice,read_value) > dice->userValues[TMC_MAX_AGE] || dice->userValues[TMC_MAX_AGE] == 0)
+      dice_tmc_readStatus(dice,read_value);
+   return (int)dice->userValues[TMC_READOUT_VALUE+rdsel];
+}
+
 int dice_tmc_setup(struct DICE* dice,int board, int slot)
 {
    //error checking
@@ -120,39 +215,39 @@ int dice_tmc_setup(struct DICE* dice,int board, int slot)
 
    //set type
    dice->type = DICE_TMC;
+   spi_profile_init(&tmc262_spi,SPI_MODE3,SPI_BIT_ORDER_MSBFIRST,TMC262_SPI_MAX_HZ);
 
    //calc bit numbers
-   dice->enable = (board-1)*32 + (slot-1)*8 + 0;
-   dice->ms1 = (board-1)*32 + (slot-1)*8 + 4;
-   dice->ms2 = (board-1)*32 + (slot-1)*8 + 5;
-   dice->ms3 = (board-1)*32 + (slot-1)*8 + 1;
-   dice->rs = (board-1)*32 + (slot-1)*8 + 2;
-   dice->dir = (board-1)*32 + (slot-1)*8 + 3;
-   dice->step = (board-1)*32 + (slot-1)*8 + 6;
-   dice->slp = (board-1)*32 + (slot-1)*8 + 7;
+   int ret = dice_setup_pins(dice,board,slot);
+   if(ret != 0)
+     return ret;
 	
    //setting the default register values
-   dice->userValues[DRIVER_CONTROL_REGISTER_VALUE]=DRIVER_CONTROL_REGISTER|INITIAL_MICROSTEPPING;
+   dice->userValues[DRIVER_CONTROL_REGISTER_VALUE]=DRIVER_CONTROL_REGISTER|INITIAL_MICROSTEPPING|INITIAL_DOUBLE_EDGE;
    dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]=CHOPPER_CONFIG_REGISTER;
    dice->userValues[COOL_STEP_REGISTER_VALUE]=COOL_STEP_REGISTER;
    dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE]=STALL_GUARD2_LOAD_MEASURE_REGISTER;
    dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE] = DRIVER_CONFIG_REGISTER | READ_STALL_GUARD_READING;
 
+   //nothing is sent yet - every register is dirty
+   dice_tmc_invalidate(dice);
+   dice->userValues[TMC_AUTOFLUSH] = 1;
+   dice->userValues[TMC_TELEMETRY_VALID] = 0;
+   dice->userValues[TMC_MAX_AGE] = 0;
+
    //unselect CS
-   iochain_setbit(dice->enable);
-   iochain_update();
+   iochain_ctx_setbit(dice->chain,dice->enable);
+   iochain_ctx_update(dice->chain);
 
    return 0;
 }
 
-int dice_tmc_start(struct DICE* dice)
+// the initial values in the cache, every register marked to be sent once
+static void tmc_defaults(struct DICE* dice)
 {
-   //send initial values
-   send262(dice,dice->userValues[DRIVER_CONTROL_REGISTER_VALUE]); 
-   send262(dice,dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]);
-   send262(dice,dice->userValues[COOL_STEP_REGISTER_VALUE]);
-   send262(dice,dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE]);
-   send262(dice,dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]);
+   unsigned long autoflush = dice->userValues[TMC_AUTOFLUSH];
+
+   dice->userValues[TMC_AUTOFLUSH] = 0;
 
    //set the current
    dice_tmc_setCurrent(dice,DEFAULT_CURRENT);
@@ -161,24 +256,254 @@ int dice_tmc_start(struct DICE* dice)
    //set a nice microstepping value
    dice_tmc_setMicrosteps(dice,DEFAULT_MICROSTEPPING);
 
+   dice->userValues[TMC_DIRTY] = (1ul << TMC_NUM_REGISTERS) - 1;
+   dice->userValues[TMC_AUTOFLUSH] = autoflush;
+}
+
+const struct SPI_PROFILE* dice_tmc_getSpiProfile()
+{
+   return &tmc262_spi;
+}
+
+int dice_tmc_start(struct DICE* dice)
+{
+   //send every register once
+   tmc_defaults(dice);
+   dice_tmc_flush(dice);
    return 0;
 }
 
+int dice_tmc_flush(struct DICE* dice)
+{
+   int i;
+   int sent = 0;
+
+   //in the order of the datasheet, the driver control register first
+   for(i=0; i < TMC_NUM_REGISTERS; i++)
+   {
+      if(dice->userValues[TMC_DIRTY] & (1ul << i))
+      {
+         send262(dice,dice->userValues[i]);
+         sent++;
+      }
+   }
+   return sent;
+}
+
+void dice_tmc_setAutoFlush(struct DICE* dice,char enabled)
+{
+   dice->userValues[TMC_AUTOFLUSH] = enabled ? 1 : 0;
+   if(enabled)
+      dice_tmc_flush(dice);
+}
+
+char dice_tmc_isAutoFlush(struct DICE* dice)
+{
+   return dice->userValues[TMC_AUTOFLUSH] ? 1 : 0;
+}
+
+unsigned char dice_tmc_getDirty(struct DICE* dice)
+{
+   return (unsigned char)dice->userValues[TMC_DIRTY];
+}
+
+void dice_tmc_invalidate(struct DICE* dice)
+{
+   int i;
+
+   //a send262 in flight records its datagram before it ends the session
+   spi_session_begin(&tmc262_spi);
+   for(i=0; i < TMC_NUM_REGISTERS; i++)
+     dice->userValues[TMC_SENT_REGISTER_VALUE+i] = ~0ul;
+   dice->userValues[TMC_DIRTY] = (1ul << TMC_NUM_REGISTERS) - 1;
+   spi_session_end();
+}
+
+// clock one datagram into every member at once - the responses collide on MISO
+static void send262_many(struct DICE** dice,int n,unsigned long datagram)
+{
+   unsigned char tx[3];
+   int i, j, reg;
+
+   spi_session_begin(&tmc262_spi);
+
+   //select all members, one frame per chain
+   for(i=0; i < n; i++)
+      iochain_ctx_clearbit(dice[i]->chain,dice[i]->enable);
+   for(i=0; i < n; i++)
+   {
+      for(j=0; j < i && dice[j]->chain != dice[i]->chain; j++)
+         ;
+      if(j == i)
+         iochain_ctx_flush(dice[i]->chain);
+   }
+
+   tx[0] = (datagram >> 16) & 0xff;
+   tx[1] = (datagram >>  8) & 0xff;
+   tx[2] = (datagram) & 0xff;
+   spi_transfern(tx,3);
+
+   //release them together - every driver takes the datagram over on this edge
+   for(i=0; i < n; i++)
+      iochain_ctx_setbit(dice[i]->chain,dice[i]->enable);
+   for(i=0; i < n; i++)
+   {
+      for(j=0; j < i && dice[j]->chain != dice[i]->chain; j++)
+         ;
+      if(j == i)
+         iochain_ctx_flush(dice[i]->chain);
+   }
+
+   //the drivers hold the register now - recorded before the bus is given up
+   reg = tmc_register_index(datagram);
+   for(i=0; i < n; i++)
+   {
+      dice[i]->userValues[TMC_SENT_REGISTER_VALUE+reg] = datagram;
+      dice[i]->userValues[TMC_DIRTY] &= ~(1ul << reg);
+   }
+
+   spi_session_end();
+}
+
+int dice_tmc_flushMany(struct DICE** dice,int n)
+{
+   struct DICE* group[DICE_TMC_GROUP_MAX];
+   int i, reg, members;
+   int sent = 0;
+
+   //error checking
+   if(dice == NULL || n < 0)
+      return ERR_PARAM;
+
+   for(reg=0; reg < TMC_NUM_REGISTERS; reg++)
+   {
+      for(;;)
+      {
+         unsigned long datagram = 0;
+
+         //the dirty members holding the value of the first one
+         members = 0;
+         for(i=0; i < n; i++)
+         {
+            if(!(dice[i]->userValues[TMC_DIRTY] & (1ul << reg)))
+               continue;
+            if(members == 0)
+               datagram = dice[i]->userValues[reg];
+            else if(dice[i]->userValues[reg] != datagram)
+               continue;
+            group[members++] = dice[i];
+            if(members == DICE_TMC_GROUP_MAX)
+               break;
+         }
+         if(members == 0)
+            break;
+
+         if(members == 1)
+            send262(group[0],datagram);
+         else
+            send262_many(group,members,datagram);
+         sent++;
+      }
+   }
+   return sent;
+}
+
+int dice_tmc_startMany(struct DICE** dice,int n)
+{
+   int i;
+
+   //error checking
+   if(dice == NULL || n < 0)
+      return ERR_PARAM;
+
+   //the same initial values as dice_tmc_start
+   for(i=0; i < n; i++)
+      tmc_defaults(dice[i]);
+   return dice_tmc_flushMany(dice,n);
+}
+
+// collect a setter of every member, then broadcast for the ones with autoflush
+static void tmc_group_flush(struct DICE** dice,int n)
+{
+   struct DICE* group[DICE_TMC_GROUP_MAX];
+   int i, members = 0;
+
+   for(i=0; i < n; i++)
+   {
+      if(dice[i]->userValues[TMC_AUTOFLUSH])
+         group[members++] = dice[i];
+      if(members == DICE_TMC_GROUP_MAX)
+      {
+         dice_tmc_flushMany(group,members);
+         members = 0;
+      }
+   }
+   dice_tmc_flushMany(group,members);
+}
+
+void dice_tmc_setCurrentMany(struct DICE** dice,int n,unsigned int current)
+{
+   unsigned long autoflush;
+   int i;
+
+   for(i=0; i < n; i++)
+   {
+      autoflush = dice[i]->userValues[TMC_AUTOFLUSH];
+      dice[i]->userValues[TMC_AUTOFLUSH] = 0;
+      dice_tmc_setCurrent(dice[i],current);
+      dice[i]->userValues[TMC_AUTOFLUSH] = autoflush;
+   }
+   tmc_group_flush(dice,n);
+}
+
+void dice_tmc_setMicrostepsMany(struct DICE** dice,int n,int number_of_steps)
+{
+   unsigned long autoflush;
+   int i;
+
+   for(i=0; i < n; i++)
+   {
+      autoflush = dice[i]->userValues[TMC_AUTOFLUSH];
+      dice[i]->userValues[TMC_AUTOFLUSH] = 0;
+      dice_tmc_setMicrosteps(dice[i],number_of_steps);
+      dice[i]->userValues[TMC_AUTOFLUSH] = autoflush;
+   }
+   tmc_group_flush(dice,n);
+}
+
+void dice_tmc_setEnabledMany(struct DICE** dice,int n,char enabled)
+{
+   unsigned long autoflush;
+   int i;
+
+   for(i=0; i < n; i++)
+   {
+      autoflush = dice[i]->userValues[TMC_AUTOFLUSH];
+      dice[i]->userValues[TMC_AUTOFLUSH] = 0;
+      dice_tmc_setEnabled(dice[i],enabled);
+      dice[i]->userValues[TMC_AUTOFLUSH] = autoflush;
+   }
+   tmc_group_flush(dice,n);
+}
+
 int dice_tmc_step(struct DICE* dice)
 {
-   iochain_setbit(dice->step);
-   iochain_update();
-   // todo wait ?
-   iochain_clearbit(dice->step);
-   iochain_update();
-   
+   dice_track_step(dice);
+
+   // with double edge steps every level change is a step - the mode the driver holds counts
+   if(dice_tmc_isDoubleEdge(dice))
+     return iochain_ctx_togglebit(dice->chain,dice->step);
+
+   // the step bit is only high for one latched frame
+   return iochain_ctx_pulsebit(dice->chain,dice->step);
 }
 
 int dice_tmc_dir(struct DICE* dice,int dir)
 {
-   if(dir) iochain_setbit(dice->dir);
-   else iochain_clearbit(dice->dir);
-   iochain_update();
+   if(dir) iochain_ctx_setbit(dice->chain,dice->dir);
+   else iochain_ctx_clearbit(dice->chain,dice->dir);
+   dice_track_dir(dice,dir);
+   return iochain_ctx_update(dice->chain);
 }
 
 
@@ -218,9 +543,10 @@ void dice_tmc_setCurrent(struct DICE* dice,unsigned int current)
     //set the new current scaling
     dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE] |= current_scaling;
     
-    //send 
-    send262(dice,dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]);
-    send262(dice,dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE]);
+    //send both in one flush
+    tmc_mark(dice,DRIVER_CONFIGURATION_REGISTER_VALUE);
+    tmc_mark(dice,STALL_GUARD2_CURRENT_REGISTER_VALUE);
+    tmc_autoflush(dice);
    
 }
 
@@ -235,6 +561,30 @@ unsigned int dice_tmc_getCurrent(struct DICE* dice)
     return (unsigned int)result;
 }
 
+/*
+ * Switch stepping on both edges of the step input.
+ * Every toggle of the step bit is a step then, so a step costs one chain update.
+ */
+void dice_tmc_setDoubleEdge(struct DICE* dice,char enabled)
+{
+	if (enabled) {
+		dice->userValues[DRIVER_CONTROL_REGISTER_VALUE] |= DOUBLE_EDGE_STEP;
+	} else {
+		dice->userValues[DRIVER_CONTROL_REGISTER_VALUE] &= ~(DOUBLE_EDGE_STEP);
+	}
+	tmc_update(dice,DRIVER_CONTROL_REGISTER_VALUE);
+}
+
+// the sent register, not the shadow copy - an unknown register is the reset value, DEDGE off
+char dice_tmc_isDoubleEdge(struct DICE* dice)
+{
+	unsigned long sent = dice->userValues[TMC_SENT_REGISTER_VALUE+DRIVER_CONTROL_REGISTER_VALUE];
+	if (sent == ~0ul) {
+		return 0;
+	}
+	return (sent & DOUBLE_EDGE_STEP) ? 1 : 0;
+}
+
 /*
  * Set the number of microsteps per step.
  * 0,2,4,8,16,32,64,128,256 is supported
@@ -270,7 +620,7 @@ void dice_tmc_setMicrosteps(struct DICE* dice,int number_of_steps) {
 	//set the new value
 	dice->userValues[DRIVER_CONTROL_REGISTER_VALUE] |=setting_pattern;
 	
-	send262(dice,dice->userValues[DRIVER_CONTROL_REGISTER_VALUE]);
+	tmc_update(dice,DRIVER_CONTROL_REGISTER_VALUE);
 
 }
 
@@ -353,7 +703,7 @@ void dice_tmc_setConstantOffTimeChopper(struct DICE* dice,char constant_off_time
  	dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE] |= (1<<12);
    }
   
-   send262(dice,dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]);
+   tmc_update(dice,CHOPPER_CONFIG_REGISTER_VALUE);
 	
 }
 
@@ -434,7 +784,7 @@ void dice_tmc_setSpreadCycleChopper(struct DICE* dice,char constant_off_time, ch
    //set the hystereis decrement
    dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE] |= ((unsigned long)blank_value) << BLANK_TIMING_SHIFT;
    
-   send262(dice,dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]);
+   tmc_update(dice,CHOPPER_CONFIG_REGISTER_VALUE);
 }
 
 /*
@@ -457,7 +807,7 @@ void dice_tmc_setRandomOffTime(struct DICE* dice,char value)
 	dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE] &= ~(RANDOM_TOFF_TIME);
    }	
 
-   send262(dice,dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]);	
+   tmc_update(dice,CHOPPER_CONFIG_REGISTER_VALUE);	
 }
 
 
@@ -479,7 +829,7 @@ void dice_tmc_setStallGuardThreshold(struct DICE* dice,char stall_guard_threshol
    //Set the new stall guard threshold
    dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE] |= (((unsigned long)stall_guard_threshold << 8) & STALL_GUARD_CONFIG_PATTERN);
 
-   send262(dice,dice->userValues[STALL_GUARD2_CURRENT_REGISTER_VALUE]);
+   tmc_update(dice,STALL_GUARD2_CURRENT_REGISTER_VALUE);
 }
 
 char dice_tmc_getStallGuardThreshold(struct DICE* dice) 
@@ -536,7 +886,7 @@ void dice_tmc_setCoolStepConfiguration(struct DICE* dice,unsigned int lower_SG_t
         //and of course we have to include the signature of the register
         | COOL_STEP_REGISTER;
     
-    send262(dice,dice->userValues[COOL_STEP_REGISTER_VALUE]);
+    tmc_update(dice,COOL_STEP_REGISTER_VALUE);
 }
 
 void dice_tmc_setCoolStepEnabled(struct DICE* dice,char enabled) {
@@ -547,7 +897,11 @@ void dice_tmc_setCoolStepEnabled(struct DICE* dice,char enabled) {
         dice->userValues[COOL_STEP_REGISTER_VALUE] |=dice->userValues[LOWER_SG_THRESHOLD];
     }
 
-    send262(dice,dice->userValues[COOL_STEP_REGISTER_VALUE]);
+    tmc_update(dice,COOL_STEP_REGISTER_VALUE);
+}
+
+char dice_tmc_isCoolStepEnabled(struct DICE* dice) {
+    return (dice->userValues[COOL_STEP_REGISTER_VALUE] & SE_MIN_PATTERN) != 0;
 }
 
 unsigned int dice_tmc_getCoolStepLowerSgThreshold(struct DICE* dice) {
@@ -573,36 +927,29 @@ unsigned char dice_tmc_getCoolStepLowerCurrentLimit(struct DICE* dice) {
 
 int dice_tmc_getMotorPosition(struct DICE* dice) {
    //we read it out even if we are not started yet - perhaps it is useful information for somebody 
-    dice_tmc_readStatus(dice,TMC26X_READOUT_POSITION);
-    return dice_tmc_getReadoutValue(dice);
+    return tmc_readout(dice,TMC26X_READOUT_POSITION);
 }
 
 //reads the stall guard setting from last status
 //returns -1 if stallguard information is not present
 int dice_tmc_getCurrentStallGuardReading(struct DICE* dice) 
 {
-  //not time optimal, but solution optiomal:
-  //first read out the stall guard value
-  dice_tmc_readStatus(dice,TMC26X_READOUT_STALLGUARD);
-  return dice_tmc_getReadoutValue(dice);
+  //served from the telemetry if it is recent enough
+  return tmc_readout(dice,TMC26X_READOUT_STALLGUARD);
 }
 
 //reads the stall guard setting from last status
 //returns -1 if stallguard information is not present
 int dice_tmc_setCurrentStallGuardReading(struct DICE* dice) 
 {
-  //not time optimal, but solution optiomal:
-  //first read out the stall guard value
-  dice_tmc_readStatus(dice,TMC26X_READOUT_STALLGUARD);
-  return dice_tmc_getReadoutValue(dice);
+  //served from the telemetry if it is recent enough
+  return tmc_readout(dice,TMC26X_READOUT_STALLGUARD);
 }
 
 unsigned char dice_tmc_getCurrentCSReading(struct DICE* dice) 
 {
-  //not time optimal, but solution optiomal:
-  //first read out the stall guard value
-  dice_tmc_readStatus(dice,TMC26X_READOUT_CURRENT);
-  return (dice_tmc_getReadoutValue(dice) & 0x1f);
+  //served from the telemetry if it is recent enough
+  return (tmc_readout(dice,TMC26X_READOUT_CURRENT) & 0x1f);
 }
 
 unsigned int dice_tmc_getCurrentCurrent(struct DICE* dice) {
@@ -675,7 +1022,7 @@ void dice_tmc_setEnabled(struct DICE* dice,char enabled) {
         dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE] |= dice->userValues[CONSTANT_OFFTIME];
     }
     //if not enabled we don't have to do anything since we already delete t_off from the register
-    send262(dice,dice->userValues[CHOPPER_CONFIG_REGISTER_VALUE]);	
+    tmc_update(dice,CHOPPER_CONFIG_REGISTER_VALUE);	
 }
 
 char dice_tmc_isEnabled(struct DICE* dice) {
@@ -690,7 +1037,7 @@ char dice_tmc_isEnabled(struct DICE* dice) {
 // be read by the various status routines.
 void dice_tmc_readStatus(struct DICE* dice,char read_value) 
 {
-    unsigned long old_driver_configuration_register_value = dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE];
+    unsigned long sent_driver_configuration_register_value = dice->userValues[TMC_SENT_REGISTER_VALUE+DRIVER_CONFIGURATION_REGISTER_VALUE];
     //reset the readout configuration
    dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE] &= ~(READ_SELECTION_PATTERN);
    //this now equals TMC26X_READOUT_POSITION - so we just have to check the other two options
@@ -700,8 +1047,10 @@ void dice_tmc_readStatus(struct DICE* dice,char read_value)
  	dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE] |= READ_STALL_GUARD_AND_COOL_STEP;
    }
    //all other cases are ignored to prevent funny values
-   //check if the readout is configured for the value we are interested in
-   if (dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]!=old_driver_configuration_register_value) {
+   //check if the driver holds the readout we are interested in - the shadow copy may differ
+   //from what was sent, and an unknown register has to be sent anyway
+   if (sent_driver_configuration_register_value == ~0ul
+       || (sent_driver_configuration_register_value & READ_SELECTION_PATTERN) != (dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE] & READ_SELECTION_PATTERN)) {
      //because then we need to write the value twice - one time for configuring, second time to get the value, see below
       send262(dice,dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]);
    }
@@ -709,6 +1058,52 @@ void dice_tmc_readStatus(struct DICE* dice,char read_value)
    send262(dice,dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]);
 }
 
+char dice_tmc_getReadoutSelection(struct DICE* dice)
+{
+   unsigned long rdsel = dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE] & READ_SELECTION_PATTERN;
+   if (rdsel == READ_STALL_GUARD_READING)
+      return TMC26X_READOUT_STALLGUARD;
+   if (rdsel == READ_STALL_GUARD_AND_COOL_STEP)
+      return TMC26X_READOUT_CURRENT;
+   return TMC26X_READOUT_POSITION;
+}
+
+void dice_tmc_setMaxAge(struct DICE* dice,unsigned long max_age_us)
+{
+   dice->userValues[TMC_MAX_AGE] = max_age_us;
+}
+
+unsigned long dice_tmc_getMaxAge(struct DICE* dice)
+{
+   return dice->userValues[TMC_MAX_AGE];
+}
+
+unsigned long dice_tmc_getStatusAge(struct DICE* dice)
+{
+   if(!(dice->userValues[TMC_TELEMETRY_VALID] & TMC_STATUS_VALID))
+      return ~0ul;
+   return tmc_age(tmc_now_us(),tmc_get_stamp(dice,TMC_STATUS_TIME));
+}
+
+unsigned long dice_tmc_getReadoutAge(struct DICE* dice,char read_value)
+{
+   int rdsel = tmc_rdsel(read_value);
+
+   if(!(dice->userValues[TMC_TELEMETRY_VALID] & (1ul << rdsel)))
+      return ~0ul;
+   return tmc_age(tmc_now_us(),tmc_get_stamp(dice,TMC_READOUT_TIME+2*rdsel));
+}
+
+int dice_tmc_pollStatus(struct DICE* dice)
+{
+   if(dice->userValues[TMC_MAX_AGE] != 0 && dice_tmc_getStatusAge(dice) <= dice->userValues[TMC_MAX_AGE])
+      return 0;
+
+   //one datagram with the readout selected now
+   send262(dice,dice->userValues[DRIVER_CONFIGURATION_REGISTER_VALUE]);
+   return 1;
+}
+
 int dice_tmc_getReadoutValue(struct DICE* dice) {
    return (int)(dice->userValues[DRIVER_STATUS_RESULT] >> 10);
 }
@@ -716,27 +1111,60 @@ int dice_tmc_getReadoutValue(struct DICE* dice) {
 void send262(struct DICE* dice,unsigned long datagram)
 {
     unsigned long i_datagram=0;
-    int i;
-    //select the TMC driver
-    iochain_clearbit(dice->enable);
-    iochain_update();
+    unsigned long long now;
+    int i, rdsel;
+    unsigned char tx[3];
+    unsigned char rx[3];
+
+    //the bus is ours until the chip is deselected again
+    spi_session_begin(&tmc262_spi);
+
+    //select the TMC driver - the CS has to be latched even inside a transaction
+    iochain_ctx_clearbit(dice->chain,dice->enable);
+    iochain_ctx_flush(dice->chain);
 
     //ensure that only valid bit are set (0-19)
     //datagram &=REGISTER_BIT_PATTERN;
 	
-    //write/read the values
-    i_datagram = spi_transfer((datagram >> 16) & 0xff);
-    i_datagram <<= 8;
-    i_datagram |= spi_transfer((datagram >>  8) & 0xff);
-    i_datagram <<= 8;
-    i_datagram |= spi_transfer((datagram) & 0xff);
+    //write/read the values in one transfer
+    tx[0] = (datagram >> 16) & 0xff;
+    tx[1] = (datagram >>  8) & 0xff;
+    tx[2] = (datagram) & 0xff;
+    spi_transfernb(tx,rx,3);
+    i_datagram = ((unsigned long)rx[0] << 16) | ((unsigned long)rx[1] << 8) | rx[2];
     i_datagram >>= 4;
      
-    //deselect the TMC chip
-    iochain_setbit(dice->enable);
-    iochain_update();
+    //deselect the TMC chip - the datagram is taken over on the rising edge
+    iochain_ctx_setbit(dice->chain,dice->enable);
+    iochain_ctx_flush(dice->chain);
 
- 
     //store the datagram as status result
     dice->userValues[DRIVER_STATUS_RESULT] = i_datagram;
+
+    //the status flags do not depend on the readout selection
+    now = tmc_now_us();
+    tmc_set_stamp(dice,TMC_STATUS_TIME,now);
+    dice->userValues[TMC_TELEMETRY_VALID] |= TMC_STATUS_VALID;
+
+    //the readout is selected by the RDSEL the driver held before this datagram.
+    //DRVCONF is 0 after a power on reset (RDSEL 0, the microstep position), but a driver
+    //which kept its power while the library restarted holds any RDSEL - until DRVCONF
+    //is sent the readout is unknown and not recorded
+    rdsel = 3;
+    if(dice->userValues[TMC_SENT_REGISTER_VALUE+DRIVER_CONFIGURATION_REGISTER_VALUE] != ~0ul)
+      rdsel = (dice->userValues[TMC_SENT_REGISTER_VALUE+DRIVER_CONFIGURATION_REGISTER_VALUE] & READ_SELECTION_PATTERN) >> 4;
+    if(rdsel < 3)
+    {
+      dice->userValues[TMC_READOUT_VALUE+rdsel] = i_datagram >> 10;
+      tmc_set_stamp(dice,TMC_READOUT_TIME+2*rdsel,now);
+      dice->userValues[TMC_TELEMETRY_VALID] |= 1ul << rdsel;
+    }
+
+    //the driver holds the register now
+    i = tmc_register_index(datagram);
+    dice->userValues[TMC_SENT_REGISTER_VALUE+i] = datagram;
+    dice->userValues[TMC_DIRTY] &= ~(1ul << i);
+
+    //the shadows are updated inside the session - a session holder sees them settled
+    spi_session_end();
 }
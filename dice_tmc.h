@@ -25,6 +25,14 @@
 
 #include "dice_common.h"
 
+// fastest SPI clock of the TMC262 - a quarter of its 16MHz clock
+#define TMC262_SPI_MAX_HZ 4000000ul
+
+struct SPI_PROFILE;
+
+// members of one broadcast, larger groups are split
+#define DICE_TMC_GROUP_MAX 16
+
 
 //! return value for TMC26XStepper.getOverTemperature() if there is a overtemperature situation in the TMC chip
 /*!
@@ -80,7 +88,51 @@ int dice_tmc_setup(struct DICE* dice,int board, int slot);
 // dice - the dice to start
 int dice_tmc_start(struct DICE* dice);
 
+// the spi profile of the TMC262 - set up by dice_tmc_setup, for sessions around
+// transfers of the caller (see spi_session_begin)
+const struct SPI_PROFILE* dice_tmc_getSpiProfile();
+
+// The setters work on a shadow copy of the five registers. A register is dirty while
+// the copy differs from what the driver holds. With autoflush (the default) every
+// setter sends its dirty registers at once, otherwise dice_tmc_flush sends them.
+// Settle the step mode (setDoubleEdge, setMicrosteps) with a flush before stepping.
+
+// send every dirty register once - returns the number of datagrams
+int dice_tmc_flush(struct DICE* dice);
+
+// send changed registers from the setters (1) or only with dice_tmc_flush (0)
+void dice_tmc_setAutoFlush(struct DICE* dice,char enabled);
+char dice_tmc_isAutoFlush(struct DICE* dice);
+
+// the dirty registers - bit 0 DRVCTRL, 1 CHOPCONF, 2 SMARTEN, 3 SGCSCONF, 4 DRVCONF
+unsigned char dice_tmc_getDirty(struct DICE* dice);
+
+// forget what the driver holds, e.g. after it lost power - the next flush sends all
+// five registers
+void dice_tmc_invalidate(struct DICE* dice);
+
+// Group broadcast: the chip selects of a group are pulled low in one chain frame,
+// a datagram is clocked once into all of them and they are released together.
+// Only members whose register holds the same value share a datagram, the others get
+// their own - a group of equal drivers is configured for the cost of one.
+// MISO is shared, so the status words of a broadcast are ignored; status and
+// readouts are read singly (readStatus, pollStatus).
+
+// start a group - like dice_tmc_start, returns the number of transfers
+int dice_tmc_startMany(struct DICE** dice,int n);
+
+// send the dirty registers of a group - returns the number of transfers
+int dice_tmc_flushMany(struct DICE** dice,int n);
+
+// group setters - send with dice_tmc_flushMany unless autoflush is off for a member
+void dice_tmc_setCurrentMany(struct DICE** dice,int n,unsigned int current);
+void dice_tmc_setMicrostepsMany(struct DICE** dice,int n,int number_of_steps);
+void dice_tmc_setEnabledMany(struct DICE** dice,int n,char enabled);
+
 // step the dice for one step
+// In double edge mode this toggles the step bit, one chain update per step.
+// Otherwise (the default) the step bit is pulsed, which takes two chain updates.
+// The mode is the one last sent to the driver, a pending setDoubleEdge does not count.
 // dice - the dice to step
 int dice_tmc_step(struct DICE* dice);
 
@@ -89,6 +141,14 @@ int dice_tmc_step(struct DICE* dice);
 // dir - the direction, 1 or 0
 int dice_tmc_dir(struct DICE* dice,int dir);
 
+// Switch stepping on both edges of the step input (DEDGE) on or off
+// dice - the dice to work on
+// enabled - 1 steps on every level change of the step bit, 0 steps on rising edges only
+void dice_tmc_setDoubleEdge(struct DICE* dice,char enabled);
+
+// returns 1 if the driver steps on both edges - the sent DRVCTRL, not the shadow copy
+char dice_tmc_isDoubleEdge(struct DICE* dice);
+
 // Set the number of microsteps in 2^i values (rounded) up to 256
 //
 // This method set's the number of microsteps per step in 2^i interval.
@@ -218,6 +278,10 @@ void dice_tmc_setCoolStepConfiguration(struct DICE* dice,unsigned int lower_SG_t
 // See also: dice_tmc_setCoolStepConfiguration() 
 void dice_tmc_setCoolStepEnabled(struct DICE* dice,char enabled);
 
+// returns true if the CoolStep smart energy operation is enabled
+// See also: dice_tmc_setCoolStepEnabled()
+char dice_tmc_isCoolStepEnabled(struct DICE* dice);
+
 // returns the lower StallGuard threshold for the CoolStep operation
 // See also dice_tmc_setCoolStepConfiguration()
 unsigned int dice_tmc_getCoolStepLowerSgThreshold(struct DICE* dice);
@@ -338,4 +402,29 @@ char dice_tmc_isEnabled(struct DICE* dice);
 // See also TMC26X_READOUT_POSITION, TMC_262_READOUT_STALLGUARD, TMC_262_READOUT_CURRENT
 void dice_tmc_readStatus(struct DICE* dice,char read_value);
 
+// the readout selected in the shadow copy - TMC26X_READOUT_POSITION, _STALLGUARD or _CURRENT
+char dice_tmc_getReadoutSelection(struct DICE* dice);
+
+// the readout value of the last status word - see readStatus
+int dice_tmc_getReadoutValue(struct DICE* dice);
+
+// Telemetry: every datagram clocks back a status word. It is decoded and time stamped
+// together with the readout selection the driver used for it, so the flags and the
+// readout values are known without extra reads.
+// getMotorPosition, getCurrentStallGuardReading and getCurrentCSReading only send a
+// readout datagram if their cached value is older than the age limit.
+
+// set the age limit in us - 0 (the default) reads every time
+void dice_tmc_setMaxAge(struct DICE* dice,unsigned long max_age_us);
+unsigned long dice_tmc_getMaxAge(struct DICE* dice);
+
+// age in us of the last status word or of a readout, ~0 if there was none yet
+// (or if it is older than ~0 us - the stamps are 64 bit and do not wrap)
+unsigned long dice_tmc_getStatusAge(struct DICE* dice);
+unsigned long dice_tmc_getReadoutAge(struct DICE* dice,char read_value);
+
+// refresh the status flags if they are older than the age limit
+// returns 1 if a datagram was sent, 0 if the flags were recent enough
+int dice_tmc_pollStatus(struct DICE* dice);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,261 @@
+//
+// Raspidapter library
+//
+// DICE TMC CoolStep tuning implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_estop.h"
+#include "dice_motion.h"
+#include "dice_tmc.h"
+#include "dice_tmc_cooltune.h"
+
+#include <string.h>
+
+void dice_tmc_cooltune_defaults(struct TMC_COOLTUNE_CONFIG* config)
+{
+   memset(config,0,sizeof(struct TMC_COOLTUNE_CONFIG));
+   config->levels = 1;
+   config->step_ns[0] = 1000000;
+   config->settle_steps = 64;
+   config->readings = 16;
+   config->steps_per_read = 4;
+}
+
+static unsigned int cooltune_clamp(int value,int low,int high)
+{
+   if(value < low)
+      return low;
+   if(value > high)
+      return high;
+   return value;
+}
+
+// below this span of the level means the load hardly changes the reading
+#define COOLTUNE_FLAT_SPAN 64
+// margins of the lowest reading over the noise for the SEUP steps 3, 2 and 1
+#define COOLTUNE_MARGIN_STALL 64
+#define COOLTUNE_MARGIN_CLOSE 128
+#define COOLTUNE_MARGIN_NEAR 256
+// noise above which readings are noisy (SEDN 0) or unsteady (SEDN 1)
+#define COOLTUNE_NOISE_HIGH 64
+#define COOLTUNE_NOISE_LOW 32
+// even the heaviest level reads above this - allow a quarter current
+#define COOLTUNE_LIGHT_READING 512
+
+// the setting from the measured readings
+static void cooltune_derive(struct TMC_COOLTUNE_RESULT* r)
+{
+   int span = r->sg_high - r->sg_low;
+   int lower, upper, margin;
+
+   if(span < COOLTUNE_FLAT_SPAN)
+   {
+      //the load hardly changes the reading - keep close to the loaded value
+      lower = r->sg_low / 2;
+      upper = lower + COOLTUNE_FLAT_SPAN;
+   }
+   else
+   {
+      lower = r->sg_low + span / 4;
+      upper = r->sg_low + span * 3 / 4;
+   }
+   //SEMIN 0 would turn CoolStep off, SEMIN and SEMAX count in 32
+   r->lower_threshold = cooltune_clamp(lower,32,480) & ~31u;
+   r->hysteresis = cooltune_clamp(upper - (int)r->lower_threshold - 32,0,480);
+
+   //the closer the readings come to a stall the faster the current has to rise
+   margin = r->sg_min - r->noise;
+   if(margin < COOLTUNE_MARGIN_STALL)
+      r->increment = 3;
+   else if(margin < COOLTUNE_MARGIN_CLOSE)
+      r->increment = 2;
+   else if(margin < COOLTUNE_MARGIN_NEAR)
+      r->increment = 1;
+   else
+      r->increment = 0;
+
+   //noisy readings have to agree longer before the current drops
+   if(r->noise > COOLTUNE_NOISE_HIGH)
+      r->decrement = 0;
+   else if(r->noise > COOLTUNE_NOISE_LOW)
+      r->decrement = 1;
+   else
+      r->decrement = 2;
+
+   //a light load leaves a lot of room - go down to a quarter
+   r->minimum = r->sg_low > COOLTUNE_LIGHT_READING ? COOL_STEP_QUARTDER_CS_LIMIT : COOL_STEP_HALF_CS_LIMIT;
+}
+
+// the settings tuning changes - restored on every return unless a result is applied
+// or an emergency stop ended the run
+struct TMC_COOLTUNE_SAVED
+{
+   unsigned int lower[TMC_COOLTUNE_MAX_AXES];
+   unsigned int upper[TMC_COOLTUNE_MAX_AXES];
+   unsigned char readings[TMC_COOLTUNE_MAX_AXES];
+   unsigned char increment[TMC_COOLTUNE_MAX_AXES];
+   unsigned char minimum[TMC_COOLTUNE_MAX_AXES];
+   char enabled[TMC_COOLTUNE_MAX_AXES];
+   char readout[TMC_COOLTUNE_MAX_AXES];
+};
+
+// result - the results to apply, NULL to restore every axis
+static int cooltune_restore(struct DICE** dice,int n,const struct TMC_COOLTUNE_SAVED* saved,const struct TMC_COOLTUNE_RESULT* result)
+{
+   int i, warned = 0;
+
+   for(i=0; i < n; i++)
+   {
+      //a hot driver keeps its former setting
+      if(result != NULL && result[i].overtemperature)
+         warned = 1;
+      if(result != NULL && !result[i].overtemperature)
+      {
+         dice_tmc_cooltune_apply(dice[i],&result[i]);
+      }
+      else
+      {
+         //the getters return the setter arguments in the same order
+         dice_tmc_setCoolStepConfiguration(dice[i],saved->lower[i],saved->upper[i],saved->readings[i],saved->increment[i],saved->minimum[i]);
+         dice_tmc_setCoolStepEnabled(dice[i],saved->enabled[i]);
+         dice_tmc_flush(dice[i]);
+      }
+      if(dice_tmc_getReadoutSelection(dice[i]) != saved->readout[i])
+         dice_tmc_readStatus(dice[i],saved->readout[i]);
+   }
+   return warned;
+}
+
+void dice_tmc_cooltune_apply(struct DICE* dice,const struct TMC_COOLTUNE_RESULT* result)
+{
+   //the setter keeps SEUP in its decrement argument and SEDN in its increment argument
+   dice_tmc_setCoolStepConfiguration(dice,result->lower_threshold,result->hysteresis,result->increment,result->decrement,result->minimum);
+   dice_tmc_setCoolStepEnabled(dice,1);
+   dice_tmc_flush(dice);
+}
+
+int dice_tmc_cooltune(struct DICE** dice,int n,const struct TMC_COOLTUNE_CONFIG* config,struct TMC_COOLTUNE_RESULT* result)
+{
+   struct TMC_COOLTUNE_SAVED saved;
+   long sum[TMC_COOLTUNE_MAX_AXES];
+   int low[TMC_COOLTUNE_MAX_AXES];
+   int high[TMC_COOLTUNE_MAX_AXES];
+   unsigned long long deadline;
+   int i, level, reading;
+   long step;
+
+   //error checking
+   if(dice == NULL || config == NULL || result == NULL)
+      return ERR_PARAM;
+   if(n < 1 || n > TMC_COOLTUNE_MAX_AXES || config->levels < 1 || config->levels > TMC_COOLTUNE_MAX_LEVELS)
+      return ERR_PARAM;
+   if(config->readings < 1 || config->steps_per_read < 1)
+      return ERR_PARAM;
+   for(i=0; i < n; i++)
+   {
+      if(dice[i] == NULL || dice[i]->type != DICE_TMC)
+         return ERR_PARAM;
+   }
+
+   //full current while measuring, every datagram returns the StallGuard reading
+   for(i=0; i < n; i++)
+   {
+      memset(&result[i],0,sizeof(struct TMC_COOLTUNE_RESULT));
+      result[i].sg_min = 1023;
+      result[i].sg_low = 1023;
+      saved.lower[i] = dice_tmc_getCoolStepLowerSgThreshold(dice[i]);
+      saved.upper[i] = dice_tmc_getCoolStepUpperSgThreshold(dice[i]);
+      saved.readings[i] = dice_tmc_getCoolStepNumberOfSGReadings(dice[i]);
+      saved.increment[i] = dice_tmc_getCoolStepCurrentIncrementSize(dice[i]);
+      saved.minimum[i] = dice_tmc_getCoolStepLowerCurrentLimit(dice[i]);
+      saved.enabled[i] = dice_tmc_isCoolStepEnabled(dice[i]);
+      saved.readout[i] = dice_tmc_getReadoutSelection(dice[i]);
+      dice_tmc_setCoolStepEnabled(dice[i],0);
+      dice_tmc_flush(dice[i]);
+      dice_tmc_readStatus(dice[i],TMC26X_READOUT_STALLGUARD);
+   }
+
+   for(level=0; level < config->levels; level++)
+   {
+      if(config->load != NULL)
+         config->load(level,config->arg);
+
+      for(i=0; i < n; i++)
+      {
+         sum[i] = 0;
+         low[i] = 1023;
+         high[i] = 0;
+      }
+
+      deadline = timing_now_ns();
+      reading = 0;
+      for(step=1; reading < config->readings; step++)
+      {
+         deadline += config->step_ns[level];
+         timing_wait_until(deadline);
+         //while stopped the drivers belong to the stop worker
+         if(estop_active())
+            return ERR_ESTOP;
+
+         dice_step_many(dice,n);
+
+         if(step < config->settle_steps || step % config->steps_per_read != 0)
+            continue;
+
+         for(i=0; i < n; i++)
+         {
+            int sg;
+
+            dice_tmc_readStatus(dice[i],TMC26X_READOUT_STALLGUARD);
+            sg = dice_tmc_getReadoutValue(dice[i]);
+            sum[i] += sg;
+            if(sg < low[i])
+               low[i] = sg;
+            if(sg > high[i])
+               high[i] = sg;
+            if(dice_tmc_getOverTemperature(dice[i]))
+               result[i].overtemperature = 1;
+         }
+         reading++;
+      }
+
+      for(i=0; i < n; i++)
+      {
+         int mean = (int)(sum[i] / config->readings);
+
+         if(low[i] < result[i].sg_min)
+            result[i].sg_min = low[i];
+         if(mean < result[i].sg_low)
+            result[i].sg_low = mean;
+         if(mean > result[i].sg_high)
+            result[i].sg_high = mean;
+         if(mean - low[i] > result[i].noise)
+            result[i].noise = mean - low[i];
+         if(high[i] - mean > result[i].noise)
+            result[i].noise = high[i] - mean;
+      }
+   }
+
+   for(i=0; i < n; i++)
+      cooltune_derive(&result[i]);
+
+   return cooltune_restore(dice,n,&saved,result);
+}
@@ -0,0 +1,84 @@
+//
+// Raspidapter Library Code
+//
+// DICE TMC CoolStep tuning header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef DICE_TMC_COOLTUNE_H
+#define DICE_TMC_COOLTUNE_H
+
+#include "dice_common.h"
+
+// CoolStep tuning of TMC axes
+// The axes run through a number of load levels with CoolStep off, so at full current.
+// A level is a step rate and optionally a callback that puts a load on the axes.
+// The StallGuard readings of every level give the thresholds: the current rises when
+// the reading falls into the lower quarter of the measured range and drops in the
+// upper quarter. The step widths follow the noise of the readings and the margin to a stall.
+// The current may drop to a quarter when even the heaviest level reads in the upper half.
+// The result is applied and CoolStep enabled, keep it to apply it again after a restart.
+// On an error or an overtemperature warning the axis gets its former CoolStep setting
+// back, the readout selection is restored in any case. After an emergency stop the
+// drivers are left as the run set them - set them again after estop_release.
+
+#define TMC_COOLTUNE_MAX_AXES 16
+#define TMC_COOLTUNE_MAX_LEVELS 8
+
+struct TMC_COOLTUNE_CONFIG
+{
+   int levels;                                   // number of load levels
+   unsigned long step_ns[TMC_COOLTUNE_MAX_LEVELS]; // time between two steps on each level
+   long settle_steps;                            // steps on a level before the first reading
+   int readings;                                 // readings per level
+   int steps_per_read;                           // steps between two readings
+   void (*load)(int level,void* arg);            // called before each level, may be NULL
+   void* arg;
+};
+
+// the CoolStep setting of an axis, in the units of dice_tmc_setCoolStepConfiguration
+struct TMC_COOLTUNE_RESULT
+{
+   unsigned int lower_threshold;   // SEMIN in StallGuard units
+   unsigned int hysteresis;        // SEMAX in StallGuard units
+   unsigned char increment;        // SEUP 0..3: 1, 2, 4 or 8 current steps on a low reading
+   unsigned char decrement;        // SEDN 0..3: a step down after 32, 8, 2 or 1 high readings
+   unsigned char minimum;          // COOL_STEP_HALF_CS_LIMIT or COOL_STEP_QUARTDER_CS_LIMIT
+   // the measurement
+   int sg_min;                     // lowest reading
+   int sg_low;                     // lowest mean of a level
+   int sg_high;                    // highest mean of a level
+   int noise;                      // largest distance of a reading from the mean of its level
+   char overtemperature;           // warning seen during the sweep
+};
+
+// fill in defaults: one level at 1ms per step, 16 readings every 4 steps
+void dice_tmc_cooltune_defaults(struct TMC_COOLTUNE_CONFIG* config);
+
+// measure the axes and apply the derived CoolStep setting
+// dice - the axes, started TMC DICE, all step in the same frames
+// n - number of axes, up to TMC_COOLTUNE_MAX_AXES
+// result - array of n results
+// returns 0, 1 if a driver warned about overtemperature - its result is not applied -,
+// ERR_ESTOP if an emergency stop ended the run, or an error
+int dice_tmc_cooltune(struct DICE** dice,int n,const struct TMC_COOLTUNE_CONFIG* config,struct TMC_COOLTUNE_RESULT* result);
+
+// apply a stored result and enable CoolStep
+void dice_tmc_cooltune_apply(struct DICE* dice,const struct TMC_COOLTUNE_RESULT* result);
+
+#endif
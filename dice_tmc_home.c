@@ -0,0 +1,153 @@
+//
+// Raspidapter library
+//
+// DICE TMC homing implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_estop.h"
+#include "dice_motion.h"
+#include "dice_tmc.h"
+#include "dice_tmc_home.h"
+
+#include <string.h>
+
+void dice_tmc_home_defaults(struct TMC_HOME_CONFIG* config)
+{
+   config->threshold = 0;
+   config->filter = 0;
+   config->steps_per_read = 4;
+   config->max_steps = 100000;
+   config->skip_steps = 64;
+   config->step_ns = 1000000;
+   config->stall_level = 0;
+}
+
+// the settings homing changes - restored on every return but an emergency stop
+struct TMC_HOME_SAVED
+{
+   char threshold[TMC_HOME_MAX_AXES];
+   char filter[TMC_HOME_MAX_AXES];
+   char readout[TMC_HOME_MAX_AXES];
+};
+
+static void home_restore(struct DICE** dice,int n,const struct TMC_HOME_SAVED* saved)
+{
+   int i;
+
+   for(i=0; i < n; i++)
+   {
+      dice_tmc_setStallGuardThreshold(dice[i],saved->threshold[i],saved->filter[i]);
+      dice_tmc_flush(dice[i]);
+      if(dice_tmc_getReadoutSelection(dice[i]) != saved->readout[i])
+         dice_tmc_readStatus(dice[i],saved->readout[i]);
+   }
+}
+
+int dice_tmc_home(struct DICE** dice,const int* dir,int n,const struct TMC_HOME_CONFIG* config,struct TMC_HOME_RESULT* result)
+{
+   struct DICE* moving[TMC_HOME_MAX_AXES];
+   int index[TMC_HOME_MAX_AXES];
+   struct TMC_HOME_SAVED saved;
+   unsigned long long deadline;
+   long step;
+   int i, k, active;
+   int ret = 0;
+
+   //error checking
+   if(dice == NULL || dir == NULL || config == NULL || result == NULL)
+      return ERR_PARAM;
+   if(n < 1 || n > TMC_HOME_MAX_AXES || config->steps_per_read < 1)
+      return ERR_PARAM;
+   for(i=0; i < n; i++)
+   {
+      if(dice[i] == NULL || dice[i]->type != DICE_TMC)
+         return ERR_PARAM;
+   }
+
+   memset(result,0,sizeof(struct TMC_HOME_RESULT));
+
+   //threshold and the StallGuard readout - from now on every datagram returns the load
+   for(i=0; i < n; i++)
+   {
+      saved.threshold[i] = dice_tmc_getStallGuardThreshold(dice[i]);
+      saved.filter[i] = dice_tmc_getStallGuardFilter(dice[i]);
+      saved.readout[i] = dice_tmc_getReadoutSelection(dice[i]);
+      dice_tmc_setStallGuardThreshold(dice[i],config->threshold,config->filter);
+      dice_tmc_flush(dice[i]);
+      dice_tmc_readStatus(dice[i],TMC26X_READOUT_STALLGUARD);
+      moving[i] = dice[i];
+      index[i] = i;
+   }
+   dice_dir_many(dice,dir,n);
+
+   active = n;
+   deadline = timing_now_ns();
+   for(step=1; active > 0 && step <= config->max_steps; step++)
+   {
+      deadline += config->step_ns;
+      timing_wait_until(deadline);
+      if(estop_active())
+      {
+         ret = ERR_ESTOP;
+         break;
+      }
+
+      //all moving axes in one frame
+      dice_step_many(moving,active);
+
+      if(step < config->skip_steps || step % config->steps_per_read != 0)
+         continue;
+
+      //one datagram per moving axis, drop the stalled ones
+      for(i=0, k=0; i < active; i++)
+      {
+         int sg;
+
+         dice_tmc_readStatus(moving[i],TMC26X_READOUT_STALLGUARD);
+         result->reads++;
+         sg = dice_tmc_getReadoutValue(moving[i]);
+         result->stallguard[index[i]] = sg;
+         result->steps[index[i]] = step;
+
+         if(dice_tmc_isStallGuardReached(moving[i]) || sg <= config->stall_level)
+         {
+            result->homed[index[i]] = 1;
+            continue;
+         }
+         moving[k] = moving[i];
+         index[k] = index[i];
+         k++;
+      }
+      active = k;
+   }
+
+   //while stopped the drivers belong to the stop worker
+   if(ret == ERR_ESTOP)
+      return ret;
+   home_restore(dice,n,&saved);
+   if(ret != 0)
+      return ret;
+
+   for(i=0; i < active; i++)
+      result->steps[index[i]] = config->max_steps;
+
+   return active == 0 ? 0 : 1;
+}
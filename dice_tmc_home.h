@@ -0,0 +1,71 @@
+//
+// Raspidapter Library Code
+//
+// DICE TMC homing header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef DICE_TMC_HOME_H
+#define DICE_TMC_HOME_H
+
+#include "dice_common.h"
+
+// sensorless homing of TMC axes with StallGuard2
+// All axes step in the same chain frames. Every steps_per_read steps each moving axis
+// sends one datagram - the readout is set to StallGuard before, so the status word of
+// that datagram carries the load - and stops once it stalls. A stall is found at most
+// steps_per_read steps after it happened.
+// The StallGuard threshold, filter and readout of every axis are restored on return.
+// After an emergency stop they are left as homing set them - set them again after
+// estop_release.
+
+#define TMC_HOME_MAX_AXES 16
+
+struct TMC_HOME_CONFIG
+{
+   char threshold;            // StallGuard threshold SGT, -64 to 63
+   char filter;               // 1 filters StallGuard over four full steps
+   int steps_per_read;        // steps between the status reads of an axis
+   long max_steps;            // an axis not stalled after this many steps fails
+   long skip_steps;           // steps before the first read - StallGuard needs speed
+   unsigned long step_ns;     // time between two steps
+   int stall_level;           // a StallGuard reading at or below this is a stall
+};
+
+// outcome of every axis
+struct TMC_HOME_RESULT
+{
+   long steps[TMC_HOME_MAX_AXES];     // steps until the stall was found - the stall happened up to
+                                      // steps_per_read-1 steps earlier
+   int stallguard[TMC_HOME_MAX_AXES]; // last StallGuard reading
+   char homed[TMC_HOME_MAX_AXES];     // 1 stalled, 0 max_steps reached
+   int reads;                         // status datagrams sent
+};
+
+// fill in defaults: SGT 0, no filter, a read every 4 steps, 1ms per step
+void dice_tmc_home_defaults(struct TMC_HOME_CONFIG* config);
+
+// home TMC axes until they stall
+// dice - the axes, started TMC DICE
+// dir - direction of each axis
+// n - number of axes, up to TMC_HOME_MAX_AXES
+// returns 0 if all axes stalled, 1 if any did not, ERR_ESTOP after an emergency stop
+// or an error
+int dice_tmc_home(struct DICE** dice,const int* dir,int n,const struct TMC_HOME_CONFIG* config,struct TMC_HOME_RESULT* result);
+
+#endif
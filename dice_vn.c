@@ -23,6 +23,7 @@
 
 #include "raspidapter_common.h"
 #include "dice_vn.h"
+#include "dice_expander.h"
 
 #define PTR_INPUT_REG 0
 #define PTR_OUTPUT_REG 1
@@ -50,50 +51,48 @@ int dice_vn_setup(struct DICE* dice,int board, int slot,int number)
    dice->type = DICE_VN;
 
    //calc bit numbers
-   dice->enable = (board-1)*32 + (slot-1)*8 + 0;
-   dice->ms1 = (board-1)*32 + (slot-1)*8 + 4;
-   dice->ms2 = (board-1)*32 + (slot-1)*8 + 5;
-   dice->ms3 = (board-1)*32 + (slot-1)*8 + 1;
-   dice->rs = (board-1)*32 + (slot-1)*8 + 2;
-   dice->dir = (board-1)*32 + (slot-1)*8 + 3;
-   dice->step = (board-1)*32 + (slot-1)*8 + 6;
-   dice->slp = (board-1)*32 + (slot-1)*8 + 7;
+   int ret = dice_setup_pins(dice,board,slot);
+   if(ret != 0)
+     return ret;
 
    // set address bits
    if( (number-1) & (1<<0))
    {
-     iochain_setbit(dice->ms1);
+     iochain_ctx_setbit(dice->chain,dice->ms1);
    }
-   else iochain_clearbit(dice->ms1);
+   else iochain_ctx_clearbit(dice->chain,dice->ms1);
    
    if( (number-1) & (1<<1))
    {
-     iochain_setbit(dice->ms2);
+     iochain_ctx_setbit(dice->chain,dice->ms2);
   
    }
-   else iochain_clearbit(dice->ms2);
-   iochain_update();
+   else iochain_ctx_clearbit(dice->chain,dice->ms2);
+   iochain_ctx_update(dice->chain);
  
    //store address
    dice->i2c_addr = DEV_BASE_ADDR | (number -1);
 
+   //the registers are written through the shadow
+   dice_expander_setup(dice,1,PTR_OUTPUT_REG,PTR_POL_REG,PTR_CONFIG_REG);
+
    return 0;
 }
 
 
 int dice_vn_setoutput(struct DICE* dice,int pins)
 {
-   return write_i2c(dice->i2c_addr,PTR_CONFIG_REG,1,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_CONFIG,pins);
 }
 
 int dice_vn_setpolarity(struct DICE* dice,int pins)
 {
-    return write_i2c(dice->i2c_addr,PTR_POL_REG,1,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_POLARITY,pins);
 }
 
 int dice_vn_set(struct DICE* dice, int pins)
 {
-   return write_i2c(dice->i2c_addr,PTR_OUTPUT_REG,1,(char*) &pins);
+   return dice_expander_write(dice,DICE_EXPANDER_OUTPUT,pins);
 }
 
 int dice_vn_read(struct DICE* dice, int pins)
@@ -35,6 +35,7 @@ int dice_vn_setoutput(struct DICE* dice,int pins);
 int dice_vn_setpolarity(struct DICE* dice,int pins);
 
 //set pins - pins should be set as output
+//the three setters only write registers that changed, see dice_expander.h for bit helpers
 int dice_vn_set(struct DICE* dice, int pins);
 
 //read pins - pins should be set as input
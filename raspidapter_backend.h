@@ -0,0 +1,108 @@
+//
+// Raspidapter Library Code
+//
+// hardware backend header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef RASPIDAPTER_BACKEND_H
+#define RASPIDAPTER_BACKEND_H
+
+#include <stdint.h>
+
+struct IOCHAIN;
+struct IOCHAIN_OP;
+struct WAVE;
+
+// gpio numbers of the P1 header pins used by the raspidapter (V2 boards)
+#define GPIO_P1_11 17
+#define GPIO_P1_12 18
+#define GPIO_P1_13 27
+#define GPIO_P1_15 22
+#define GPIO_P1_24 8
+#define GPIO_P1_26 7
+
+// spi settings - the values match the bcm2835 library
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+#define SPI_BIT_ORDER_LSBFIRST 0
+#define SPI_BIT_ORDER_MSBFIRST 1
+// spi clock dividers of the 250MHz core clock, 0 means 65536
+#define SPI_CORE_CLOCK_HZ 250000000ul
+#define SPI_CLOCK_DIVIDER_65536 0
+#define SPI_CLOCK_DIVIDER_256 256
+#define SPI_CLOCK_DIVIDER_128 128
+#define SPI_CLOCK_DIVIDER_64 64
+#define SPI_CLOCK_DIVIDER_32 32
+
+// the hardware access of the library
+// All functions return 0 on success unless noted otherwise.
+struct RASPIDAPTER_BACKEND
+{
+   const char* name;
+
+   int (*init)();
+   int (*close)();
+
+   // gpio
+   void (*gpio_output)(int pin);
+   void (*gpio_write)(int pin, int level);
+   // cost of one gpio write in ns - the io chain takes it from its delays
+   unsigned int (*gpio_write_ns)();
+
+   // io chains - attach is called by iochain_init, play shifts out a compiled frame and strobes it
+   // play stops without a strobe and returns 1 as soon as chain->generation differs from
+   // generation - an emergency stop took over the pins
+   void (*iochain_attach)(const struct IOCHAIN* chain);
+   int (*iochain_play)(const struct IOCHAIN* chain, const struct IOCHAIN_OP* frame, unsigned int generation);
+
+   // i2c
+   int (*i2c_begin)();
+   void (*i2c_end)();
+   void (*i2c_set_baudrate)(unsigned int baudrate);
+   int (*i2c_write)(int address, const char* data, int len);
+   int (*i2c_read)(int address, char* data, int len);
+
+   // spi - the chip selects are in the io chain
+   int (*spi_begin)();
+   void (*spi_end)();
+   void (*spi_configure)(int mode, int bitorder, int divider);
+   void (*spi_transfer)(const unsigned char* tx, unsigned char* rx, int len);
+
+   // waveforms - play starts the playback and returns, busy is 1 until it is done
+   // NULL if the backend can not play waveforms
+   int (*wave_play)(const struct WAVE* wave);
+   int (*wave_busy)();
+   // stop a playing waveform at once - must be async signal safe
+   void (*wave_stop)();
+};
+
+// the backends of the library
+extern const struct RASPIDAPTER_BACKEND backend_bcm2835;
+extern const struct RASPIDAPTER_BACKEND backend_sim;
+
+// select the backend - must be called before setup_raspidapter
+// The default is backend_bcm2835, or backend_sim if built with RASPIDAPTER_SIM.
+int raspidapter_set_backend(const struct RASPIDAPTER_BACKEND* backend);
+
+// the selected backend
+const struct RASPIDAPTER_BACKEND* raspidapter_backend();
+
+#endif
@@ -0,0 +1,502 @@
+//
+// Raspidapter library
+//
+// bcm2835 backend implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+
+#include "bcm2835.h"
+#include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_wave.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define GPIO_WRITE_CALIBRATION 1000
+
+// waveforms are played by a dma channel, paced by the PWM fifo
+#define WAVE_DMA_CHANNEL 5
+
+// bus addresses as the dma engine sees the peripherals
+#define BUS_GPSET0 0x7E20001Cu
+#define BUS_GPCLR0 0x7E200028u
+#define BUS_PWM_FIF1 0x7E20C018u
+
+// register offsets (in words) from the start of the peripherals
+#define DMA_BASE (0x7000/4)
+#define DMA_CHANNEL_SIZE (0x100/4)
+#define DMA_ENABLE (0xFF0/4)
+#define DMA_CS 0
+#define DMA_CONBLK_AD 1
+#define DMA_DEBUG 8
+
+#define DMA_CS_RESET (1u<<31)
+#define DMA_CS_WAIT_WRITES (1u<<28)
+#define DMA_CS_PANIC_PRIORITY(x) ((x)<<20)
+#define DMA_CS_PRIORITY(x) ((x)<<16)
+#define DMA_CS_INT (1u<<2)
+#define DMA_CS_END (1u<<1)
+#define DMA_CS_ACTIVE (1u<<0)
+
+#define DMA_TI_NO_WIDE_BURSTS (1u<<26)
+#define DMA_TI_PERMAP(x) ((x)<<16)
+#define DMA_TI_DEST_DREQ (1u<<6)
+#define DMA_TI_WAIT_RESP (1u<<3)
+#define DMA_PERMAP_PWM 5
+
+#define PWM_CTL 0
+#define PWM_STA 1
+#define PWM_DMAC 2
+#define PWM_RNG1 4
+#define PWM_FIF1 6
+#define PWM_CTL_CLRF1 (1u<<6)
+#define PWM_CTL_USEF1 (1u<<5)
+#define PWM_CTL_PWEN1 (1u<<0)
+#define PWM_STA_FULL1 (1u<<0)
+#define PWM_DMAC_ENAB (1u<<31)
+#define PWM_DMAC_PANIC(x) ((x)<<8)
+#define PWM_DMAC_DREQ(x) (x)
+
+#define CM_PWMCTL (0xA0/4)
+#define CM_PWMDIV (0xA4/4)
+#define CM_PASSWD 0x5A000000u
+#define CM_BUSY (1u<<7)
+#define CM_KILL (1u<<5)
+#define CM_ENAB (1u<<4)
+#define CM_SRC_PLLD 6
+
+// the PWM runs at 10MHz, one fifo word per range
+#define PWM_CLOCK_NS 100
+#define PLLD_MHZ 500
+#define PLLD_MHZ_PI4 750
+#define PERI_BASE_PI4 0xFE000000ul
+#define PERI_BASE_PI1 0x20000000ul
+
+// videocore mailbox - allocates the uncached memory the dma engine reads
+#define MBOX_IOCTL _IOWR(100, 0, char*)
+#define MBOX_TAG_ALLOCATE 0x3000C
+#define MBOX_TAG_LOCK 0x3000D
+#define MBOX_TAG_UNLOCK 0x3000E
+#define MBOX_TAG_RELEASE 0x3000F
+#define MBOX_MEM_DIRECT 0x4
+#define MBOX_MEM_COHERENT 0x8
+
+#define PAGE_SIZE_BYTES 4096
+
+// hardware control block, 32 byte aligned
+struct DMA_CB
+{
+   uint32_t ti;
+   uint32_t source;
+   uint32_t dest;
+   uint32_t length;
+   uint32_t stride;
+   uint32_t next;
+   uint32_t pad[2];
+};
+
+// memory of the waveform player
+int wave_mbox = -1;
+unsigned int wave_handle = 0;
+uint32_t wave_bus = 0;            // bus address of the memory
+unsigned char* wave_mem = NULL;   // mapped memory
+unsigned int wave_size = 0;
+int wave_playing = 0;
+
+//internal function defines
+void bcm2835_wave_close();
+
+int bcm2835_backend_init()
+{
+   return bcm2835_init() ? 0 : ERR_INIT;
+}
+
+int bcm2835_backend_close()
+{
+   bcm2835_wave_close();
+   bcm2835_close();
+   return 0;
+}
+
+void bcm2835_backend_gpio_output(int pin)
+{
+   bcm2835_gpio_fsel(pin,BCM2835_GPIO_FSEL_OUTP);
+}
+
+void bcm2835_backend_gpio_write(int pin, int level)
+{
+   bcm2835_gpio_write(pin,level ? HIGH : LOW);
+}
+
+//
+// measure how long an unfenced gpio write takes - an empty clear mask changes nothing
+//
+unsigned int bcm2835_backend_gpio_write_ns()
+{
+   int i;
+   volatile uint32_t* gpclr = bcm2835_gpio + BCM2835_GPCLR0/4;
+   unsigned long long start = timing_now_ns();
+   for(i=0; i < GPIO_WRITE_CALIBRATION; i++)
+   {
+      bcm2835_peri_write_nb(gpclr,0);
+   }
+   __sync_synchronize();
+   return (unsigned int)((timing_now_ns() - start)/GPIO_WRITE_CALIBRATION);
+}
+
+//
+// shift out a compiled frame and latch it. Blocks while sending.
+// Only the frame is fenced, not the single writes.
+//
+int bcm2835_backend_iochain_play(const struct IOCHAIN* chain, const struct IOCHAIN_OP* frame, unsigned int generation)
+{
+   volatile uint32_t* gpset = bcm2835_gpio + BCM2835_GPSET0/4;
+   volatile uint32_t* gpclr = bcm2835_gpio + BCM2835_GPCLR0/4;
+   const struct IOCHAIN_OP* op = frame;
+   const struct IOCHAIN_OP* end = frame + chain->chain_bits;
+
+   __sync_synchronize();
+   for(; op != end; op++)
+   {
+      //an emergency stop owns the pins now
+      if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+         return 1;
+
+      if(op->set)
+         bcm2835_peri_write_nb(gpset,op->set);
+      timing_spin(chain->setup_wait);
+
+      //clock
+      bcm2835_peri_write_nb(gpset,chain->clock_mask);
+      timing_spin(chain->high_wait);
+      bcm2835_peri_write_nb(gpclr,op->clr);
+      timing_spin(chain->low_wait);
+   }
+   if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+      return 1;
+
+   //toggle strobe
+   bcm2835_peri_write_nb(gpset,chain->strobe_mask);
+   timing_spin(chain->strobe_wait);
+   bcm2835_peri_write_nb(gpclr,chain->strobe_mask);
+   __sync_synchronize();
+   return 0;
+}
+
+//
+// waveform player
+// The control blocks and the data words live in uncached memory from the videocore.
+// Delay blocks write to the PWM fifo, which takes one word per tick.
+//
+
+static unsigned int mbox_call(unsigned int tag, unsigned int* values, int count)
+{
+   unsigned int msg[32];
+   int i;
+
+   msg[0] = (6+count)*sizeof(unsigned int);
+   msg[1] = 0;
+   msg[2] = tag;
+   msg[3] = count*sizeof(unsigned int);
+   msg[4] = count*sizeof(unsigned int);
+   for(i=0; i < count; i++)
+      msg[5+i] = values[i];
+   msg[5+count] = 0;
+
+   if(ioctl(wave_mbox,MBOX_IOCTL,msg) < 0)
+      return 0;
+   return msg[5];
+}
+
+static volatile uint32_t* dma_channel()
+{
+   return (volatile uint32_t*)bcm2835_peripherals + DMA_BASE + WAVE_DMA_CHANNEL*DMA_CHANNEL_SIZE;
+}
+
+static void wave_free_memory()
+{
+   if(wave_mem != NULL)
+      munmap(wave_mem,wave_size);
+   if(wave_handle != 0)
+   {
+      mbox_call(MBOX_TAG_UNLOCK,&wave_handle,1);
+      mbox_call(MBOX_TAG_RELEASE,&wave_handle,1);
+   }
+   wave_mem = NULL;
+   wave_handle = 0;
+   wave_bus = 0;
+   wave_size = 0;
+}
+
+static int wave_alloc_memory(unsigned int size)
+{
+   unsigned int args[3];
+   unsigned long peri = (unsigned long)bcm2835_peripherals_base;
+   int memfd;
+
+   size = (size + PAGE_SIZE_BYTES - 1) & ~(PAGE_SIZE_BYTES - 1);
+   if(size <= wave_size)
+      return 0;
+
+   wave_free_memory();
+   if(wave_mbox < 0)
+   {
+      wave_mbox = open("/dev/vcio",0);
+      if(wave_mbox < 0)
+         return ERR_INIT;
+   }
+
+   //the first pi needs the uncached alias, the later ones the coherent one
+   args[0] = size;
+   args[1] = PAGE_SIZE_BYTES;
+   args[2] = peri == PERI_BASE_PI1 ? MBOX_MEM_DIRECT : MBOX_MEM_DIRECT | MBOX_MEM_COHERENT;
+   wave_handle = mbox_call(MBOX_TAG_ALLOCATE,args,3);
+   if(wave_handle == 0)
+      return ERR_INIT;
+   wave_bus = mbox_call(MBOX_TAG_LOCK,&wave_handle,1);
+   if(wave_bus == 0)
+   {
+      wave_free_memory();
+      return ERR_INIT;
+   }
+
+   memfd = open("/dev/mem",O_RDWR | O_SYNC);
+   if(memfd < 0)
+   {
+      wave_free_memory();
+      return ERR_INIT;
+   }
+   wave_mem = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,memfd,wave_bus & ~0xC0000000u);
+   close(memfd);
+   if(wave_mem == MAP_FAILED)
+   {
+      wave_mem = NULL;
+      wave_free_memory();
+      return ERR_INIT;
+   }
+   wave_size = size;
+   return 0;
+}
+
+//
+// the PWM fifo paces the delay blocks - prefilled, so every word waits one tick
+//
+static void wave_start_pacing(unsigned int tick_ns)
+{
+   unsigned long peri = (unsigned long)bcm2835_peripherals_base;
+   unsigned int mhz = peri == PERI_BASE_PI4 ? PLLD_MHZ_PI4 : PLLD_MHZ;
+   unsigned int range = (tick_ns + PWM_CLOCK_NS - 1)/PWM_CLOCK_NS;
+
+   bcm2835_peri_write(bcm2835_pwm + PWM_CTL,0);
+
+   bcm2835_peri_write(bcm2835_clk + CM_PWMCTL,CM_PASSWD | CM_KILL);
+   while(bcm2835_peri_read(bcm2835_clk + CM_PWMCTL) & CM_BUSY)
+      ;
+   bcm2835_peri_write(bcm2835_clk + CM_PWMDIV,CM_PASSWD | ((mhz*PWM_CLOCK_NS/1000) << 12));
+   bcm2835_peri_write(bcm2835_clk + CM_PWMCTL,CM_PASSWD | CM_ENAB | CM_SRC_PLLD);
+
+   bcm2835_peri_write(bcm2835_pwm + PWM_RNG1,range ? range : 1);
+   bcm2835_peri_write(bcm2835_pwm + PWM_DMAC,PWM_DMAC_ENAB | PWM_DMAC_PANIC(15) | PWM_DMAC_DREQ(15));
+   bcm2835_peri_write(bcm2835_pwm + PWM_CTL,PWM_CTL_CLRF1);
+   timing_delay_ns(10000);
+   while(!(bcm2835_peri_read(bcm2835_pwm + PWM_STA) & PWM_STA_FULL1))
+      bcm2835_peri_write(bcm2835_pwm + PWM_FIF1,0);
+   bcm2835_peri_write(bcm2835_pwm + PWM_CTL,PWM_CTL_USEF1 | PWM_CTL_PWEN1);
+}
+
+int bcm2835_backend_wave_play(const struct WAVE* wave)
+{
+   volatile uint32_t* dma = dma_channel();
+   struct DMA_CB* cb;
+   uint32_t* words;
+   uint32_t words_bus;
+   uint32_t zero_bus;
+   int i;
+
+   // layout: control blocks, one data word per block, a zero word for the pacing
+   unsigned int cb_bytes = wave->count*sizeof(struct DMA_CB);
+   int ret = wave_alloc_memory(cb_bytes + (wave->count+1)*sizeof(uint32_t));
+   if(ret != 0)
+      return ret;
+
+   cb = (struct DMA_CB*)wave_mem;
+   words = (uint32_t*)(wave_mem + cb_bytes);
+   words_bus = wave_bus + cb_bytes;
+   zero_bus = words_bus + wave->count*sizeof(uint32_t);
+   words[wave->count] = 0;
+
+   for(i=0; i < wave->count; i++)
+   {
+      const struct WAVE_CB* w = &wave->cb[i];
+      if(w->kind == WAVE_DELAY)
+      {
+         cb[i].ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_PERMAP_PWM);
+         cb[i].source = zero_bus;
+         cb[i].dest = BUS_PWM_FIF1;
+         cb[i].length = w->value*sizeof(uint32_t);
+      }
+      else
+      {
+         words[i] = w->value;
+         cb[i].ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP;
+         cb[i].source = words_bus + i*sizeof(uint32_t);
+         cb[i].dest = w->kind == WAVE_SET ? BUS_GPSET0 : BUS_GPCLR0;
+         cb[i].length = sizeof(uint32_t);
+      }
+      cb[i].stride = 0;
+      cb[i].next = i+1 < wave->count ? wave_bus + (i+1)*sizeof(struct DMA_CB) : 0;
+   }
+   __sync_synchronize();
+
+   wave_start_pacing(wave->tick_ns);
+
+   bcm2835_peri_write((volatile uint32_t*)bcm2835_peripherals + DMA_BASE + DMA_ENABLE,
+      bcm2835_peri_read((volatile uint32_t*)bcm2835_peripherals + DMA_BASE + DMA_ENABLE) | (1u << WAVE_DMA_CHANNEL));
+   bcm2835_peri_write(dma + DMA_CS,DMA_CS_RESET);
+   timing_delay_ns(10000);
+   bcm2835_peri_write(dma + DMA_CS,DMA_CS_INT | DMA_CS_END);
+   bcm2835_peri_write(dma + DMA_CONBLK_AD,wave_bus);
+   bcm2835_peri_write(dma + DMA_DEBUG,7);
+   bcm2835_peri_write(dma + DMA_CS,DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY(8) | DMA_CS_PRIORITY(8) | DMA_CS_ACTIVE);
+   wave_playing = 1;
+
+   return 0;
+}
+
+//
+// stop the player and give the memory back
+//
+void bcm2835_wave_close()
+{
+   if(wave_mem != NULL)
+   {
+      bcm2835_peri_write(dma_channel() + DMA_CS,DMA_CS_RESET);
+      bcm2835_peri_write(bcm2835_pwm + PWM_CTL,0);
+      wave_playing = 0;
+      wave_free_memory();
+   }
+   if(wave_mbox >= 0)
+   {
+      close(wave_mbox);
+      wave_mbox = -1;
+   }
+}
+
+void bcm2835_backend_wave_stop()
+{
+   if(wave_playing)
+      bcm2835_peri_write(dma_channel() + DMA_CS,DMA_CS_RESET);
+}
+
+int bcm2835_backend_wave_busy()
+{
+   if(!wave_playing)
+      return 0;
+   if(bcm2835_peri_read(dma_channel() + DMA_CS) & DMA_CS_ACTIVE)
+      return 1;
+
+   wave_playing = 0;
+   return 0;
+}
+
+int bcm2835_backend_i2c_begin()
+{
+   bcm2835_i2c_begin();
+   return 0;
+}
+
+void bcm2835_backend_i2c_end()
+{
+   bcm2835_i2c_end();
+}
+
+void bcm2835_backend_i2c_set_baudrate(unsigned int baudrate)
+{
+   bcm2835_i2c_set_baudrate(baudrate);
+}
+
+int bcm2835_backend_i2c_write(int address, const char* data, int len)
+{
+   bcm2835_i2c_setSlaveAddress(address);
+   return bcm2835_i2c_write(data,len) == BCM2835_I2C_REASON_OK ? 0 : ERR_I2C;
+}
+
+int bcm2835_backend_i2c_read(int address, char* data, int len)
+{
+   bcm2835_i2c_setSlaveAddress(address);
+   return bcm2835_i2c_read(data,len) == BCM2835_I2C_REASON_OK ? 0 : ERR_I2C;
+}
+
+int bcm2835_backend_spi_begin()
+{
+   bcm2835_spi_begin();
+
+   //return cs signals to normal, as they are set via io_chain
+   bcm2835_gpio_fsel(RPI_GPIO_P1_26, BCM2835_GPIO_FSEL_OUTP); // CE1
+   bcm2835_gpio_fsel(RPI_GPIO_P1_24, BCM2835_GPIO_FSEL_OUTP); // CE0
+   return 0;
+}
+
+void bcm2835_backend_spi_end()
+{
+   bcm2835_spi_end();
+}
+
+void bcm2835_backend_spi_configure(int mode, int bitorder, int divider)
+{
+   bcm2835_spi_setDataMode(mode);
+   bcm2835_spi_setBitOrder(bitorder);
+   bcm2835_spi_setClockDivider(divider);
+}
+
+void bcm2835_backend_spi_transfer(const unsigned char* tx, unsigned char* rx, int len)
+{
+   bcm2835_spi_transfernb((char*)tx,(char*)rx,len);
+}
+
+const struct RASPIDAPTER_BACKEND backend_bcm2835 =
+{
+   "bcm2835",
+   bcm2835_backend_init,
+   bcm2835_backend_close,
+   bcm2835_backend_gpio_output,
+   bcm2835_backend_gpio_write,
+   bcm2835_backend_gpio_write_ns,
+   NULL,
+   bcm2835_backend_iochain_play,
+   bcm2835_backend_i2c_begin,
+   bcm2835_backend_i2c_end,
+   bcm2835_backend_i2c_set_baudrate,
+   bcm2835_backend_i2c_write,
+   bcm2835_backend_i2c_read,
+   bcm2835_backend_spi_begin,
+   bcm2835_backend_spi_end,
+   bcm2835_backend_spi_configure,
+   bcm2835_backend_spi_transfer,
+   bcm2835_backend_wave_play,
+   bcm2835_backend_wave_busy,
+   bcm2835_backend_wave_stop
+};
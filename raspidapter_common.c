@@ -25,8 +25,9 @@
 //
 
 
-#include "bcm2835.h"
 #include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_timing.h"
 
 
 #include <stdio.h>
@@ -39,200 +40,1164 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <pthread.h>
 #include <unistd.h>
 
 
-// I/O chain buffers
-int num_chained_io =0;
-char* chained_io_buffer =0; 
+#define CHAINED_IO_ENABLE GPIO_P1_15
+#define CHAINED_IO_DATA GPIO_P1_12
+#define CHAINED_IO_CLOCK GPIO_P1_13
+#define CHAINED_IO_STROBE GPIO_P1_11
 
-#define CHAINED_IO_ENABLE RPI_V2_GPIO_P1_15
-#define CHAINED_IO_DATA RPI_V2_GPIO_P1_12
-#define CHAINED_IO_CLOCK RPI_V2_GPIO_P1_13
-#define CHAINED_IO_STROBE RPI_V2_GPIO_P1_11
+// the hardware access
+#ifdef RASPIDAPTER_SIM
+const struct RASPIDAPTER_BACKEND* g_backend = &backend_sim;
+#else
+const struct RASPIDAPTER_BACKEND* g_backend = &backend_bcm2835;
+#endif
+
+// I/O chain set up by setup_raspidapter
+struct IOCHAIN g_iochain;
+// I/O chain the dice_*_setup functions bind to
+struct IOCHAIN* g_iochain_selected =0;
+
+// measured cost of one gpio write
+unsigned int gpio_write_ns =0;
+
+// default timing - the 74HC595 limits at 3.3V plus some margin
+const struct IOCHAIN_TIMING iochain_default_timing = { 30, 5, 30, 30, 30 };
 
 // marker for init
 int g_initialised =0; 
 
+// the open transactions of the calling thread, one per chain group
+#define IOCHAIN_MAX_TRANSACTIONS 8
+
+struct IOCHAIN_TRANSACTION
+{
+   struct IOCHAIN* chain;
+   int depth;
+   int pending;
+   struct IOCHAIN_PINSET deferred;  // bits written inside the transaction
+};
+
+__thread struct IOCHAIN_TRANSACTION iochain_tx[IOCHAIN_MAX_TRANSACTIONS];
+__thread int iochain_tx_open = 0;
+
+static struct IOCHAIN_TRANSACTION* iochain_tx_find(const struct IOCHAIN* chain)
+{
+   int i;
+
+   if(iochain_tx_open == 0)
+      return NULL;
+   for(i=0; i < IOCHAIN_MAX_TRANSACTIONS; i++)
+   {
+      if(iochain_tx[i].chain == chain)
+         return &iochain_tx[i];
+   }
+   return NULL;
+}
+
+//
+// a write inside a transaction of the calling thread - the bits stay out of the frames
+// of other threads until the commit. Marked before the buffer is written.
+//
+static void iochain_defer(struct IOCHAIN* chain, int word, uint32_t mask)
+{
+   struct IOCHAIN_TRANSACTION* tx = iochain_tx_find(chain);
+
+   if(tx == NULL)
+      return;
+   //more words than a pin set holds are written through
+   if(iochain_pinset_add_mask(&tx->deferred,word,mask) == 0)
+      __atomic_fetch_or(&chain->deferred[word],mask,__ATOMIC_SEQ_CST);
+}
+
+//
+// hand the deferred bits of the calling thread to the frames - all words at once,
+// no frame is taken in between
+//
+static void iochain_publish(struct IOCHAIN* chain, struct IOCHAIN_TRANSACTION* tx)
+{
+   int i;
+
+   if(tx->deferred.count == 0)
+      return;
+   while(__atomic_exchange_n(&chain->shifting,1,__ATOMIC_SEQ_CST) != 0)
+      ;
+   for(i=0; i < tx->deferred.count; i++)
+      __atomic_fetch_and(&chain->deferred[tx->deferred.word[i]],~tx->deferred.mask[i],__ATOMIC_SEQ_CST);
+   __atomic_store_n(&chain->shifting,0,__ATOMIC_SEQ_CST);
+   tx->deferred.count = 0;
+}
+
+//
+// loops to wait for a signal time, minus the time the gpio write itself takes
+//
+unsigned int iochain_wait(unsigned int ns)
+{
+   if(ns <= gpio_write_ns)
+      return 0;
+   return timing_loops(ns - gpio_write_ns);
+}
+
+int raspidapter_set_backend(const struct RASPIDAPTER_BACKEND* backend)
+{
+   if(backend == NULL)
+      return ERR_PARAM;
+   if(g_initialised == 1)
+      return ERR_INIT;
+
+   g_backend = backend;
+   return 0;
+}
+
+const struct RASPIDAPTER_BACKEND* raspidapter_backend()
+{
+   return g_backend;
+}
+
+//
+//  init a group of io chains
+//
+int iochain_init(struct IOCHAIN* chain, int numboards, int numchains, const int* datapins, int clock, int strobe, int enable)
+{
+   int i;
+
+   //error checking
+   if(chain == NULL || datapins == NULL)
+   {
+      return ERR_PARAM;
+   }
+   if(numboards < 1 || numchains < 1 || numchains > IOCHAIN_MAX_CHAINS)
+   {
+      return ERR_PARAM;
+   }
+   //all pins have to be in the first gpio bank
+   if(clock < 0 || clock > 31 || strobe < 0 || strobe > 31 || enable > 31)
+   {
+      return ERR_PARAM;
+   }
+
+   memset(chain,0,sizeof(struct IOCHAIN));
+
+   //calc amount of ios - all chains are as long as the longest one
+   chain->numboards = numboards;
+   chain->numchains = numchains;
+   chain->boards_per_chain = (numboards + numchains - 1)/numchains;
+   chain->chain_bits = 32* chain->boards_per_chain;
+   chain->num_io = chain->chain_bits * numchains;
+
+   for(i=0; i < numchains; i++)
+   {
+      if(datapins[i] < 0 || datapins[i] > 31)
+      {
+         return ERR_PARAM;
+      }
+      chain->data_mask[i] = 1u << datapins[i];
+      chain->data_all |= chain->data_mask[i];
+   }
+   chain->clock_mask = 1u << clock;
+   chain->strobe_mask = 1u << strobe;
+
+   //alloc buffers - the images are words, so writers can update them atomically
+   chain->num_words = chain->num_io/IOCHAIN_WORD_BITS;
+   chain->buffer = calloc(chain->num_words,sizeof(uint32_t));
+   chain->front = calloc(chain->num_words,sizeof(uint32_t));
+   chain->latched = calloc(chain->num_words,sizeof(uint32_t));
+   chain->pulse = calloc(chain->num_words,sizeof(uint32_t));
+   chain->taken = calloc(chain->num_words,sizeof(uint32_t));
+   chain->toggled = calloc(chain->num_words,sizeof(uint32_t));
+   chain->frame = calloc(chain->chain_bits,sizeof(struct IOCHAIN_OP));
+   chain->hold = calloc(chain->num_words,sizeof(uint32_t));
+   chain->keep = calloc(chain->num_words,sizeof(uint32_t));
+   chain->stop_image = calloc(chain->num_words,sizeof(uint32_t));
+   chain->stop_frame = calloc(chain->chain_bits,sizeof(struct IOCHAIN_OP));
+   chain->wave_last = calloc(chain->num_words,sizeof(uint32_t));
+   chain->deferred = calloc(chain->num_words,sizeof(uint32_t));
+   if (chain->buffer == NULL || chain->front == NULL || chain->latched == NULL || chain->pulse == NULL || chain->taken == NULL || chain->toggled == NULL
+       || chain->frame == NULL || chain->hold == NULL || chain->keep == NULL || chain->stop_image == NULL || chain->stop_frame == NULL
+       || chain->wave_last == NULL || chain->deferred == NULL) {
+      printf("chained_io allocation error \n");
+      exit (-1);
+   }
+
+   if(g_backend->iochain_attach)
+   {
+      g_backend->iochain_attach(chain);
+   }
+
+   for(i=0; i < numchains; i++)
+   {
+      g_backend->gpio_output(datapins[i]);
+      g_backend->gpio_write(datapins[i],0);
+   }
+   g_backend->gpio_output(clock);
+   g_backend->gpio_output(strobe);
+   g_backend->gpio_write(clock,0);
+   g_backend->gpio_write(strobe,0);
+
+   //enable output stage
+   if(enable >= 0)
+   {
+      g_backend->gpio_output(enable);
+      g_backend->gpio_write(enable,1);
+   }
+
+   if(gpio_write_ns == 0)
+   {
+      gpio_write_ns = g_backend->gpio_write_ns();
+   }
+   iochain_ctx_set_timing(chain,&iochain_default_timing);
+   iochain_compile_image(chain,chain->stop_image,chain->stop_frame);
+
+   if(g_iochain_selected == 0)
+   {
+      g_iochain_selected = chain;
+   }
+   return 0;
+}
+
+//
+// Undo the IO chain init
+//
+int iochain_deinit(struct IOCHAIN* chain)
+{
+  if(chain == NULL)
+  {
+     return ERR_PARAM;
+  }
+
+  free(chain->buffer);
+  free(chain->front);
+  free(chain->latched);
+  free(chain->pulse);
+  free(chain->taken);
+  free(chain->toggled);
+  free(chain->frame);
+  free(chain->hold);
+  free(chain->keep);
+  free(chain->stop_image);
+  free(chain->stop_frame);
+  free(chain->wave_last);
+  free(chain->deferred);
+  chain->buffer = 0;
+  chain->front = 0;
+  chain->latched = 0;
+  chain->pulse = 0;
+  chain->taken = 0;
+  chain->toggled = 0;
+  chain->frame = 0;
+  chain->hold = 0;
+  chain->keep = 0;
+  chain->stop_image = 0;
+  chain->stop_frame = 0;
+  chain->wave_last = 0;
+  chain->deferred = 0;
+
+  if(g_iochain_selected == chain)
+  {
+     g_iochain_selected = 0;
+  }
+
+   return 0;
+}
+
+struct IOCHAIN* iochain_default()
+{
+   return &g_iochain;
+}
+
+int iochain_select(struct IOCHAIN* chain)
+{
+   if(chain == NULL)
+      return ERR_PARAM;
+
+   g_iochain_selected = chain;
+   return 0;
+}
+
+struct IOCHAIN* iochain_selected()
+{
+   return g_iochain_selected;
+}
+
+//
+// map board, slot and pin of a slot to a bit number
+// Boards are spread in order over the chains: with 3 boards per chain,
+// boards 1-3 are on the first data line, 4-6 on the second one and so on.
+//
+int iochain_bit(struct IOCHAIN* chain, int board, int slot, int pin)
+{
+   if(chain == NULL || chain->buffer == 0)
+      return ERR_INIT;
+   if(board < 1 || board > chain->numboards || slot < 1 || slot > 4 || pin < 0 || pin > 7)
+      return ERR_PARAM;
+
+   int line = (board-1) / chain->boards_per_chain;
+   int pos = (board-1) % chain->boards_per_chain;
+
+   return line*chain->chain_bits + pos*32 + (slot-1)*8 + pin;
+}
+
+int iochain_ctx_set_timing(struct IOCHAIN* chain, const struct IOCHAIN_TIMING* timing)
+{
+   if(chain == NULL || timing == NULL)
+      return ERR_PARAM;
+
+   chain->timing = *timing;
+
+   chain->setup_wait = iochain_wait(timing->setup_ns);
+   //the data changes after the falling edge, so the hold time extends the high time
+   chain->high_wait = iochain_wait(timing->clock_high_ns > timing->hold_ns ? timing->clock_high_ns : timing->hold_ns);
+   chain->low_wait = iochain_wait(timing->clock_low_ns);
+   chain->strobe_wait = iochain_wait(timing->strobe_ns);
+
+   return 0;
+}
+
+int iochain_ctx_get_timing(struct IOCHAIN* chain, struct IOCHAIN_TIMING* timing)
+{
+   if(chain == NULL || timing == NULL)
+      return ERR_PARAM;
+
+   *timing = chain->timing;
+   return 0;
+}
+
+//
+// set a bit of the IO chain
+//
+int iochain_ctx_setbit(struct IOCHAIN* chain, int bit)
+{
+   //error checking
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(bit < 0 || bit >= chain->num_io)
+   {
+      return ERR_PARAM;
+   }
+
+   iochain_defer(chain,bit>>5,1u<<(bit&31));
+   __atomic_fetch_or(&chain->buffer[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+
+   return 0;
+}
+
+//
+// clear a bit in the IO chain
+// 
+int iochain_ctx_clearbit(struct IOCHAIN* chain, int bit)
+{
+   //error checking
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(bit < 0 || bit >= chain->num_io)
+   {
+      return ERR_PARAM;
+   }
+
+   iochain_defer(chain,bit>>5,1u<<(bit&31));
+   __atomic_fetch_and(&chain->buffer[bit>>5],~(1u<<(bit&31)),__ATOMIC_RELEASE);
+
+   return 0;
+}
+
+//
+// set a bit for exactly one latched frame
+//
+int iochain_ctx_pulsebit(struct IOCHAIN* chain, int bit)
+{
+   int ret = iochain_ctx_setbit(chain,bit);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   //a pulse not latched yet would swallow this one - latch it first, even inside a transaction
+   if(__atomic_load_n(&chain->pulse[bit>>5],__ATOMIC_ACQUIRE) & (1u<<(bit&31)))
+   {
+      iochain_ctx_flush(chain);
+      iochain_ctx_setbit(chain,bit);
+   }
+
+   //the bit is in the buffer before it is marked, so a shifter taking the mark sees it
+   __atomic_fetch_or(&chain->pulse[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+
+   return iochain_ctx_update(chain);
+}
+
+//
+// invert a bit and update
+//
+int iochain_ctx_togglebit(struct IOCHAIN* chain, int bit)
+{
+   //error checking
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(bit < 0 || bit >= chain->num_io)
+   {
+      return ERR_PARAM;
+   }
+
+   //a toggle not latched yet would be undone by this one - latch it first, even inside a transaction
+   if(__atomic_load_n(&chain->toggled[bit>>5],__ATOMIC_ACQUIRE) & (1u<<(bit&31)))
+   {
+      iochain_ctx_flush(chain);
+   }
+
+   //the bit is in the buffer before it is marked, like a pulse
+   iochain_defer(chain,bit>>5,1u<<(bit&31));
+   __atomic_fetch_xor(&chain->buffer[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+   __atomic_fetch_or(&chain->toggled[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+
+   return iochain_ctx_update(chain);
+}
+
+//
+// pin sets
+//
+int iochain_pinset_init(struct IOCHAIN_PINSET* set, struct IOCHAIN* chain)
+{
+   if(set == NULL || chain == NULL || chain->buffer == 0)
+   {
+      return ERR_PARAM;
+   }
+
+   set->chain = chain;
+   set->count = 0;
+   return 0;
+}
+
+int iochain_pinset_add_mask(struct IOCHAIN_PINSET* set, int word, uint32_t mask)
+{
+   int i;
+
+   //error checking
+   if(set == NULL || set->chain == NULL)
+   {
+      return ERR_INIT;
+   }
+   if(word < 0 || word >= set->chain->num_words)
+   {
+      return ERR_PARAM;
+   }
+
+   //merge pins of the same word
+   for(i=0; i < set->count; i++)
+   {
+      if(set->word[i] == word)
+      {
+         set->mask[i] |= mask;
+         return 0;
+      }
+   }
+   if(set->count == IOCHAIN_PINSET_WORDS)
+   {
+      return ERR_PARAM;
+   }
+
+   set->word[set->count] = word;
+   set->mask[set->count] = mask;
+   set->count++;
+   return 0;
+}
+
+int iochain_pinset_add(struct IOCHAIN_PINSET* set, int bit)
+{
+   if(set == NULL || set->chain == NULL)
+   {
+      return ERR_INIT;
+   }
+   if(bit < 0 || bit >= set->chain->num_io)
+   {
+      return ERR_PARAM;
+   }
+
+   return iochain_pinset_add_mask(set,bit>>5,1u<<(bit&31));
+}
+
+int iochain_set_pins(const struct IOCHAIN_PINSET* set)
+{
+   int i;
+   uint32_t* buffer = set->chain->buffer;
+
+   for(i=0; i < set->count; i++)
+   {
+      iochain_defer(set->chain,set->word[i],set->mask[i]);
+      __atomic_fetch_or(&buffer[set->word[i]],set->mask[i],__ATOMIC_RELEASE);
+   }
+   return 0;
+}
+
+int iochain_clear_pins(const struct IOCHAIN_PINSET* set)
+{
+   int i;
+   uint32_t* buffer = set->chain->buffer;
+
+   for(i=0; i < set->count; i++)
+   {
+      iochain_defer(set->chain,set->word[i],set->mask[i]);
+      __atomic_fetch_and(&buffer[set->word[i]],~set->mask[i],__ATOMIC_RELEASE);
+   }
+   return 0;
+}
+
+// checks if a pin of the set is still marked in one of the mark images
+static int iochain_pins_marked(const struct IOCHAIN_PINSET* set, uint32_t* marks)
+{
+   int i;
+   for(i=0; i < set->count; i++)
+   {
+      if(__atomic_load_n(&marks[set->word[i]],__ATOMIC_ACQUIRE) & set->mask[i])
+         return 1;
+   }
+   return 0;
+}
+
+int iochain_pulse_pins(const struct IOCHAIN_PINSET* set)
+{
+   int i;
+
+   if(iochain_pins_marked(set,set->chain->pulse))
+      iochain_ctx_flush(set->chain);
+   iochain_set_pins(set);
+   for(i=0; i < set->count; i++)
+   {
+      __atomic_fetch_or(&set->chain->pulse[set->word[i]],set->mask[i],__ATOMIC_RELEASE);
+   }
+   return iochain_ctx_update(set->chain);
+}
+
+int iochain_toggle_pins(const struct IOCHAIN_PINSET* set)
+{
+   int i;
+   uint32_t* buffer = set->chain->buffer;
+
+   if(iochain_pins_marked(set,set->chain->toggled))
+      iochain_ctx_flush(set->chain);
+   for(i=0; i < set->count; i++)
+   {
+      iochain_defer(set->chain,set->word[i],set->mask[i]);
+      __atomic_fetch_xor(&buffer[set->word[i]],set->mask[i],__ATOMIC_RELEASE);
+      __atomic_fetch_or(&set->chain->toggled[set->word[i]],set->mask[i],__ATOMIC_RELEASE);
+   }
+   return iochain_ctx_update(set->chain);
+}
+
+int iochain_ctx_modify_word(struct IOCHAIN* chain, int word, uint32_t set, uint32_t clr, uint32_t toggle)
+{
+   uint32_t old;
+   uint32_t next;
+
+   //error checking
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(word < 0 || word >= chain->num_words)
+   {
+      return ERR_PARAM;
+   }
+
+   iochain_defer(chain,word,set | clr | toggle);
+   old = __atomic_load_n(&chain->buffer[word],__ATOMIC_RELAXED);
+   do
+   {
+      next = ((old | set) & ~clr) ^ toggle;
+   } while(!__atomic_compare_exchange_n(&chain->buffer[word],&old,next,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+
+   return 0;
+}
+
+//
+// turn a chain image into gpio masks, highest bit first
+// Bit n of every chain is sent in the same clock cycle.
+//
+void iochain_compile_image(const struct IOCHAIN* chain, const uint32_t* image, struct IOCHAIN_OP* ops)
+{
+   uint32_t data = 0;
+   int i, k;
+   struct IOCHAIN_OP* op = ops;
+
+   for(i= chain->chain_bits-1; i >=0; i--, op++)
+   {
+      uint32_t next = 0;
+      for(k=0; k < chain->numchains; k++)
+      {
+         int bit = k*chain->chain_bits + i;
+         if((image[bit>>5] >> (bit&31)) & 1)
+            next |= chain->data_mask[k];
+      }
+
+      //falling data pins go low together with the previous falling clock edge
+      if(op != ops)
+         op[-1].clr |= data & ~next;
+
+      op->set = next & ~data;
+      op->clr = chain->clock_mask;
+      data = next;
+   }
+
+   //leave the data low after the frame
+   ops[chain->chain_bits-1].clr |= data;
+}
+
 //
-// This is a software loop to wait
-// a short while.
+// copy the buffer word by word - every word is consistent, whatever the writers do
+// frame - bits deferred by open transactions stay at their latched level
 //
-void short_wait()
-{ int w;
-  for (w=0; w<50; w++)
-  { w++;
-    w--;
-  }
-} // short_wait
+static void iochain_take_image(const struct IOCHAIN* chain, uint32_t* image, int frame)
+{
+   int i;
+   for(i=0; i < chain->num_words; i++)
+   {
+      image[i] = __atomic_load_n(&chain->buffer[i],__ATOMIC_ACQUIRE);
+      if(frame)
+      {
+         uint32_t deferred = __atomic_load_n(&chain->deferred[i],__ATOMIC_ACQUIRE);
+         image[i] = (image[i] & ~deferred) | (chain->latched[i] & deferred);
+      }
+   }
 
-void high_wait()
-{ int w;
-  for (w=0; w<25; w++)
-  { w++;
-    w--;
-  }
+   //held bits stay low and kept bits at their latched level, whatever the writers do
+   if(__atomic_load_n(&chain->stopped,__ATOMIC_ACQUIRE))
+   {
+      for(i=0; i < chain->num_words; i++)
+         image[i] = (image[i] & ~chain->hold[i] & ~chain->keep[i]) | (chain->latched[i] & chain->keep[i]);
+   }
 }
 
-void high_wait_half()
-{ int w;
-  for (w=0; w<12; w++)
-  { w++;
-    w--;
-  }
+void iochain_snapshot(const struct IOCHAIN* chain, uint32_t* image)
+{
+   iochain_take_image(chain,image,0);
 }
 
-void low_wait()
-{ int w;
-  for (w=0; w<10; w++)
-  { w++;
-    w--;
-  }
+void iochain_compile(struct IOCHAIN* chain)
+{
+   iochain_compile_image(chain,chain->front,chain->frame);
 }
 
+//
+// wait for a waveform still driving the pins - its last frame is latched then
+// Only called by the thread owning the shifter.
+//
+static void iochain_wave_done(struct IOCHAIN* chain)
+{
+   if(g_backend->wave_busy)
+   {
+      while(g_backend->wave_busy())
+         ;
+   }
+   if(chain->wave_pending)
+   {
+      memcpy(chain->latched,chain->wave_last,chain->num_words*sizeof(uint32_t));
+      chain->latched_valid = 1;
+      chain->wave_pending = 0;
+   }
+}
 
+//
+// shift the buffer out and latch it. Blocks while sending.
+// Returns 1 if an emergency stop dropped the frame.
+//
+int iochain_shift(struct IOCHAIN* chain, unsigned int generation)
+{
+   iochain_compile(chain);
+   return g_backend->iochain_play(chain,chain->frame,generation);
+}
 
 //
-//  init io chain IOs 
+// latch the safe frame - only called by the thread owning the shifter
+// The next regular frame has to be shifted in full, with the held bits cleared.
 //
-int setup_iochain(int numboards)
+void iochain_latch_stop(struct IOCHAIN* chain)
 {
-   //error checking
-   if(numboards < 1)
+   const struct IOCHAIN_OP* ops = chain->stop_frame;
+   uint32_t kept = 0;
+   int i;
+
+   //a stopped waveform leaves the last frame it strobed - at best the one it was built with
+   iochain_wave_done(chain);
+
+   //kept bits go into the safe frame at the level on the pins - compiled into the
+   //scratch buffers of the owner
+   for(i=0; i < chain->num_words; i++)
    {
-      return ERR_PARAM;
+      uint32_t keep = __atomic_load_n(&chain->keep[i],__ATOMIC_ACQUIRE);
+      chain->front[i] = chain->stop_image[i] | (chain->latched[i] & keep);
+      kept |= keep;
+   }
+   if(kept)
+   {
+      iochain_compile_image(chain,chain->front,chain->frame);
+      ops = chain->frame;
    }
 
-   if(chained_io_buffer != 0)
+   //a stop coming in while the safe frame is shifted starts it again
+   while(g_backend->iochain_play(chain,ops,__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE)) != 0)
+      ;
+
+   //writers see the kept level, so the release does not change it
+   for(i=0; i < chain->num_words; i++)
    {
-      return ERR_INIT;
+      __atomic_fetch_and(&chain->buffer[i],~(chain->keep[i] & ~chain->latched[i]),__ATOMIC_SEQ_CST);
+      __atomic_fetch_or(&chain->buffer[i],chain->keep[i] & chain->latched[i],__ATOMIC_SEQ_CST);
    }
+   __atomic_store_n(&chain->stop_latched_ns,timing_now_ns(),__ATOMIC_RELEASE);
+   chain->latched_valid = 0;
+   __atomic_store_n(&chain->again,1,__ATOMIC_SEQ_CST);
+}
 
-   //calc amount of ios
-   num_chained_io = 32* numboards;
+//
+// snapshot the buffer and latch it if it differs from the registers, then drop pulse bits again
+// Only called by the thread owning the shifter.
+//
+void iochain_latch_frame(struct IOCHAIN* chain)
+{
+   int i;
+   uint32_t pulses = 0;
+   int bytes = chain->num_words*sizeof(uint32_t);
+   unsigned int generation = __atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE);
 
-   //alloc buffer
-   if ((chained_io_buffer = malloc(num_chained_io/8)) == NULL) {
-      printf("chained_io allocation error \n");
-      exit (-1);
+   //the frame is compared with what the pins show once a waveform is done
+   iochain_wave_done(chain);
+
+   //take the pulse and toggle marks first - their bits are already in the buffer
+   //marks of deferred bits are left for the frame of the commit
+   for(i=0; i < chain->num_words; i++)
+   {
+      uint32_t deferred = __atomic_load_n(&chain->deferred[i],__ATOMIC_ACQUIRE);
+      chain->taken[i] = __atomic_fetch_and(&chain->pulse[i],deferred,__ATOMIC_ACQ_REL) & ~deferred;
+      pulses |= chain->taken[i];
+      __atomic_fetch_and(&chain->toggled[i],deferred,__ATOMIC_ACQ_REL);
    }
 
-   bcm2835_gpio_fsel(CHAINED_IO_ENABLE,BCM2835_GPIO_FSEL_OUTP);
-   bcm2835_gpio_fsel(CHAINED_IO_DATA,BCM2835_GPIO_FSEL_OUTP);
-   bcm2835_gpio_fsel(CHAINED_IO_CLOCK,BCM2835_GPIO_FSEL_OUTP);
-   bcm2835_gpio_fsel(CHAINED_IO_STROBE,BCM2835_GPIO_FSEL_OUTP);
+   iochain_take_image(chain,chain->front,1);
+   if(!chain->latched_valid || memcmp(chain->front,chain->latched,bytes) != 0)
+   {
+      if(iochain_shift(chain,generation) == 0)
+      {
+         memcpy(chain->latched,chain->front,bytes);
+         chain->latched_valid = 1;
+      }
+   }
 
-   //enable output stage
-   bcm2835_gpio_write(CHAINED_IO_ENABLE,HIGH);
-   return 0;
+   //clear the pulse bits and latch the falling edge
+   if(pulses)
+   {
+      for(i=0; i < chain->num_words; i++)
+         __atomic_fetch_and(&chain->buffer[i],~chain->taken[i],__ATOMIC_RELEASE);
+      iochain_take_image(chain,chain->front,1);
+      if(iochain_shift(chain,generation) == 0)
+         memcpy(chain->latched,chain->front,bytes);
+   }
 
+   //an emergency stop came in - this frame may be older than the stop
+   if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+      iochain_latch_stop(chain);
 }
 
 //
-// Undo the IO chain init
+// latch the buffer - lock free for the writers
+// One thread owns the shifter. A thread finding it busy leaves its changes to the owner,
+// which shifts again before it lets go. With wait set the caller shifts a frame itself,
+// so its changes are latched on return.
 //
-int deinit_iochain()
+int iochain_latch(struct IOCHAIN* chain, int wait)
 {
-  free(chained_io_buffer);
+   __atomic_store_n(&chain->again,1,__ATOMIC_SEQ_CST);
 
-   return 0;
+   for(;;)
+   {
+      if(__atomic_exchange_n(&chain->shifting,1,__ATOMIC_SEQ_CST) == 0)
+      {
+         while(__atomic_exchange_n(&chain->again,0,__ATOMIC_SEQ_CST))
+         {
+            iochain_latch_frame(chain);
+            wait = 0;
+         }
+         __atomic_store_n(&chain->shifting,0,__ATOMIC_SEQ_CST);
+
+         //changes left by another thread between the last frame and the release
+         if(!__atomic_load_n(&chain->again,__ATOMIC_SEQ_CST))
+            return 0;
+      }
+      else if(!wait)
+      {
+         //the owner sees again set and shifts once more
+         return 0;
+      }
+   }
 }
 
+//
+// start a waveform as the owner of the shifter - no frame is shifted while it plays
+//
+int iochain_ctx_play_wave(struct IOCHAIN* chain, const struct WAVE* wave, const uint32_t* last)
+{
+   unsigned int generation;
+   int ret;
+
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(g_backend->wave_play == NULL)
+   {
+     return ERR_INIT;
+   }
+
+   while(__atomic_exchange_n(&chain->shifting,1,__ATOMIC_SEQ_CST) != 0)
+      ;
+   generation = __atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE);
+
+   //the safe frame holds the pins until the release
+   if(__atomic_load_n(&chain->stopped,__ATOMIC_ACQUIRE))
+   {
+      ret = ERR_ESTOP;
+   }
+   else
+   {
+      //one waveform at a time
+      iochain_wave_done(chain);
+      ret = g_backend->wave_play(wave);
+      if(ret == 0)
+      {
+         memcpy(chain->wave_last,last,chain->num_words*sizeof(uint32_t));
+         chain->wave_pending = 1;
+      }
+   }
+
+   //a stop coming in since the check left the safe frame to us
+   if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+   {
+      if(g_backend->wave_stop)
+         g_backend->wave_stop();
+      iochain_latch_stop(chain);
+   }
+   __atomic_store_n(&chain->shifting,0,__ATOMIC_SEQ_CST);
+
+   //changes another thread left to us - they wait for the waveform
+   if(__atomic_load_n(&chain->again,__ATOMIC_SEQ_CST))
+      iochain_latch(chain,0);
+   return ret;
+}
 
 //
-// set a bit of the IO chain
+// add a bit to the bits held low by an emergency stop
 //
-int iochain_setbit(int bit)
+int iochain_ctx_stop_hold(struct IOCHAIN* chain, int bit)
 {
-   //error checking
-   if(bit >= num_chained_io-1)
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(bit < 0 || bit >= chain->num_io)
    {
       return ERR_PARAM;
    }
-   if(chained_io_buffer == 0)
+
+   __atomic_fetch_or(&chain->hold[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+   return 0;
+}
+
+//
+// add a bit to the bits frozen at their latched level by an emergency stop
+//
+int iochain_ctx_stop_keep(struct IOCHAIN* chain, int bit)
+{
+   if(chain == NULL || chain->buffer == 0)
    {
      return ERR_INIT;
    }
+   if(bit < 0 || bit >= chain->num_io)
+   {
+      return ERR_PARAM;
+   }
 
-   //calc bit and bytenum
-   int bytenum = bit/8;
-   int bitnum = bit%8;
+   __atomic_fetch_or(&chain->keep[bit>>5],1u<<(bit&31),__ATOMIC_RELEASE);
+   return 0;
+}
 
-   chained_io_buffer[bytenum] |= (1<<bitnum); 
+//
+// set a bit high in the safe frame and compile it again
+// Not safe against a concurrent stop - call it while arming.
+//
+int iochain_ctx_stop_safe(struct IOCHAIN* chain, int bit)
+{
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   if(bit < 0 || bit >= chain->num_io)
+   {
+      return ERR_PARAM;
+   }
 
+   chain->stop_image[bit>>5] |= 1u<<(bit&31);
+   iochain_compile_image(chain,chain->stop_image,chain->stop_frame);
    return 0;
 }
 
 //
-// clear a bit in the IO chain
-// 
-int iochain_clearbit(int bit)
+// drop the safe frame setup of a chain group
+// Not safe against a concurrent stop - call it while disarming.
+//
+int iochain_ctx_stop_clear(struct IOCHAIN* chain)
 {
-   if(bit >= num_chained_io-1)
+   int i;
+
+   if(chain == NULL || chain->buffer == 0)
    {
-      return ERR_PARAM;
+     return ERR_INIT;
+   }
+
+   for(i=0; i < chain->num_words; i++)
+   {
+      __atomic_store_n(&chain->hold[i],0,__ATOMIC_RELEASE);
+      __atomic_store_n(&chain->keep[i],0,__ATOMIC_RELEASE);
+      chain->stop_image[i] = 0;
    }
-   if(chained_io_buffer == 0)
+   iochain_compile_image(chain,chain->stop_image,chain->stop_frame);
+   return 0;
+}
+
+//
+// emergency stop of a chain group - only atomics and the backend, no locks
+//
+int iochain_ctx_stop(struct IOCHAIN* chain)
+{
+   int i;
+
+   if(chain == NULL || chain->buffer == 0)
    {
      return ERR_INIT;
    }
 
-   //calc bit and bytenum
-   int bytenum = bit/8;
-   int bitnum = bit%8;
-  
-   chained_io_buffer[bytenum] &= ~(1<<bitnum); 
+   //no writer can set the held bits from now on
+   __atomic_store_n(&chain->stopped,1,__ATOMIC_SEQ_CST);
+   for(i=0; i < chain->num_words; i++)
+      __atomic_fetch_and(&chain->buffer[i],~chain->hold[i],__ATOMIC_SEQ_CST);
+
+   //a frame being shifted is dropped at its next bit
+   __atomic_add_fetch(&chain->generation,1,__ATOMIC_SEQ_CST);
+   if(g_backend->wave_stop)
+      g_backend->wave_stop();
+
+   //latch the safe frame - or leave it to the thread owning the shifter, it sees the generation
+   __atomic_store_n(&chain->again,1,__ATOMIC_SEQ_CST);
+   if(__atomic_exchange_n(&chain->shifting,1,__ATOMIC_SEQ_CST) == 0)
+   {
+      iochain_latch_stop(chain);
+      __atomic_store_n(&chain->shifting,0,__ATOMIC_SEQ_CST);
+   }
+   return 0;
+}
+
+int iochain_ctx_release(struct IOCHAIN* chain)
+{
+   int i;
 
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+
+   //changes of kept bits while stopped are dropped - the latched level does not move while stopped
+   for(i=0; i < chain->num_words; i++)
+   {
+      uint32_t keep = chain->keep[i];
+      uint32_t level = __atomic_load_n(&chain->latched[i],__ATOMIC_ACQUIRE) & keep;
+      iochain_ctx_modify_word(chain,i,level,keep & ~level,0);
+   }
+
+   __atomic_store_n(&chain->stopped,0,__ATOMIC_SEQ_CST);
    return 0;
 }
 
+unsigned long long iochain_ctx_stop_worst_ns(struct IOCHAIN* chain)
+{
+   const struct IOCHAIN_TIMING* t;
+   unsigned long long bit_ns;
+
+   if(chain == NULL)
+      return 0;
+
+   //every bit is up to three gpio writes and the delays
+   t = &chain->timing;
+   bit_ns = t->setup_ns + (t->clock_high_ns > t->hold_ns ? t->clock_high_ns : t->hold_ns) + t->clock_low_ns + 3*gpio_write_ns;
+   return bit_ns*(chain->chain_bits+1) + t->strobe_ns + 2*gpio_write_ns;
+}
+
 //
 // update buffered outputs to hards. Blocks while sending.
+// Inside a transaction of the calling thread the update is deferred to iochain_commit()
 //
-int iochain_update()
+int iochain_ctx_update(struct IOCHAIN* chain)
 {
-   //printf("iochain: ");
-   if(chained_io_buffer == 0)
+   struct IOCHAIN_TRANSACTION* tx;
+
+   if(chain == NULL || chain->buffer == 0)
    {
      return ERR_INIT;
    }
 
-   int i=0;
-   //check all bits
-   for(i= num_chained_io-1; i >=0; i--)
-   {
-       int bytenum = i/8;
-       int bitnum = i%8;  
-
-       //set output if there is a one  
-       if(chained_io_buffer[bytenum] & (1<<bitnum))
-       {
-	  bcm2835_gpio_write(CHAINED_IO_DATA,HIGH); 
-	 // printf("1");     
-       } //else printf("0");
-       high_wait_half();
-       high_wait_half();
-       
-       //clock
-       bcm2835_gpio_write(CHAINED_IO_CLOCK,HIGH); 
-       high_wait_half();
-       high_wait_half();
-       bcm2835_gpio_write(CHAINED_IO_CLOCK,LOW); 
-       
-       //set data to zero
-       bcm2835_gpio_write(CHAINED_IO_DATA,LOW); 
-       low_wait();
-   }
-
-   //toggle strobe
-   bcm2835_gpio_write(CHAINED_IO_STROBE,HIGH);
-   high_wait();
-   bcm2835_gpio_write(CHAINED_IO_STROBE,LOW);
-   
-  // printf("\n");
+   tx = iochain_tx_find(chain);
+   if(tx != NULL)
+   {
+      tx->pending = 1;
+      return 0;
+   }
+
+   return iochain_latch(chain,0);
+}
+
+//
+// latch the buffer now, even inside a transaction - with the deferred bits of the calling thread
+//
+int iochain_ctx_flush(struct IOCHAIN* chain)
+{
+   struct IOCHAIN_TRANSACTION* tx;
+
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+
+   tx = iochain_tx_find(chain);
+   if(tx != NULL)
+      iochain_publish(chain,tx);
+   return iochain_latch(chain,1);
+}
+
+//
+// start a transaction of the calling thread - transactions can be nested
+//
+int iochain_ctx_begin(struct IOCHAIN* chain)
+{
+   struct IOCHAIN_TRANSACTION* tx;
+   int i;
+
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+
+   tx = iochain_tx_find(chain);
+   for(i=0; tx == NULL && i < IOCHAIN_MAX_TRANSACTIONS; i++)
+   {
+      if(iochain_tx[i].chain == NULL)
+      {
+         tx = &iochain_tx[i];
+         tx->chain = chain;
+         tx->depth = 0;
+         tx->pending = 0;
+         iochain_pinset_init(&tx->deferred,chain);
+         iochain_tx_open++;
+      }
+   }
+   if(tx == NULL)
+   {
+     return ERR_PARAM;
+   }
+
+   tx->depth++;
+   return 0;
+}
+
+//
+// end a transaction - the outermost commit latches all deferred updates in one frame
+//
+int iochain_ctx_commit(struct IOCHAIN* chain)
+{
+   struct IOCHAIN_TRANSACTION* tx;
+   int pending;
+
+   if(chain == NULL || chain->buffer == 0)
+   {
+     return ERR_INIT;
+   }
+   tx = iochain_tx_find(chain);
+   if(tx == NULL)
+   {
+     return ERR_PARAM;
+   }
+
+   if(--tx->depth > 0)
+   {
+      return 0;
+   }
+   iochain_publish(chain,tx);
+   pending = tx->pending;
+   tx->chain = NULL;
+   iochain_tx_open--;
+   if(pending)
+   {
+      return iochain_latch(chain,0);
+   }
    return 0;
 }
 
+//
+// the classic interface works on the chain set up by setup_raspidapter
+//
+int iochain_setbit(int bit)
+{
+   return iochain_ctx_setbit(&g_iochain,bit);
+}
+
+int iochain_clearbit(int bit)
+{
+   return iochain_ctx_clearbit(&g_iochain,bit);
+}
+
+int iochain_pulsebit(int bit)
+{
+   return iochain_ctx_pulsebit(&g_iochain,bit);
+}
+
+int iochain_togglebit(int bit)
+{
+   return iochain_ctx_togglebit(&g_iochain,bit);
+}
+
+int iochain_update()
+{
+   return iochain_ctx_update(&g_iochain);
+}
+
+int iochain_flush()
+{
+   return iochain_ctx_flush(&g_iochain);
+}
+
+int iochain_begin()
+{
+   return iochain_ctx_begin(&g_iochain);
+}
+
+int iochain_commit()
+{
+   return iochain_ctx_commit(&g_iochain);
+}
+
+int iochain_set_timing(const struct IOCHAIN_TIMING* timing)
+{
+   return iochain_ctx_set_timing(&g_iochain,timing);
+}
+
+int iochain_get_timing(struct IOCHAIN_TIMING* timing)
+{
+   return iochain_ctx_get_timing(&g_iochain,timing);
+}
+
 ///////////////////////////////////////
 // I2C Routinen
 //////////////////////////////////////
@@ -241,25 +1206,21 @@ int iochain_update()
 
 int read_i2c(int address, char reg, int amount, char* data)
 {
-   int i=0;
    int err;
    //error checking
    // TODO
 
    //set clock ?
 
-   //set address
-   bcm2835_i2c_setSlaveAddress(address);    
-
-   err = bcm2835_i2c_write(&reg,1);
-   if(err!= BCM2835_I2C_REASON_OK)
+   err = g_backend->i2c_write(address,&reg,1);
+   if(err!= 0)
    {
      printf("Error sending i2c register\n");
      return ERR_I2C;
    }
    //read data
-   err= bcm2835_i2c_read(data,amount);
-   if(err!= BCM2835_I2C_REASON_OK)
+   err= g_backend->i2c_read(address,data,amount);
+   if(err!= 0)
    {
      printf("Error reading i2c data\n");
      return ERR_I2C;
@@ -269,7 +1230,6 @@ int read_i2c(int address, char reg, int amount, char* data)
 
 int write_i2c(int address, char reg, int amount, char* data)
 {
-   int i=0;
    //error checking
    // TODO
    int err=0;
@@ -283,11 +1243,9 @@ int write_i2c(int address, char reg, int amount, char* data)
    //set clock ?
 
 
-   //set address
-   bcm2835_i2c_setSlaveAddress(address);   
    //send data
-   err = bcm2835_i2c_write(txbuf,amount+1);
-   if(err!= BCM2835_I2C_REASON_OK)
+   err = g_backend->i2c_write(address,txbuf,amount+1);
+   if(err!= 0)
    {
      printf("Error sending i2c data: %x\n",err);
      return ERR_I2C;
@@ -299,34 +1257,77 @@ int write_i2c(int address, char reg, int amount, char* data)
 ////////////////////////////////////////////
 //  SPI routines
 ////////////////////////////////////////////
+
+// the profile of the spi bus controller - mode -1 means unknown
+struct SPI_PROFILE spi_active = { -1, 0, 0 };
+const struct SPI_PROFILE spi_default_profile = { SPI_MODE3, SPI_BIT_ORDER_MSBFIRST, SPI_CLOCK_DIVIDER_65536 };
+pthread_mutex_t spi_mutex = PTHREAD_MUTEX_INITIALIZER;
+__thread int spi_depth = 0;     // sessions of the calling thread
+
+int spi_profile_init(struct SPI_PROFILE* profile, int mode, int bitorder, unsigned long max_hz)
+{
+   unsigned long divider = 2;
+
+   if(profile == NULL || mode < SPI_MODE0 || mode > SPI_MODE3 || max_hz == 0)
+      return ERR_PARAM;
+
+   //the fastest clock not above max_hz - the controller takes powers of two best
+   while(divider < 65536 && SPI_CORE_CLOCK_HZ/divider > max_hz)
+      divider <<= 1;
+
+   profile->mode = mode;
+   profile->bitorder = bitorder;
+   profile->divider = divider == 65536 ? SPI_CLOCK_DIVIDER_65536 : (int)divider;
+   return 0;
+}
+
+int spi_session_begin(const struct SPI_PROFILE* profile)
+{
+   if(profile == NULL)
+      return ERR_PARAM;
+
+   if(spi_depth++ > 0)
+      return 0;
+   pthread_mutex_lock(&spi_mutex);
+
+   //only program the controller if the device type changes
+   if(profile->mode != spi_active.mode || profile->bitorder != spi_active.bitorder || profile->divider != spi_active.divider)
+   {
+      g_backend->spi_configure(profile->mode,profile->bitorder,profile->divider);
+      spi_active = *profile;
+   }
+   return 0;
+}
+
+int spi_session_end()
+{
+   if(spi_depth == 0)
+      return ERR_INIT;
+
+   if(--spi_depth == 0)
+      pthread_mutex_unlock(&spi_mutex);
+   return 0;
+}
+
 unsigned char spi_transfer(unsigned char data)
 {
-    bcm2835_spi_setDataMode(BCM2835_SPI_MODE3);
-    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);    
-   bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_65536)	;
+   unsigned char ret;
 
-   char ret = bcm2835_spi_transfer(data);
+   spi_transfernb(&data,&ret,1);
 
    return ret;
 }
 
 void spi_transfern(unsigned char* data,int len)
 {
-    bcm2835_spi_setDataMode(BCM2835_SPI_MODE3);
-    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);    
-   bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_65536)	;	
-  bcm2835_spi_transfern(data,len);
+   spi_transfernb(data,data,len);
 }
 
 void spi_transfernb(unsigned char* dataTx,unsigned char* dataRx,int len)
 {
-    bcm2835_spi_setDataMode(BCM2835_SPI_MODE3);
-	bcm2835_spi_setDataMode(BCM2835_SPI_MODE3);
-    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);    
-   bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_65536)	;
-   bcm2835_spi_transfernb(dataTx,dataRx,len);
-	
-
+   spi_session_begin(&spi_default_profile);
+   g_backend->spi_transfer(dataTx,dataRx,len);
+   spi_session_end();
 }
 
 ////////////////////////////////////////////
@@ -335,28 +1336,37 @@ void spi_transfernb(unsigned char* dataTx,unsigned char* dataRx,int len)
 
 // main setup routine
 int setup_raspidapter(int numboards)
+{
+   int datapin = CHAINED_IO_DATA;
+   return setup_raspidapter_chains(numboards,1,&datapin);
+}
+
+// setup routine for boards spread over parallel chains
+int setup_raspidapter_chains(int numboards, int numchains, const int* datapins)
 {
    //error checking
-   if(numboards <1)
+   if(numboards <1 || numchains < 1 || datapins == NULL)
      return ERR_PARAM;
 
    if(g_initialised == 1)
 	return ERR_INIT;
 
    //setup IO access
-   if(!bcm2835_init())
+   if(g_backend->init() != 0)
 	return -1;
 
+   //measure the delay loop before the io chain derives its delays from it
+   timing_calibrate();
+
    //setup i2c
-   bcm2835_i2c_begin();
+   g_backend->i2c_begin();
 
-   //setup Spi - but return cs signals to normal, as they are set via io_chain
-   bcm2835_spi_begin();
-   bcm2835_gpio_fsel(RPI_GPIO_P1_26, BCM2835_GPIO_FSEL_OUTP); // CE1
-   bcm2835_gpio_fsel(RPI_GPIO_P1_24, BCM2835_GPIO_FSEL_OUTP); // CE0
+   //setup Spi - the backend returns the cs signals to normal, as they are set via io_chain
+   g_backend->spi_begin();
+   spi_active.mode = -1;
   
    //setup iochain
-   int ret = setup_iochain(numboards);
+   int ret = iochain_init(&g_iochain,numboards,numchains,datapins,CHAINED_IO_CLOCK,CHAINED_IO_STROBE,CHAINED_IO_ENABLE);
    if(ret != 0)
 	return ret;
 
@@ -367,9 +1377,10 @@ int setup_raspidapter(int numboards)
 
 int deinit_raspidapter()
 {
-  deinit_iochain();
-  bcm2835_i2c_end();
-  bcm2835_spi_end();
-  bcm2835_close();
+  iochain_deinit(&g_iochain);
+  g_initialised = 0;
+  g_backend->i2c_end();
+  g_backend->spi_end();
+  g_backend->close();
   return 0;
 }
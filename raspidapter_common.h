@@ -21,24 +21,212 @@
 
 
 
+#ifndef RASPIDAPTER_COMMON_H
+#define RASPIDAPTER_COMMON_H
+
 #include <stdio.h>
+#include <stdint.h>
+
+// maximum number of parallel data lines in one chain group
+#define IOCHAIN_MAX_CHAINS 8
+
+// bits per word of the chain images
+#define IOCHAIN_WORD_BITS 32
+
+struct WAVE;
+
+// timing of the IO chain signals in ns - defaults are the 74HC595 limits at 3.3V plus margin
+struct IOCHAIN_TIMING
+{
+   unsigned int setup_ns;       // data stable before the rising clock edge
+   unsigned int hold_ns;        // data stable after the rising clock edge
+   unsigned int clock_high_ns;  // minimum clock high time
+   unsigned int clock_low_ns;   // minimum clock low time
+   unsigned int strobe_ns;      // minimum strobe pulse width
+};
+
+// one clock cycle of an IO chain group as gpio set and clear masks
+struct IOCHAIN_OP
+{
+   uint32_t set;   // GPSET before the rising edge - data pins going high
+   uint32_t clr;   // GPCLR for the falling edge - clock and data pins going low for the next bit
+};
+
+// a group of IO chains on separate data lines sharing clock and strobe
+// Bit n of every chain is shifted in the same clock cycle. Use the iochain_* functions
+// to access the members.
+struct IOCHAIN
+{
+   int numboards;
+   int numchains;
+   int boards_per_chain;
+   int chain_bits;            // bits per chain
+   int num_io;                // bits of all chains - chain k holds bits k*chain_bits ...
 
+   uint32_t data_mask[IOCHAIN_MAX_CHAINS];
+   uint32_t data_all;
+   uint32_t clock_mask;
+   uint32_t strobe_mask;
+
+   // the images are num_words words, bit n is bit n%32 of word n/32
+   int num_words;
+   uint32_t* buffer;          // updated by the writers with atomic word operations
+   uint32_t* front;           // snapshot of the buffer the shifter serializes
+   uint32_t* latched;         // image of the last frame latched into the registers
+   uint32_t* pulse;           // bits which are dropped again right after the next latch
+   uint32_t* taken;           // pulse bits of the frame being shifted
+   uint32_t* toggled;         // bits toggled since the last frame - a second toggle latches the first one
+   int latched_valid;
+   struct IOCHAIN_OP* frame;
+   uint32_t* wave_last;       // last frame of a waveform being played, latched once it is done
+   int wave_pending;
+
+   // bits written inside open transactions - other threads latch them at their last level
+   uint32_t* deferred;
+
+   // shifter state - one thread shifts, the others leave their changes to it
+   int shifting;
+   int again;
+
+   // emergency stop - the safe frame is compiled in advance, a stop raises the generation
+   // and the player drops the frame it is shifting
+   uint32_t* hold;            // bits forced low while stopped
+   uint32_t* keep;            // bits frozen at their latched level while stopped
+   uint32_t* stop_image;      // the safe image
+   struct IOCHAIN_OP* stop_frame;
+   int stopped;
+   unsigned int generation;
+   unsigned long long stop_latched_ns;  // timing_now_ns of the last latched safe frame
+
+   struct IOCHAIN_TIMING timing;
+   unsigned int setup_wait;   // delay loops derived from the timing
+   unsigned int high_wait;
+   unsigned int low_wait;
+   unsigned int strobe_wait;
+};
 
 // Error codes
 #define ERR_PARAM -1
 #define ERR_INIT -2
 #define ERR_I2C -3
+#define ERR_ESTOP -4    // an emergency stop interrupted the operation
 
 // main setup routine
 // param: number of connected boards
 int setup_raspidapter(int numboards);
 
+// setup routine for boards spread over parallel chains sharing clock and strobe
+// numboards - number of connected boards
+// numchains - number of data lines, at most IOCHAIN_MAX_CHAINS
+// datapins - gpio number of the data line of every chain
+int setup_raspidapter_chains(int numboards, int numchains, const int* datapins);
+
 //frees allocated resources
 int deinit_raspidapter();
 
 
 //functions to access the serial clocked IOs - normally only used by the DICE functions
 
+// init an additional group of IO chains - setup_raspidapter already inits the default one
+// clock, strobe and enable are gpio numbers, enable may be -1 if not connected
+int iochain_init(struct IOCHAIN* chain, int numboards, int numchains, const int* datapins, int clock, int strobe, int enable);
+
+// free a group of IO chains
+int iochain_deinit(struct IOCHAIN* chain);
+
+// the chain group set up by setup_raspidapter
+struct IOCHAIN* iochain_default();
+
+// select the chain group the dice_*_setup functions bind the DICE to
+int iochain_select(struct IOCHAIN* chain);
+struct IOCHAIN* iochain_selected();
+
+// get the bit number of a pin in a slot
+// board - counting from 1, slot - 1 to 4, pin - 0 to 7
+int iochain_bit(struct IOCHAIN* chain, int board, int slot, int pin);
+
+// a set of pins of one chain group as (word, mask) pairs - touching all pins of
+// the set is one atomic operation per word
+#define IOCHAIN_PINSET_WORDS 32
+
+struct IOCHAIN_PINSET
+{
+   struct IOCHAIN* chain;
+   int count;
+   int word[IOCHAIN_PINSET_WORDS];
+   uint32_t mask[IOCHAIN_PINSET_WORDS];
+};
+
+// start an empty pin set of a chain group
+int iochain_pinset_init(struct IOCHAIN_PINSET* set, struct IOCHAIN* chain);
+
+// add a bit to a pin set
+int iochain_pinset_add(struct IOCHAIN_PINSET* set, int bit);
+
+// add a precomputed (word, mask) pair to a pin set
+int iochain_pinset_add_mask(struct IOCHAIN_PINSET* set, int word, uint32_t mask);
+
+// set, clear, pulse or toggle all pins of a set
+// like the single bit functions, pulse and toggle update the chain
+int iochain_set_pins(const struct IOCHAIN_PINSET* set);
+int iochain_clear_pins(const struct IOCHAIN_PINSET* set);
+int iochain_pulse_pins(const struct IOCHAIN_PINSET* set);
+int iochain_toggle_pins(const struct IOCHAIN_PINSET* set);
+
+// change a word of the buffer in one atomic step: set, then clear, then toggle bits
+int iochain_ctx_modify_word(struct IOCHAIN* chain, int word, uint32_t set, uint32_t clr, uint32_t toggle);
+
+// copy the buffer into image (num_words words) - safe while other threads write bits
+void iochain_snapshot(const struct IOCHAIN* chain, uint32_t* image);
+
+// compile a chain image (num_words words, like the buffer) into chain_bits clock cycles
+// used by the players, ops must hold chain_bits entries
+void iochain_compile_image(const struct IOCHAIN* chain, const uint32_t* image, struct IOCHAIN_OP* ops);
+
+// start a waveform with the shifter of its chain group taken - used by wave_play
+// last - the image of its last frame, the chain counts it as latched once the waveform is done
+// returns ERR_ESTOP while the chain group is stopped
+int iochain_ctx_play_wave(struct IOCHAIN* chain, const struct WAVE* wave, const uint32_t* last);
+
+// emergency stop of a chain group - see raspidapter_estop.h for the full stop
+// hold - the bit is cleared by a stop and kept low until the release
+// safe - the bit is high in the safe frame (eg chip selects), all other bits are low
+// keep - the bit stays at its latched level until the release (eg double edge step inputs,
+//        where any level change is a step)
+int iochain_ctx_stop_hold(struct IOCHAIN* chain, int bit);
+int iochain_ctx_stop_safe(struct IOCHAIN* chain, int bit);
+int iochain_ctx_stop_keep(struct IOCHAIN* chain, int bit);
+
+// drop all hold, safe and keep bits - the safe frame is all low again
+int iochain_ctx_stop_clear(struct IOCHAIN* chain);
+
+// latch the safe frame - async signal safe, any thread
+// If another thread is shifting, it drops its frame at the next bit and latches the
+// safe frame itself. Worst case: iochain_ctx_stop_worst_ns() after the call.
+int iochain_ctx_stop(struct IOCHAIN* chain);
+
+// allow the held bits again - they stay low until they are set, kept bits stay at the
+// level latched by the stop
+int iochain_ctx_release(struct IOCHAIN* chain);
+
+// the worst case time from iochain_ctx_stop to the latched safe frame:
+// one bit of a dropped frame, the safe frame and its strobe
+unsigned long long iochain_ctx_stop_worst_ns(struct IOCHAIN* chain);
+
+// the iochain_ctx_* functions work like the functions below on a given chain group
+int iochain_ctx_setbit(struct IOCHAIN* chain, int bit);
+int iochain_ctx_clearbit(struct IOCHAIN* chain, int bit);
+int iochain_ctx_pulsebit(struct IOCHAIN* chain, int bit);
+int iochain_ctx_togglebit(struct IOCHAIN* chain, int bit);
+int iochain_ctx_update(struct IOCHAIN* chain);
+int iochain_ctx_flush(struct IOCHAIN* chain);
+int iochain_ctx_begin(struct IOCHAIN* chain);
+int iochain_ctx_commit(struct IOCHAIN* chain);
+int iochain_ctx_set_timing(struct IOCHAIN* chain, const struct IOCHAIN_TIMING* timing);
+int iochain_ctx_get_timing(struct IOCHAIN* chain, struct IOCHAIN_TIMING* timing);
+
+// the following functions work on the chain group set up by setup_raspidapter
+
 // set a bit in the IO chain
 // bit - the bit number (not a bitfield)
 int iochain_setbit(int bit);
@@ -47,15 +235,72 @@ int iochain_setbit(int bit);
 // bit - the bit number (not a bitfield)
 int iochain_clearbit(int bit);
 
+// set a bit for one latched frame only - it is cleared and latched again right after
+// bit - the bit number (not a bitfield)
+int iochain_pulsebit(int bit);
+
+// invert a bit and update - one latched frame per call (eg for double edge step inputs)
+// bit - the bit number (not a bitfield)
+int iochain_togglebit(int bit);
+
 // update buffered IOs to the hardware - blocks whiel sending
+// Skipped if the buffer equals the last latched frame. Deferred inside a transaction.
+// The bit functions are safe from several threads. If another thread is shifting,
+// the update returns and that thread shifts the changes with its next frame.
 int iochain_update();
 
+// set the signal timing of the IO chain
+// The GPIO write time measured at setup is already taken from the delays.
+int iochain_set_timing(const struct IOCHAIN_TIMING* timing);
+
+// get the signal timing of the IO chain
+int iochain_get_timing(struct IOCHAIN_TIMING* timing);
+
+// latch buffered IOs now, even inside a transaction (eg for chip selects)
+// The changes of an open transaction of the calling thread are latched with it.
+int iochain_flush();
+
+// start a transaction: updates are deferred until the outermost iochain_commit()
+// Transactions can be nested. They belong to the calling thread: updates and flushes of
+// other threads go on and latch the bits written inside the transaction at their last
+// latched level, until the commit shows all of them in one frame. A thread holds
+// transactions on up to 8 chain groups; the bits of more than IOCHAIN_PINSET_WORDS
+// words in one transaction are written through.
+int iochain_begin();
+
+// end a transaction: the outermost commit latches all changes in one frame
+int iochain_commit();
+
 // function to access the i2C 
 int read_i2c(int address, char reg, int amount, char* data);
 int write_i2c(int address, char reg, int amount, char* data);
 
 //functions to access SPI
+
+// the spi settings of a device type - mode and bit order like SPI_MODE* and
+// SPI_BIT_ORDER_* in raspidapter_backend.h, divider of the 250MHz core clock
+struct SPI_PROFILE
+{
+   int mode;
+   int bitorder;
+   int divider;
+};
+
+// calc the profile of a device type from its fastest spi clock in Hz
+int spi_profile_init(struct SPI_PROFILE* profile, int mode, int bitorder, unsigned long max_hz);
+
+// start a session: locks the bus for the calling thread and programs the profile,
+// unless it is the active one already. Sessions of a thread can be nested, the inner
+// ones keep the profile of the outermost. Keep the chip select inside the session.
+int spi_session_begin(const struct SPI_PROFILE* profile);
+
+// end a session and unlock the bus
+int spi_session_end();
+
+// transfers - inside a session with its profile, otherwise each one is a session
+// with the default profile (mode 3, msb first, divider 65536)
 unsigned char spi_transfer(unsigned char data);
 void spi_transfern(unsigned char* data,int len);
 void spi_transfernb(unsigned char* dataTx,unsigned char* dataRx,int len);
 
+#endif
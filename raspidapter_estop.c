@@ -0,0 +1,304 @@
+//
+// Raspidapter library
+//
+// emergency stop implementation
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "raspidapter_estop.h"
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "dice_tmc.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <string.h>
+#include <time.h>
+
+// the worker gives up waiting for a thread owning the shifter after this time
+#define ESTOP_LATCH_TIMEOUT_NS 100000000ull
+
+pthread_t estop_thread;
+pthread_mutex_t estop_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t estop_done_cond = PTHREAD_COND_INITIALIZER;
+sem_t estop_sem;
+
+struct DICE* estop_dice[ESTOP_MAX_DICE];
+int estop_numdice = 0;
+struct IOCHAIN* estop_chains[ESTOP_MAX_CHAINS];
+int estop_numchains = 0;
+
+int estop_armed = 0;
+int estop_quit = 0;
+int estop_stopped = 0;
+int estop_busy = 0;                        // triggered, the worker is not done yet
+unsigned long long estop_trigger_ns = 0;
+
+struct ESTOP_STATS estop_stats;
+const struct timespec estop_poll = { 0, 10000 };
+
+static int estop_add_chain(struct IOCHAIN* chain)
+{
+   int i;
+   for(i=0; i < estop_numchains; i++)
+   {
+      if(estop_chains[i] == chain)
+         return 0;
+   }
+   if(estop_numchains == ESTOP_MAX_CHAINS)
+      return ERR_PARAM;
+   estop_chains[estop_numchains++] = chain;
+   return 0;
+}
+
+// the safe frame bits of a DICE
+static int estop_add_dice(struct DICE* dice)
+{
+   int ret = estop_add_chain(dice->chain);
+   if(ret != 0)
+      return ret;
+
+   switch(dice->type)
+   {
+      case DICE_STK:
+         iochain_ctx_stop_hold(dice->chain,dice->enable);
+         iochain_ctx_stop_hold(dice->chain,dice->step);
+         break;
+      case DICE_TMC:
+         // with double edge steps a falling step bit is a step - freeze it instead
+         if(dice_tmc_isDoubleEdge(dice))
+            iochain_ctx_stop_keep(dice->chain,dice->step);
+         else
+            iochain_ctx_stop_hold(dice->chain,dice->step);
+         iochain_ctx_stop_safe(dice->chain,dice->enable);
+         break;
+      case DICE_TC:
+         iochain_ctx_stop_safe(dice->chain,dice->enable);
+         break;
+      default:
+         break;
+   }
+   return 0;
+}
+
+// waits for the safe frames, then turns the TMC choppers off
+static void* estop_main(void* arg)
+{
+   (void)arg;
+
+   for(;;)
+   {
+      unsigned long long trigger;
+      unsigned long long latched = 0;
+      int i;
+
+      while(sem_wait(&estop_sem) != 0)
+         ;
+      if(__atomic_load_n(&estop_quit,__ATOMIC_ACQUIRE))
+         break;
+
+      // a thread owning a shifter latches the safe frame of its group itself
+      trigger = __atomic_load_n(&estop_trigger_ns,__ATOMIC_ACQUIRE);
+      for(i=0; i < estop_numchains; i++)
+      {
+         unsigned long long t;
+         while((t = __atomic_load_n(&estop_chains[i]->stop_latched_ns,__ATOMIC_ACQUIRE)) < trigger)
+         {
+            if(timing_now_ns() - trigger > ESTOP_LATCH_TIMEOUT_NS)
+               break;
+            //sleep, the owner may need this cpu
+            nanosleep(&estop_poll,0);
+         }
+         if(t > latched)
+            latched = t;
+      }
+
+      //the safe frame may have raised a chip select inside a datagram - resend everything
+      for(i=0; i < estop_numdice; i++)
+      {
+         if(estop_dice[i]->type == DICE_TMC)
+         {
+            dice_tmc_invalidate(estop_dice[i]);
+            dice_tmc_setEnabled(estop_dice[i],0);
+            dice_tmc_flush(estop_dice[i]);
+         }
+      }
+
+      pthread_mutex_lock(&estop_mutex);
+      estop_stats.triggers++;
+      estop_stats.last_ns = latched > trigger ? latched - trigger : 0;
+      if(estop_stats.last_ns > estop_stats.max_ns)
+         estop_stats.max_ns = estop_stats.last_ns;
+      estop_stats.chopper_ns = timing_now_ns() - trigger;
+      estop_busy = 0;
+      pthread_cond_broadcast(&estop_done_cond);
+      pthread_mutex_unlock(&estop_mutex);
+   }
+   return 0;
+}
+
+// drops the safe frame setup of every armed chain group
+static void estop_clear_chains()
+{
+   int i;
+   for(i=0; i < estop_numchains; i++)
+      iochain_ctx_stop_clear(estop_chains[i]);
+   estop_numdice = 0;
+   estop_numchains = 0;
+}
+
+int estop_arm(struct DICE** dice, int n)
+{
+   int i;
+   int ret = 0;
+
+   if(dice == 0 || n < 1 || n > ESTOP_MAX_DICE)
+      return ERR_PARAM;
+   if(estop_armed)
+      return ERR_INIT;
+
+   estop_numdice = 0;
+   estop_numchains = 0;
+   for(i=0; i < n && ret == 0; i++)
+   {
+      if(dice[i] == 0 || dice[i]->chain == 0)
+         ret = ERR_PARAM;
+      else
+         ret = estop_add_dice(dice[i]);
+      if(ret == 0)
+         estop_dice[estop_numdice++] = dice[i];
+   }
+   // nothing stays half armed
+   if(ret != 0)
+   {
+      estop_clear_chains();
+      return ret;
+   }
+
+   memset(&estop_stats,0,sizeof(estop_stats));
+   estop_stats.worst_ns = estop_worst_ns();
+   estop_quit = 0;
+   estop_stopped = 0;
+   estop_busy = 0;
+   if(sem_init(&estop_sem,0,0) != 0)
+   {
+      estop_clear_chains();
+      return ERR_INIT;
+   }
+   if(pthread_create(&estop_thread,0,estop_main,0) != 0)
+   {
+      sem_destroy(&estop_sem);
+      estop_clear_chains();
+      return ERR_INIT;
+   }
+   estop_armed = 1;
+   return 0;
+}
+
+int estop_disarm()
+{
+   if(!estop_armed)
+      return ERR_INIT;
+
+   // a stopped group is released first, then the held and safe bits are dropped
+   if(estop_active())
+      estop_release();
+
+   __atomic_store_n(&estop_quit,1,__ATOMIC_RELEASE);
+   sem_post(&estop_sem);
+   pthread_join(estop_thread,0);
+   sem_destroy(&estop_sem);
+   estop_clear_chains();
+   estop_armed = 0;
+   return 0;
+}
+
+//
+// only atomics, clock_gettime, the backend and sem_post - safe in a signal handler
+//
+int estop_trigger()
+{
+   int i;
+
+   if(!estop_armed)
+      return ERR_INIT;
+
+   __atomic_store_n(&estop_trigger_ns,timing_now_ns(),__ATOMIC_RELEASE);
+   __atomic_store_n(&estop_stopped,1,__ATOMIC_SEQ_CST);
+   __atomic_store_n(&estop_busy,1,__ATOMIC_SEQ_CST);
+
+   for(i=0; i < estop_numchains; i++)
+      iochain_ctx_stop(estop_chains[i]);
+
+   sem_post(&estop_sem);
+   return 0;
+}
+
+int estop_active()
+{
+   return __atomic_load_n(&estop_stopped,__ATOMIC_ACQUIRE);
+}
+
+int estop_wait_done()
+{
+   if(!estop_armed)
+      return ERR_INIT;
+
+   pthread_mutex_lock(&estop_mutex);
+   while(__atomic_load_n(&estop_busy,__ATOMIC_ACQUIRE))
+      pthread_cond_wait(&estop_done_cond,&estop_mutex);
+   pthread_mutex_unlock(&estop_mutex);
+   return 0;
+}
+
+int estop_release()
+{
+   int i;
+
+   if(!estop_armed)
+      return ERR_INIT;
+
+   // the choppers are turned off before anything may move again
+   estop_wait_done();
+   for(i=0; i < estop_numchains; i++)
+      iochain_ctx_release(estop_chains[i]);
+   __atomic_store_n(&estop_stopped,0,__ATOMIC_SEQ_CST);
+   return 0;
+}
+
+// the groups are stopped one after the other
+unsigned long long estop_worst_ns()
+{
+   unsigned long long worst = 0;
+   int i;
+
+   for(i=0; i < estop_numchains; i++)
+      worst += iochain_ctx_stop_worst_ns(estop_chains[i]);
+   return worst;
+}
+
+int estop_get_stats(struct ESTOP_STATS* stats)
+{
+   if(stats == 0)
+      return ERR_PARAM;
+
+   pthread_mutex_lock(&estop_mutex);
+   *stats = estop_stats;
+   pthread_mutex_unlock(&estop_mutex);
+   return 0;
+}
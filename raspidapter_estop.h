@@ -0,0 +1,82 @@
+//
+// Raspidapter Library Code
+//
+// emergency stop header
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef RASPIDAPTER_ESTOP_H
+#define RASPIDAPTER_ESTOP_H
+
+#include "dice_common.h"
+
+// The emergency stop latches a precompiled safe frame on every armed chain group:
+// all outputs low, STK enables and all step inputs held low until the release,
+// TMC and TC chip selects high. The step inputs of TMC DICE in double edge mode keep
+// their level instead, any change would be a step - arm after the step mode is settled. The frame does not depend on the number of DICE,
+// it is latched at most iochain_ctx_stop_worst_ns() after the trigger on every group
+// (estop_worst_ns() for all of them), as long as a thread shifting the chain is not
+// descheduled. A waveform being played is stopped, wave_play refuses new ones.
+// A worker thread then sends all five registers of every armed TMC over SPI again,
+// with the chopper off - a datagram cut off by the safe frame is overwritten. Until
+// estop_release the worker owns the TMC register shadows: do not call the TMC setters
+// or flushes while stopped, reapply settings after the release.
+// While stopped the step scheduler, program_play, the dice_profile runners, TMC homing and CoolStep tuning all return ERR_ESTOP.
+
+#define ESTOP_MAX_DICE 64
+#define ESTOP_MAX_CHAINS 8
+
+// measured reaction times
+struct ESTOP_STATS
+{
+   unsigned long long triggers;
+   unsigned long long last_ns;        // trigger to the safe frame latched on all groups
+   unsigned long long max_ns;
+   unsigned long long worst_ns;       // the documented bound, see estop_worst_ns
+   unsigned long long chopper_ns;     // trigger to the last TMC chopper turned off
+};
+
+// arm the stop for a set of DICE and start the worker thread
+// On an error nothing is armed, the safe frames of the groups are left all low.
+int estop_arm(struct DICE** dice, int n);
+
+// stop the worker thread - the DICE are no longer stopped by estop_trigger
+// A stop still active is released, the hold and safe bits of the groups are dropped.
+int estop_disarm();
+
+// trigger the stop - async signal safe, may be called from any thread
+int estop_trigger();
+
+// 1 between estop_trigger and estop_release
+int estop_active();
+
+// block until the worker turned the TMC choppers off
+int estop_wait_done();
+
+// leave the stop state - the held outputs stay low and the TMC choppers off
+// until they are enabled again
+int estop_release();
+
+// the worst case time from the trigger to the safe frame on all armed groups
+unsigned long long estop_worst_ns();
+
+// get the reaction times
+int estop_get_stats(struct ESTOP_STATS* stats);
+
+#endif
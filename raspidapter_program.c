@@ -0,0 +1,465 @@
+//
+// Raspidapter library
+//
+// motion program implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "raspidapter_program.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_estop.h"
+#include "dice_tmc.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////
+//  compiler
+////////////////////////////////////////////
+
+// by time - direction and enable changes before the steps of the same time
+static int program_event_order(const void* a, const void* b)
+{
+   const struct PROGRAM_EVENT* x = (const struct PROGRAM_EVENT*)a;
+   const struct PROGRAM_EVENT* y = (const struct PROGRAM_EVENT*)b;
+
+   if(x->time_ns != y->time_ns)
+      return x->time_ns < y->time_ns ? -1 : 1;
+   return (x->type == PROGRAM_STEP) - (y->type == PROGRAM_STEP);
+}
+
+// the word changes of the frame being compiled
+struct PROGRAM_FRAME
+{
+   int num_words;
+   uint32_t* set;
+   uint32_t* clr;
+   uint32_t* toggle;
+};
+
+static void program_level(struct PROGRAM_FRAME* frame, int bit, int level)
+{
+   uint32_t mask = 1u << (bit & 31);
+   if(level)
+   {
+      frame->set[bit>>5] |= mask;
+      frame->clr[bit>>5] &= ~mask;
+   }
+   else
+   {
+      frame->clr[bit>>5] |= mask;
+      frame->set[bit>>5] &= ~mask;
+   }
+}
+
+static int program_write_record(FILE* f, struct PROGRAM_FRAME* frame, uint64_t time_ns)
+{
+   struct PROGRAM_RECORD record;
+   struct PROGRAM_ENTRY entry;
+   int i;
+
+   record.time_ns = time_ns;
+   record.count = 0;
+   record.reserved = 0;
+   for(i=0; i < frame->num_words; i++)
+   {
+      if(frame->set[i] | frame->clr[i] | frame->toggle[i])
+         record.count++;
+   }
+   if(fwrite(&record,sizeof(record),1,f) != 1)
+      return ERR_INIT;
+
+   for(i=0; i < frame->num_words; i++)
+   {
+      if(!(frame->set[i] | frame->clr[i] | frame->toggle[i]))
+         continue;
+      entry.word = i;
+      entry.set = frame->set[i];
+      entry.clr = frame->clr[i];
+      entry.toggle = frame->toggle[i];
+      if(fwrite(&entry,sizeof(entry),1,f) != 1)
+         return ERR_INIT;
+   }
+
+   memset(frame->set,0,frame->num_words*sizeof(uint32_t));
+   memset(frame->clr,0,frame->num_words*sizeof(uint32_t));
+   memset(frame->toggle,0,frame->num_words*sizeof(uint32_t));
+   return 0;
+}
+
+int program_compile(const char* filename, struct IOCHAIN* chain, const struct PROGRAM_EVENT* events, int n,
+                    unsigned int window_ns, unsigned int pulse_ns)
+{
+   struct PROGRAM_HEADER header;
+   struct PROGRAM_FRAME frame;
+   struct PROGRAM_EVENT* ev;
+   uint32_t* fall;
+   uint32_t* used;
+   uint32_t* steps;
+   uint32_t* toggles;
+   int falling = 0;
+   uint64_t fall_time = 0;
+   FILE* f;
+   int ret = 0;
+   int i;
+
+   //error checking
+   if(filename == NULL || chain == NULL || chain->buffer == 0 || (events == NULL && n > 0) || n < 0)
+   {
+      return ERR_PARAM;
+   }
+   for(i=0; i < n; i++)
+   {
+      struct DICE* dice = events[i].dice;
+      if(dice == NULL || dice->chain != chain || (dice->type != DICE_STK && dice->type != DICE_TMC))
+         return ERR_PARAM;
+      if(events[i].type < PROGRAM_STEP || events[i].type > PROGRAM_ENABLE)
+         return ERR_PARAM;
+   }
+
+   ev = malloc((n ? n : 1)*sizeof(struct PROGRAM_EVENT));
+   frame.num_words = chain->num_words;
+   frame.set = calloc(chain->num_words,sizeof(uint32_t));
+   frame.clr = calloc(chain->num_words,sizeof(uint32_t));
+   frame.toggle = calloc(chain->num_words,sizeof(uint32_t));
+   fall = calloc(chain->num_words,sizeof(uint32_t));
+   used = calloc(chain->num_words,sizeof(uint32_t));
+   steps = calloc(chain->num_words,sizeof(uint32_t));
+   toggles = calloc(chain->num_words,sizeof(uint32_t));
+   f = fopen(filename,"wb");
+   if(ev == NULL || frame.set == NULL || frame.clr == NULL || frame.toggle == NULL || fall == NULL
+      || used == NULL || steps == NULL || toggles == NULL || f == NULL)
+   {
+      ret = ERR_INIT;
+      goto done;
+   }
+   memcpy(ev,events,n*sizeof(struct PROGRAM_EVENT));
+   qsort(ev,n,sizeof(struct PROGRAM_EVENT),program_event_order);
+
+   //the step mode of every DICE - the mode the driver holds now
+   for(i=0; i < n; i++)
+   {
+      struct DICE* dice = ev[i].dice;
+      steps[dice->step>>5] |= 1u << (dice->step & 31);
+      if(dice->type == DICE_TMC && dice_tmc_isDoubleEdge(dice))
+         toggles[dice->step>>5] |= 1u << (dice->step & 31);
+   }
+
+   memset(&header,0,sizeof(header));
+   header.magic = PROGRAM_MAGIC;
+   header.version = PROGRAM_VERSION;
+   header.num_words = chain->num_words;
+   header.numboards = chain->numboards;
+   header.numchains = chain->numchains;
+   if(fwrite(&header,sizeof(header),1,f) != 1
+      || fwrite(steps,sizeof(uint32_t),chain->num_words,f) != (size_t)chain->num_words
+      || fwrite(toggles,sizeof(uint32_t),chain->num_words,f) != (size_t)chain->num_words)
+   {
+      ret = ERR_INIT;
+      goto done;
+   }
+
+   i = 0;
+   while(i < n && ret == 0)
+   {
+      uint64_t t0 = ev[i].time_ns;
+
+      //drop the step bits of the last frame - before the next frame at the latest
+      if(falling)
+      {
+         uint64_t t = fall_time < t0 ? fall_time : t0;
+         memcpy(frame.clr,fall,chain->num_words*sizeof(uint32_t));
+         memset(fall,0,chain->num_words*sizeof(uint32_t));
+         ret = program_write_record(f,&frame,t);
+         header.num_records++;
+         header.duration_ns = t;
+         falling = 0;
+         if(ret != 0)
+            break;
+      }
+
+      //a DICE appears once per frame - its step bit stands for it
+      memset(used,0,chain->num_words*sizeof(uint32_t));
+      for(; i < n && ev[i].time_ns <= t0 + window_ns; i++)
+      {
+         struct DICE* dice = ev[i].dice;
+         uint32_t mask = 1u << (dice->step & 31);
+         if(used[dice->step>>5] & mask)
+            break;
+         used[dice->step>>5] |= mask;
+
+         if(ev[i].type == PROGRAM_DIR)
+            program_level(&frame,dice->dir,ev[i].value);
+         else if(ev[i].type == PROGRAM_ENABLE)
+            program_level(&frame,dice->enable,ev[i].value);
+         else if(toggles[dice->step>>5] & mask)
+            frame.toggle[dice->step>>5] ^= mask;
+         else
+         {
+            program_level(&frame,dice->step,1);
+            fall[dice->step>>5] |= mask;
+            falling = 1;
+         }
+      }
+
+      ret = program_write_record(f,&frame,t0);
+      header.num_records++;
+      header.duration_ns = t0;
+      fall_time = t0 + pulse_ns;
+   }
+   if(falling && ret == 0)
+   {
+      memcpy(frame.clr,fall,chain->num_words*sizeof(uint32_t));
+      ret = program_write_record(f,&frame,fall_time);
+      header.num_records++;
+      header.duration_ns = fall_time;
+   }
+
+   //the header knows the size now
+   if(ret == 0 && (fseek(f,0,SEEK_SET) != 0 || fwrite(&header,sizeof(header),1,f) != 1))
+      ret = ERR_INIT;
+
+done:
+   if(f != NULL && fclose(f) != 0 && ret == 0)
+      ret = ERR_INIT;
+   free(ev);
+   free(frame.set);
+   free(frame.clr);
+   free(frame.toggle);
+   free(fall);
+   free(used);
+   free(steps);
+   free(toggles);
+   return ret;
+}
+
+////////////////////////////////////////////
+//  player
+////////////////////////////////////////////
+
+int program_open(struct PROGRAM* program, const char* filename)
+{
+   struct stat st;
+   void* map;
+
+   //error checking
+   if(program == NULL || filename == NULL)
+   {
+      return ERR_PARAM;
+   }
+
+   memset(program,0,sizeof(struct PROGRAM));
+   program->fd = open(filename,O_RDONLY);
+   if(program->fd < 0)
+   {
+      return ERR_INIT;
+   }
+   if(fstat(program->fd,&st) != 0 || (size_t)st.st_size < sizeof(struct PROGRAM_HEADER))
+   {
+      close(program->fd);
+      return ERR_PARAM;
+   }
+
+   map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,program->fd,0);
+   if(map == MAP_FAILED)
+   {
+      close(program->fd);
+      return ERR_INIT;
+   }
+   //read ahead while playing
+   madvise(map,st.st_size,MADV_SEQUENTIAL);
+
+   program->map = map;
+   program->size = st.st_size;
+   program->header = (const struct PROGRAM_HEADER*)map;
+   if(program->header->magic != PROGRAM_MAGIC || program->header->version != PROGRAM_VERSION
+      || (program->size - sizeof(struct PROGRAM_HEADER))/(2*sizeof(uint32_t)) < program->header->num_words)
+   {
+      program_close(program);
+      return ERR_PARAM;
+   }
+   program->steps = (const uint32_t*)(program->header + 1);
+   program->toggles = program->steps + program->header->num_words;
+
+   return 0;
+}
+
+int program_close(struct PROGRAM* program)
+{
+   if(program == NULL || program->map == NULL)
+   {
+      return ERR_PARAM;
+   }
+
+   munmap((void*)program->map,program->size);
+   close(program->fd);
+   program->map = NULL;
+   program->header = NULL;
+   program->steps = NULL;
+   program->toggles = NULL;
+   program->size = 0;
+   program->fd = -1;
+   return 0;
+}
+
+// checks that the DICE cover every step bit of the program in the compiled step mode
+static int program_check_modes(const struct PROGRAM* program, struct IOCHAIN* chain, struct DICE** dice, int n)
+{
+   uint32_t w;
+   int i;
+
+   for(w=0; w < program->header->num_words; w++)
+   {
+      uint32_t covered = 0;
+      for(i=0; i < n; i++)
+      {
+         uint32_t mask = 1u << (dice[i]->step & 31);
+         int toggle;
+
+         if(dice[i]->chain != chain || (uint32_t)(dice[i]->step>>5) != w || !(program->steps[w] & mask))
+            continue;
+         toggle = dice[i]->type == DICE_TMC && dice_tmc_isDoubleEdge(dice[i]);
+         if(toggle != ((program->toggles[w] & mask) != 0))
+            return ERR_PARAM;
+         covered |= mask;
+      }
+      if(covered != program->steps[w])
+         return ERR_PARAM;
+   }
+   return 0;
+}
+
+// update the tracks of the DICE on a word of the chain after an entry was applied
+// before - the word before the entry
+static void program_track(const struct PROGRAM* program, struct IOCHAIN* chain, struct DICE** dice, int n,
+                          const struct PROGRAM_ENTRY* entry, uint32_t before)
+{
+   uint32_t after = __atomic_load_n(&chain->buffer[entry->word],__ATOMIC_RELAXED);
+   uint32_t changed = before ^ after;
+   int i;
+
+   if(changed == 0)
+      return;
+   for(i=0; i < n; i++)
+   {
+      uint32_t mask;
+
+      if(dice[i]->chain != chain)
+         continue;
+      if(dice[i]->dir >= 0 && (uint32_t)(dice[i]->dir>>5) == entry->word)
+      {
+         mask = 1u << (dice[i]->dir & 31);
+         if(changed & mask)
+            dice_track_dir(dice[i],(after & mask) != 0);
+      }
+      if((uint32_t)(dice[i]->step>>5) == entry->word)
+      {
+         //a toggled step bit steps on both edges, a pulsed one on the rising edge
+         mask = 1u << (dice[i]->step & 31);
+         if((changed & mask) && ((program->toggles[entry->word] & mask) || (after & mask)))
+            dice_track_step(dice[i]);
+      }
+   }
+}
+
+int program_play(const struct PROGRAM* program, struct IOCHAIN* chain, struct DICE** dice, int n,
+                 struct PROGRAM_STATS* stats)
+{
+   const unsigned char* p;
+   const unsigned char* end;
+   unsigned long long start;
+   uint64_t r;
+   int i;
+
+   //error checking
+   if(program == NULL || program->map == NULL || chain == NULL || chain->buffer == 0 || (dice == NULL && n > 0) || n < 0)
+   {
+      return ERR_PARAM;
+   }
+   if(program->header->num_words != (uint32_t)chain->num_words)
+   {
+      return ERR_PARAM;
+   }
+   for(i=0; i < n; i++)
+   {
+      if(dice[i] == NULL)
+         return ERR_PARAM;
+   }
+   if(program_check_modes(program,chain,dice,n) != 0)
+   {
+      return ERR_PARAM;
+   }
+   if(stats != NULL)
+   {
+      memset(stats,0,sizeof(struct PROGRAM_STATS));
+   }
+
+   p = (const unsigned char*)(program->toggles + program->header->num_words);
+   end = program->map + program->size;
+   start = timing_now_ns();
+
+   for(r=0; r < program->header->num_records; r++)
+   {
+      const struct PROGRAM_RECORD* record = (const struct PROGRAM_RECORD*)p;
+      const struct PROGRAM_ENTRY* entry;
+      unsigned long long now;
+      uint32_t i;
+
+      //the records are checked as they are played - a truncated file stops the program
+      if((size_t)(end - p) < sizeof(struct PROGRAM_RECORD))
+         return ERR_PARAM;
+      entry = (const struct PROGRAM_ENTRY*)(record + 1);
+      if(record->count > (uint32_t)chain->num_words || (size_t)(end - (const unsigned char*)entry) < record->count*sizeof(struct PROGRAM_ENTRY))
+         return ERR_PARAM;
+
+      timing_wait_until(start + record->time_ns);
+      if(estop_active())
+         return ERR_ESTOP;
+      for(i=0; i < record->count; i++, entry++)
+      {
+         uint32_t before;
+
+         if(entry->word >= (uint32_t)chain->num_words)
+            return ERR_PARAM;
+         before = __atomic_load_n(&chain->buffer[entry->word],__ATOMIC_RELAXED);
+         if(iochain_ctx_modify_word(chain,entry->word,entry->set,entry->clr,entry->toggle) != 0)
+            return ERR_PARAM;
+         program_track(program,chain,dice,n,entry,before);
+      }
+      iochain_ctx_update(chain);
+
+      if(stats != NULL)
+      {
+         now = timing_now_ns() - start;
+         uint64_t late = now > record->time_ns ? now - record->time_ns : 0;
+         stats->records++;
+         stats->total_late_ns += late;
+         if(late > stats->max_late_ns)
+            stats->max_late_ns = late;
+      }
+      p = (const unsigned char*)entry;
+   }
+
+   return 0;
+}
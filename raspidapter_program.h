@@ -0,0 +1,130 @@
+//
+// Raspidapter Library Code
+//
+// motion program header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef RASPIDAPTER_PROGRAM_H
+#define RASPIDAPTER_PROGRAM_H
+
+#include "raspidapter_common.h"
+#include "dice_common.h"
+
+#include <stddef.h>
+
+// precompiled motion programs
+// A program file holds timestamped chain frames as word deltas. The player maps the
+// file and streams it through the chain without computing or allocating anything,
+// the pages are read from the page cache as the program plays.
+//
+// file layout (native byte order):
+//   struct PROGRAM_HEADER
+//   step masks: num_words words of the step bits the program drives, then num_words
+//               words of the step bits it toggles (TMC in double edge mode)
+//   records: struct PROGRAM_RECORD followed by count struct PROGRAM_ENTRY
+
+#define PROGRAM_MAGIC 0x47504452u      // "RDPG"
+#define PROGRAM_VERSION 2
+
+struct PROGRAM_HEADER
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t num_words;        // image words of the chain group the program is for
+   uint32_t numboards;
+   uint32_t numchains;
+   uint32_t reserved;
+   uint64_t num_records;
+   uint64_t duration_ns;      // time of the last record
+};
+
+// one frame - latched at time_ns after the start of the program
+struct PROGRAM_RECORD
+{
+   uint64_t time_ns;
+   uint32_t count;            // entries following the record
+   uint32_t reserved;
+};
+
+// change of one image word: set, then clear, then toggle bits
+struct PROGRAM_ENTRY
+{
+   uint32_t word;
+   uint32_t set;
+   uint32_t clr;
+   uint32_t toggle;
+};
+
+// events of a step schedule for the compiler
+#define PROGRAM_STEP 0
+#define PROGRAM_DIR 1
+#define PROGRAM_ENABLE 2
+
+struct PROGRAM_EVENT
+{
+   uint64_t time_ns;          // from the start of the program
+   struct DICE* dice;         // STK or TMC DICE
+   int type;
+   int value;                 // level for PROGRAM_DIR and PROGRAM_ENABLE
+};
+
+// a mapped program
+struct PROGRAM
+{
+   int fd;
+   const unsigned char* map;
+   size_t size;
+   const struct PROGRAM_HEADER* header;
+   const uint32_t* steps;     // the step masks of the file
+   const uint32_t* toggles;
+};
+
+struct PROGRAM_STATS
+{
+   uint64_t records;          // frames played
+   uint64_t max_late_ns;      // largest delay of a frame
+   uint64_t total_late_ns;
+};
+
+// compile a step schedule into a program file
+// chain - the chain group of all DICE of the events
+// window_ns - events this close to the first of a frame are merged into it, as long as
+//             every DICE appears only once in the frame - a second step, or a step after
+//             a direction change of the same DICE, starts the next frame
+// pulse_ns - time from a step to the frame dropping the step bits again
+//            TMC DICE in double edge mode toggle the step bit and need no second frame
+// The step mode of every DICE is recorded, program_play checks it.
+int program_compile(const char* filename, struct IOCHAIN* chain, const struct PROGRAM_EVENT* events, int n,
+                    unsigned int window_ns, unsigned int pulse_ns);
+
+// map a program file - only the header is read
+int program_open(struct PROGRAM* program, const char* filename);
+int program_close(struct PROGRAM* program);
+
+// play a program on a chain group - blocks until it is done
+// dice - the DICE stepped by the program, their step mode has to be the compiled one -
+//        a toggled step bit on a driver stepping on rising edges only loses every second step
+//        their tracks follow the step and dir bits as the frames are written
+// stats may be NULL
+// returns ERR_ESTOP if an emergency stop ended the program
+int program_play(const struct PROGRAM* program, struct IOCHAIN* chain, struct DICE** dice, int n,
+                 struct PROGRAM_STATS* stats);
+
+#endif
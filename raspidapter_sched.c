@@ -0,0 +1,462 @@
+//
+// Raspidapter library
+//
+// step scheduler implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "raspidapter_sched.h"
+#include "raspidapter_common.h"
+#include "raspidapter_timing.h"
+#include "raspidapter_estop.h"
+#include "dice_stk.h"
+#include "dice_tmc.h"
+#include "dice_motion.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STEPSCHED_EVENT_DIR 0
+#define STEPSCHED_EVENT_STEP 1
+
+// most chain groups one merged frame can touch
+#define STEPSCHED_MAX_FRAME_CHAINS IOCHAIN_MAX_CHAINS
+
+struct STEPSCHED_EVENT
+{
+   unsigned long long time;
+   unsigned long long seq;       // keeps events of the same time in queue order
+   struct DICE* dice;
+   int type;
+   int value;
+};
+
+static pthread_t stepsched_thread;
+static pthread_mutex_t stepsched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stepsched_cond = PTHREAD_COND_INITIALIZER;      // queue changed
+static pthread_cond_t stepsched_idle = PTHREAD_COND_INITIALIZER;      // queue ran empty
+
+static struct STEPSCHED_EVENT* stepsched_heap = 0;
+static struct STEPSCHED_EVENT* stepsched_batch = 0;
+static int stepsched_capacity = 0;
+static int stepsched_count = 0;
+static unsigned long long stepsched_seq = 0;
+static int stepsched_running = 0;
+static int stepsched_busy = 0;
+
+static unsigned int stepsched_spin_ns = STEPSCHED_SPIN_NS;
+static unsigned int stepsched_window_ns = STEPSCHED_WINDOW_NS;
+
+static struct STEPSCHED_STATS stepsched_stats;
+
+// heap order - earliest time first, directions before steps, then queue order
+static int stepsched_before(const struct STEPSCHED_EVENT* a,const struct STEPSCHED_EVENT* b)
+{
+   if(a->time != b->time)
+      return a->time < b->time;
+   if(a->type != b->type)
+      return a->type < b->type;
+   return a->seq < b->seq;
+}
+
+static void stepsched_push(const struct STEPSCHED_EVENT* ev)
+{
+   int i = stepsched_count++;
+   while(i > 0)
+   {
+      int parent = (i-1)/2;
+      if(!stepsched_before(ev,&stepsched_heap[parent]))
+         break;
+      stepsched_heap[i] = stepsched_heap[parent];
+      i = parent;
+   }
+   stepsched_heap[i] = *ev;
+}
+
+static void stepsched_pop(struct STEPSCHED_EVENT* ev)
+{
+   struct STEPSCHED_EVENT last;
+   int i = 0;
+
+   *ev = stepsched_heap[0];
+   last = stepsched_heap[--stepsched_count];
+   for(;;)
+   {
+      int child = 2*i+1;
+      if(child >= stepsched_count)
+         break;
+      if(child+1 < stepsched_count && stepsched_before(&stepsched_heap[child+1],&stepsched_heap[child]))
+         child++;
+      if(!stepsched_before(&stepsched_heap[child],&last))
+         break;
+      stepsched_heap[i] = stepsched_heap[child];
+      i = child;
+   }
+   stepsched_heap[i] = last;
+}
+
+static void stepsched_sleep_until(unsigned long long time_ns)
+{
+   struct timespec ts;
+   ts.tv_sec = time_ns / 1000000000ull;
+   ts.tv_nsec = time_ns % 1000000000ull;
+   clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0);
+}
+
+static void stepsched_emit(const struct STEPSCHED_EVENT* ev)
+{
+   if(ev->type == STEPSCHED_EVENT_DIR)
+   {
+      if(ev->dice->type == DICE_STK)
+         dice_stk_dir(ev->dice,ev->value);
+      else
+         dice_tmc_dir(ev->dice,ev->value);
+   }
+   else
+   {
+      dice_step(ev->dice);
+   }
+}
+
+// checks if an event can join the first n events of the batch - a DICE may appear only once,
+// a second step would latch together with the first and a direction change together with a step.
+// The batch also closes before it touches more chain groups than one frame can hold.
+static int stepsched_fits(const struct STEPSCHED_EVENT* ev, int n)
+{
+   struct IOCHAIN* chains[STEPSCHED_MAX_FRAME_CHAINS];
+   int numchains = 0;
+   int found = 0;
+   int i,j;
+
+   for(i=0; i < n; i++)
+   {
+      struct IOCHAIN* chain = stepsched_batch[i].dice->chain;
+      if(stepsched_batch[i].dice == ev->dice)
+         return 0;
+      if(chain == ev->dice->chain)
+         found = 1;
+      for(j=0; j < numchains; j++)
+      {
+         if(chains[j] == chain)
+            break;
+      }
+      if(j == numchains)
+         chains[numchains++] = chain;
+   }
+   return found || numchains < STEPSCHED_MAX_FRAME_CHAINS;
+}
+
+// emits a batch of due events - one transaction per chain group, so every group latches once
+static void stepsched_run_batch(int n)
+{
+   struct IOCHAIN* chains[STEPSCHED_MAX_FRAME_CHAINS];
+   int numchains = 0;
+   unsigned long long start = timing_now_ns();
+   unsigned long long frame;
+   int i,j;
+
+   for(i=0; i < n; i++)
+   {
+      struct IOCHAIN* chain = stepsched_batch[i].dice->chain;
+      for(j=0; j < numchains; j++)
+      {
+         if(chains[j] == chain)
+            break;
+      }
+      if(j == numchains)
+      {
+         iochain_ctx_begin(chain);
+         chains[numchains++] = chain;
+      }
+      stepsched_emit(&stepsched_batch[i]);
+   }
+   for(j=0; j < numchains; j++)
+   {
+      iochain_ctx_commit(chains[j]);
+   }
+
+   frame = timing_now_ns() - start;
+
+   pthread_mutex_lock(&stepsched_mutex);
+   stepsched_stats.frames++;
+   stepsched_stats.total_frame_ns += frame;
+   if(frame > stepsched_stats.max_frame_ns)
+      stepsched_stats.max_frame_ns = frame;
+   for(i=0; i < n; i++)
+   {
+      unsigned long long late = start > stepsched_batch[i].time ? start - stepsched_batch[i].time : 0;
+      stepsched_stats.events++;
+      stepsched_stats.total_late_ns += late;
+      if(late > stepsched_stats.max_late_ns)
+         stepsched_stats.max_late_ns = late;
+      if(late > stepsched_window_ns)
+         stepsched_stats.late++;
+   }
+   pthread_mutex_unlock(&stepsched_mutex);
+}
+
+static void* stepsched_main(void* arg)
+{
+   (void)arg;
+
+   pthread_mutex_lock(&stepsched_mutex);
+   while(stepsched_running)
+   {
+      unsigned long long due;
+      unsigned long long now;
+      int n;
+
+      if(stepsched_count == 0)
+      {
+         pthread_cond_broadcast(&stepsched_idle);
+         pthread_cond_wait(&stepsched_cond,&stepsched_mutex);
+         continue;
+      }
+
+      due = stepsched_heap[0].time;
+      now = timing_now_ns();
+
+      // sleep until the spin phase - in slices, so earlier events queued meanwhile are not missed
+      if(due > now + stepsched_spin_ns)
+      {
+         unsigned long long wake = due - stepsched_spin_ns;
+         if(wake > now + STEPSCHED_MAX_SLEEP_NS)
+            wake = now + STEPSCHED_MAX_SLEEP_NS;
+         pthread_mutex_unlock(&stepsched_mutex);
+         stepsched_sleep_until(wake);
+         pthread_mutex_lock(&stepsched_mutex);
+         continue;
+      }
+
+      // spin the rest without holding the lock
+      pthread_mutex_unlock(&stepsched_mutex);
+      while(timing_now_ns() < due)
+      {
+      }
+      pthread_mutex_lock(&stepsched_mutex);
+
+      // collect everything due within the merge window - the rest of the window goes into the next frame
+      n = 0;
+      while(stepsched_count > 0 && stepsched_heap[0].time <= due + stepsched_window_ns
+            && stepsched_fits(&stepsched_heap[0],n))
+      {
+         stepsched_pop(&stepsched_batch[n++]);
+      }
+      if(n == 0)
+         continue;
+
+      // an emergency stop drops everything queued
+      if(estop_active())
+      {
+         stepsched_stats.dropped += n + stepsched_count;
+         stepsched_count = 0;
+         continue;
+      }
+
+      stepsched_busy = 1;
+      pthread_mutex_unlock(&stepsched_mutex);
+      stepsched_run_batch(n);
+      pthread_mutex_lock(&stepsched_mutex);
+      stepsched_busy = 0;
+   }
+   pthread_cond_broadcast(&stepsched_idle);
+   pthread_mutex_unlock(&stepsched_mutex);
+
+   return 0;
+}
+
+int stepsched_start(int capacity, int priority)
+{
+   pthread_attr_t attr;
+   struct sched_param param;
+   int ret;
+
+   if(capacity <= 0)
+      return ERR_PARAM;
+   if(stepsched_running)
+      return ERR_INIT;
+
+   stepsched_heap = malloc(sizeof(struct STEPSCHED_EVENT)*capacity);
+   stepsched_batch = malloc(sizeof(struct STEPSCHED_EVENT)*capacity);
+   if(stepsched_heap == 0 || stepsched_batch == 0)
+   {
+      free(stepsched_heap);
+      free(stepsched_batch);
+      stepsched_heap = 0;
+      stepsched_batch = 0;
+      return ERR_INIT;
+   }
+   stepsched_capacity = capacity;
+   stepsched_count = 0;
+   stepsched_busy = 0;
+   memset(&stepsched_stats,0,sizeof(stepsched_stats));
+   stepsched_running = 1;
+
+   ret = -1;
+   if(priority > 0)
+   {
+      pthread_attr_init(&attr);
+      pthread_attr_setinheritsched(&attr,PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr,SCHED_FIFO);
+      param.sched_priority = priority;
+      pthread_attr_setschedparam(&attr,&param);
+      ret = pthread_create(&stepsched_thread,&attr,stepsched_main,0);
+      pthread_attr_destroy(&attr);
+      stepsched_stats.realtime = (ret == 0);
+   }
+   // no permission for realtime scheduling - run with normal priority
+   if(ret != 0)
+      ret = pthread_create(&stepsched_thread,0,stepsched_main,0);
+
+   if(ret != 0)
+   {
+      stepsched_running = 0;
+      free(stepsched_heap);
+      free(stepsched_batch);
+      stepsched_heap = 0;
+      stepsched_batch = 0;
+      return ERR_INIT;
+   }
+   return 0;
+}
+
+int stepsched_stop()
+{
+   if(!stepsched_running)
+      return ERR_INIT;
+
+   pthread_mutex_lock(&stepsched_mutex);
+   stepsched_running = 0;
+   stepsched_stats.dropped += stepsched_count;
+   stepsched_count = 0;
+   pthread_cond_broadcast(&stepsched_cond);
+   pthread_mutex_unlock(&stepsched_mutex);
+
+   pthread_join(stepsched_thread,0);
+
+   free(stepsched_heap);
+   free(stepsched_batch);
+   stepsched_heap = 0;
+   stepsched_batch = 0;
+   stepsched_capacity = 0;
+   return 0;
+}
+
+static int stepsched_queue(struct DICE* dice, int type, int value, unsigned long long time_ns)
+{
+   struct STEPSCHED_EVENT ev;
+
+   if(dice == 0 || (dice->type != DICE_STK && dice->type != DICE_TMC))
+      return ERR_PARAM;
+
+   pthread_mutex_lock(&stepsched_mutex);
+   if(!stepsched_running)
+   {
+      pthread_mutex_unlock(&stepsched_mutex);
+      return ERR_INIT;
+   }
+   if(estop_active())
+   {
+      stepsched_stats.dropped++;
+      pthread_mutex_unlock(&stepsched_mutex);
+      return ERR_ESTOP;
+   }
+   if(stepsched_count == stepsched_capacity)
+   {
+      stepsched_stats.dropped++;
+      pthread_mutex_unlock(&stepsched_mutex);
+      return ERR_PARAM;
+   }
+
+   ev.time = time_ns;
+   ev.seq = stepsched_seq++;
+   ev.dice = dice;
+   ev.type = type;
+   ev.value = value;
+   stepsched_push(&ev);
+
+   // wake the thread if the new event is the next one
+   if(stepsched_heap[0].seq == ev.seq)
+      pthread_cond_signal(&stepsched_cond);
+   pthread_mutex_unlock(&stepsched_mutex);
+   return 0;
+}
+
+int stepsched_step(struct DICE* dice, unsigned long long time_ns)
+{
+   return stepsched_queue(dice,STEPSCHED_EVENT_STEP,0,time_ns);
+}
+
+int stepsched_dir(struct DICE* dice, int dir, unsigned long long time_ns)
+{
+   return stepsched_queue(dice,STEPSCHED_EVENT_DIR,dir,time_ns);
+}
+
+int stepsched_set_timing(unsigned int spin_ns, unsigned int window_ns)
+{
+   pthread_mutex_lock(&stepsched_mutex);
+   stepsched_spin_ns = spin_ns;
+   stepsched_window_ns = window_ns;
+   pthread_mutex_unlock(&stepsched_mutex);
+   return 0;
+}
+
+int stepsched_pending()
+{
+   int n;
+   pthread_mutex_lock(&stepsched_mutex);
+   n = stepsched_count;
+   pthread_mutex_unlock(&stepsched_mutex);
+   return n;
+}
+
+int stepsched_wait_idle()
+{
+   pthread_mutex_lock(&stepsched_mutex);
+   while(stepsched_running && (stepsched_count > 0 || stepsched_busy))
+   {
+      pthread_cond_wait(&stepsched_idle,&stepsched_mutex);
+   }
+   pthread_mutex_unlock(&stepsched_mutex);
+   return 0;
+}
+
+int stepsched_get_stats(struct STEPSCHED_STATS* stats)
+{
+   if(stats == 0)
+      return ERR_PARAM;
+   pthread_mutex_lock(&stepsched_mutex);
+   *stats = stepsched_stats;
+   pthread_mutex_unlock(&stepsched_mutex);
+   return 0;
+}
+
+int stepsched_reset_stats()
+{
+   int realtime;
+   pthread_mutex_lock(&stepsched_mutex);
+   realtime = stepsched_stats.realtime;
+   memset(&stepsched_stats,0,sizeof(stepsched_stats));
+   stepsched_stats.realtime = realtime;
+   pthread_mutex_unlock(&stepsched_mutex);
+   return 0;
+}
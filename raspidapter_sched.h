@@ -0,0 +1,85 @@
+//
+// Raspidapter Library Code
+//
+// step scheduler header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef RASPIDAPTER_SCHED_H
+#define RASPIDAPTER_SCHED_H
+
+#include "dice_common.h"
+
+// The step scheduler emits time stamped step and direction events of STK and TMC
+// DICE from its own thread. It sleeps with clock_nanosleep until shortly before an event
+// is due and spins for the rest. Events due within the merge window are emitted
+// in one chain transaction, as long as every DICE appears only once in it - a second step
+// of the same DICE, or a step after its direction change, goes into the next frame.
+// While the scheduler runs, other threads should not access the io chains it uses.
+// A page fault in the step thread costs more than any spin - realtime applications
+// should lock their memory with mlockall before starting the scheduler.
+
+// defaults
+#define STEPSCHED_SPIN_NS 50000       // spin for the last 50us before an event
+#define STEPSCHED_WINDOW_NS 2000      // merge events due within 2us
+#define STEPSCHED_MAX_SLEEP_NS 1000000 // recheck the queue at least every ms while sleeping
+
+// achieved versus requested timing - the delay of an event is measured when its frame starts
+struct STEPSCHED_STATS
+{
+   unsigned long long events;          // events emitted
+   unsigned long long frames;          // chain transactions - events/frames is the merge rate
+   unsigned long long late;            // events emitted later than the merge window
+   unsigned long long dropped;         // events rejected because the queue was full or dropped by an emergency stop
+   unsigned long long max_late_ns;     // largest delay of an event
+   unsigned long long total_late_ns;   // sum of all delays, total_late_ns/events is the mean
+   unsigned long long max_frame_ns;    // longest chain update
+   unsigned long long total_frame_ns;  // sum of all chain updates - close to the run time means the chain is saturated
+   int realtime;                       // 1 if the thread got the requested realtime priority
+};
+
+// start the scheduler thread
+// capacity - number of events the queue can hold
+// priority - SCHED_FIFO priority of the thread, 0 for normal scheduling
+int stepsched_start(int capacity, int priority);
+
+// stop the scheduler thread - pending events are dropped
+int stepsched_stop();
+
+// queue a step of a STK or TMC DICE at a CLOCK_MONOTONIC time (see timing_now_ns)
+// returns ERR_ESTOP while an emergency stop is active, the queue drops its events then
+int stepsched_step(struct DICE* dice, unsigned long long time_ns);
+
+// queue a direction change - emitted before steps due at the same time, ERR_ESTOP like a step
+int stepsched_dir(struct DICE* dice, int dir, unsigned long long time_ns);
+
+// set how long the thread spins before an event and how close events get merged
+int stepsched_set_timing(unsigned int spin_ns, unsigned int window_ns);
+
+// number of queued events
+int stepsched_pending();
+
+// block until the queue is empty
+int stepsched_wait_idle();
+
+// get and reset the timing statistics
+int stepsched_get_stats(struct STEPSCHED_STATS* stats);
+int stepsched_reset_stats();
+
+#endif
@@ -0,0 +1,920 @@
+//
+// Raspidapter library
+//
+// simulator backend implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+
+#include "raspidapter_common.h"
+#include "raspidapter_backend.h"
+#include "raspidapter_sim.h"
+#include "raspidapter_wave.h"
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+// longest simulated chain line in bits - 64 boards
+#define SIM_LINE_BITS 2048
+#define SIM_MAX_DEVICES 64
+
+// i2c address ranges of the expanders
+#define SIM_9555_BASE 0x20
+#define SIM_VN_BASE 0x70
+
+#define SIM_TC 1
+#define SIM_TMC 2
+
+// stand still flag after 2^20 clocks at 16MHz without step
+#define SIM_TMC_STANDSTILL_NS 65536000ull
+
+// one shift register line behind a data pin
+struct SIM_LINE
+{
+   unsigned char bits[SIM_LINE_BITS];      // ring buffer, head is the bit shifted in last
+   int head;
+   unsigned char latched[SIM_LINE_BITS];   // latched outputs, position 0 is the first register
+};
+
+// a spi device selected by a chain bit
+struct SIM_DEVICE
+{
+   int type;
+   const struct IOCHAIN* chain;
+   int board;
+   int slot;
+   int cs;
+   int step;
+   int dir;
+
+   int selected;
+   int last_step;
+   int byte;                     // bytes transferred since the cs went low
+   unsigned long out;            // bits sent on miso in this transfer
+   unsigned long in;             // bits received on mosi in this transfer
+
+   // MAX31855
+   double celsius[3];
+   double internal[3];
+   int fault[3];
+
+   // TMC262
+   unsigned long regs[5];
+   unsigned long datagrams;
+   int stallguard;
+   int flags;
+   int position;
+   unsigned long long last_step_ns;
+};
+
+// i2c expander registers
+struct SIM_EXPANDER
+{
+   unsigned int regs[4];
+   unsigned int input;
+   int pointer;
+};
+
+struct SIM_LINE sim_lines[32];
+uint32_t sim_level =0;
+uint32_t sim_clock_lines[32];     // data pins shifted by a clock pin
+uint32_t sim_strobe_lines[32];    // data pins latched by a strobe pin
+
+struct SIM_DEVICE sim_devices[SIM_MAX_DEVICES];
+int sim_num_devices =0;
+
+struct SIM_EXPANDER sim_9555[8];
+struct SIM_EXPANDER sim_vn[4];
+
+unsigned long long sim_time =0;
+unsigned int sim_gpio_write_cost = SIM_GPIO_WRITE_NS;
+unsigned int sim_spi_divider =0;
+unsigned int sim_i2c_baud = SIM_I2C_BAUDRATE;
+struct SIM_STATS sim_stats;
+void (*sim_clock_hook)(void* arg) = 0;
+void* sim_clock_hook_arg = 0;
+
+// the scheduler, sampler and stop threads drive the simulator together
+// One lock for all state; the internal helpers expect it to be held.
+// Not async signal safe - trigger an emergency stop from a thread in simulations.
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////
+//  virtual clock and state
+////////////////////////////////////////////
+
+static void sim_reset_state()
+{
+   int i;
+
+   memset(sim_lines,0,sizeof(sim_lines));
+   memset(sim_clock_lines,0,sizeof(sim_clock_lines));
+   memset(sim_strobe_lines,0,sizeof(sim_strobe_lines));
+   memset(sim_devices,0,sizeof(sim_devices));
+   memset(&sim_stats,0,sizeof(sim_stats));
+   sim_num_devices = 0;
+   sim_level = 0;
+   sim_time = 0;
+   sim_clock_hook = 0;
+   sim_clock_hook_arg = 0;
+   sim_spi_divider = 0;
+   sim_i2c_baud = SIM_I2C_BAUDRATE;
+
+   //power on values: all pins input, outputs high
+   for(i=0; i < 8; i++)
+   {
+      memset(&sim_9555[i],0,sizeof(struct SIM_EXPANDER));
+      sim_9555[i].regs[1] = 0xffff;
+      sim_9555[i].regs[3] = 0xffff;
+   }
+   for(i=0; i < 4; i++)
+   {
+      memset(&sim_vn[i],0,sizeof(struct SIM_EXPANDER));
+      sim_vn[i].regs[1] = 0xff;
+      sim_vn[i].regs[3] = 0xff;
+   }
+}
+
+void sim_reset()
+{
+   pthread_mutex_lock(&sim_mutex);
+   sim_reset_state();
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+unsigned long long sim_now_ns()
+{
+   unsigned long long t;
+   pthread_mutex_lock(&sim_mutex);
+   t = sim_time;
+   pthread_mutex_unlock(&sim_mutex);
+   return t;
+}
+
+void sim_advance_ns(unsigned long long ns)
+{
+   pthread_mutex_lock(&sim_mutex);
+   sim_time += ns;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+void sim_set_clock_hook(void (*hook)(void* arg), void* arg)
+{
+   pthread_mutex_lock(&sim_mutex);
+   sim_clock_hook = hook;
+   sim_clock_hook_arg = arg;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+void sim_set_gpio_write_ns(unsigned int ns)
+{
+   pthread_mutex_lock(&sim_mutex);
+   sim_gpio_write_cost = ns;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+void sim_get_stats(struct SIM_STATS* stats)
+{
+   if(stats == NULL)
+      return;
+   pthread_mutex_lock(&sim_mutex);
+   *stats = sim_stats;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+int sim_gpio(int pin)
+{
+   int level;
+   if(pin < 0 || pin > 31)
+      return 0;
+   pthread_mutex_lock(&sim_mutex);
+   level = (sim_level >> pin) & 1;
+   pthread_mutex_unlock(&sim_mutex);
+   return level;
+}
+
+////////////////////////////////////////////
+//  chains and devices on the chains
+////////////////////////////////////////////
+
+//
+// data pin and position of a chain bit
+//
+static int sim_locate(const struct IOCHAIN* chain, int bit, int* pos)
+{
+   if(chain == NULL || bit < 0 || bit >= chain->num_io)
+      return -1;
+
+   int line = bit / chain->chain_bits;
+   *pos = bit % chain->chain_bits;
+   return __builtin_ctz(chain->data_mask[line]);
+}
+
+static int sim_latched(const struct IOCHAIN* chain, int bit)
+{
+   int pos;
+   int pin = sim_locate(chain,bit,&pos);
+   if(pin < 0 || pos >= SIM_LINE_BITS)
+      return 0;
+   return sim_lines[pin].latched[pos];
+}
+
+int sim_output(const struct IOCHAIN* chain, int bit)
+{
+   int level;
+   pthread_mutex_lock(&sim_mutex);
+   level = sim_latched(chain,bit);
+   pthread_mutex_unlock(&sim_mutex);
+   return level;
+}
+
+static struct SIM_DEVICE* sim_find(const struct IOCHAIN* chain, int board, int slot, int type)
+{
+   int i;
+   for(i=0; i < sim_num_devices; i++)
+   {
+      struct SIM_DEVICE* dev = &sim_devices[i];
+      if(dev->chain == chain && dev->board == board && dev->slot == slot && dev->type == type)
+         return dev;
+   }
+   return NULL;
+}
+
+static struct SIM_DEVICE* sim_add(const struct IOCHAIN* chain, int board, int slot, int type)
+{
+   struct IOCHAIN* c = (struct IOCHAIN*)chain;
+   struct SIM_DEVICE* dev;
+
+   if(sim_num_devices >= SIM_MAX_DEVICES || iochain_bit(c,board,slot,0) < 0)
+      return NULL;
+
+   dev = &sim_devices[sim_num_devices++];
+   memset(dev,0,sizeof(struct SIM_DEVICE));
+   dev->type = type;
+   dev->chain = chain;
+   dev->board = board;
+   dev->slot = slot;
+   dev->cs = iochain_bit(c,board,slot,0);
+   dev->dir = iochain_bit(c,board,slot,3);
+   dev->step = iochain_bit(c,board,slot,6);
+   //cs lines are pulled up
+   dev->selected = 0;
+   return dev;
+}
+
+int sim_add_tc(const struct IOCHAIN* chain, int board, int slot)
+{
+   struct SIM_DEVICE* dev;
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_add(chain,board,slot,SIM_TC);
+   pthread_mutex_unlock(&sim_mutex);
+   return dev ? 0 : ERR_PARAM;
+}
+
+int sim_tc_set(const struct IOCHAIN* chain, int board, int slot, int chipnum, double celsius, double internal, int fault)
+{
+   struct SIM_DEVICE* dev;
+   int ret = ERR_PARAM;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_find(chain,board,slot,SIM_TC);
+   if(dev != NULL && chipnum >= 1 && chipnum <= 3)
+   {
+      dev->celsius[chipnum-1] = celsius;
+      dev->internal[chipnum-1] = internal;
+      dev->fault[chipnum-1] = fault & 0x7;
+      ret = 0;
+   }
+   pthread_mutex_unlock(&sim_mutex);
+   return ret;
+}
+
+int sim_add_tmc(const struct IOCHAIN* chain, int board, int slot)
+{
+   struct SIM_DEVICE* dev;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_add(chain,board,slot,SIM_TMC);
+   if(dev != NULL)
+   {
+      //power on reset: every register 0 - 256 microsteps, RDSEL 0 reads out the position
+      dev->regs[4] = 0xE0000;
+      dev->stallguard = 512;
+   }
+   pthread_mutex_unlock(&sim_mutex);
+   return dev ? 0 : ERR_PARAM;
+}
+
+int sim_tmc_set_status(const struct IOCHAIN* chain, int board, int slot, int stallguard, int flags)
+{
+   struct SIM_DEVICE* dev;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_find(chain,board,slot,SIM_TMC);
+   if(dev != NULL)
+   {
+      dev->stallguard = stallguard & 0x3ff;
+      dev->flags = flags & 0xfe;
+   }
+   pthread_mutex_unlock(&sim_mutex);
+   return dev ? 0 : ERR_PARAM;
+}
+
+unsigned long sim_tmc_register(const struct IOCHAIN* chain, int board, int slot, int reg)
+{
+   struct SIM_DEVICE* dev;
+   unsigned long value = 0;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_find(chain,board,slot,SIM_TMC);
+   if(dev != NULL && reg >= 0 && reg <= 4)
+      value = dev->regs[reg];
+   pthread_mutex_unlock(&sim_mutex);
+   return value;
+}
+
+unsigned long sim_tmc_datagrams(const struct IOCHAIN* chain, int board, int slot)
+{
+   struct SIM_DEVICE* dev;
+   unsigned long n;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_find(chain,board,slot,SIM_TMC);
+   n = dev ? dev->datagrams : 0;
+   pthread_mutex_unlock(&sim_mutex);
+   return n;
+}
+
+int sim_tmc_position(const struct IOCHAIN* chain, int board, int slot)
+{
+   struct SIM_DEVICE* dev;
+   int position;
+
+   pthread_mutex_lock(&sim_mutex);
+   dev = sim_find(chain,board,slot,SIM_TMC);
+   position = dev ? dev->position : 0;
+   pthread_mutex_unlock(&sim_mutex);
+   return position;
+}
+
+//
+// the 20 bit status word of a TMC262 for the selected readout
+//
+static unsigned long sim_tmc_status(struct SIM_DEVICE* dev)
+{
+   unsigned long value;
+   unsigned long flags = dev->flags;
+
+   switch((dev->regs[4] >> 4) & 0x3)
+   {
+      case 0:
+         value = dev->position;
+         break;
+      case 1:
+         value = dev->stallguard;
+         break;
+      default:
+         value = (dev->stallguard & 0x3e0) | (dev->regs[3] & 0x1f);
+         break;
+   }
+
+   if(dev->stallguard == 0)
+      flags |= 0x1;
+   if(sim_time - dev->last_step_ns > SIM_TMC_STANDSTILL_NS)
+      flags |= 0x80;
+
+   return ((value & 0x3ff) << 10) | flags;
+}
+
+//
+// the 32 bit frame of the muxed MAX31855 subchip
+//
+static unsigned long sim_tc_frame(struct SIM_DEVICE* dev)
+{
+   int chip = 0;
+   unsigned long frame;
+
+   if(sim_latched(dev->chain,dev->step))
+      chip = 1;
+   else if(sim_latched(dev->chain,dev->dir))
+      chip = 2;
+
+   long tc = lround(dev->celsius[chip]*4.0);
+   long internal = lround(dev->internal[chip]*16.0);
+
+   frame = ((unsigned long)tc & 0x3fff) << 18;
+   frame |= ((unsigned long)internal & 0xfff) << 4;
+   frame |= dev->fault[chip];
+   if(dev->fault[chip])
+      frame |= 1ul << 16;
+   return frame;
+}
+
+//
+// a TMC262 datagram is taken over with the rising cs edge
+//
+static void sim_tmc_datagram(struct SIM_DEVICE* dev)
+{
+   unsigned long datagram = dev->in & 0xfffff;
+
+   if(dev->byte == 0)
+      return;
+
+   dev->datagrams++;
+   if(!(datagram & 0x80000))
+      dev->regs[0] = datagram;
+   else
+      dev->regs[1 + ((datagram >> 17) & 0x3)] = datagram;
+}
+
+//
+// check the chip selects and step inputs after a latch
+//
+static void sim_devices_latched()
+{
+   int i;
+   for(i=0; i < sim_num_devices; i++)
+   {
+      struct SIM_DEVICE* dev = &sim_devices[i];
+      int selected = !sim_latched(dev->chain,dev->cs);
+
+      if(selected && !dev->selected)
+      {
+         //falling cs edge: start a new transfer
+         dev->byte = 0;
+         dev->in = 0;
+         if(dev->type == SIM_TC)
+            dev->out = sim_tc_frame(dev);
+         else
+            dev->out = sim_tmc_status(dev) << 4;
+      }
+      else if(!selected && dev->selected && dev->type == SIM_TMC)
+      {
+         sim_tmc_datagram(dev);
+      }
+      dev->selected = selected;
+
+      if(dev->type == SIM_TMC)
+      {
+         int step = sim_latched(dev->chain,dev->step);
+         int dedge = (dev->regs[0] & 0x100) != 0;
+         if(step != dev->last_step && (step || dedge))
+         {
+            int inc = 1 << (dev->regs[0] & 0xf);
+            if(inc > 256)
+               inc = 256;
+            dev->position = (dev->position + (sim_latched(dev->chain,dev->dir) ? inc : -inc)) & 0x3ff;
+            dev->last_step_ns = sim_time;
+         }
+         dev->last_step = step;
+      }
+   }
+}
+
+////////////////////////////////////////////
+//  gpio
+////////////////////////////////////////////
+
+static void sim_set(uint32_t mask)
+{
+   uint32_t rising = mask & ~sim_level;
+   int pin;
+
+   sim_stats.gpio_writes++;
+   sim_time += sim_gpio_write_cost;
+   sim_level |= mask;
+
+   for(pin=0; rising; pin++, rising >>= 1)
+   {
+      uint32_t lines;
+      int line;
+
+      if(!(rising & 1))
+         continue;
+
+      //clock: shift the data into every line
+      lines = sim_clock_lines[pin];
+      for(line=0; lines; line++, lines >>= 1)
+      {
+         if(lines & 1)
+         {
+            struct SIM_LINE* l = &sim_lines[line];
+            l->head = (l->head + 1) % SIM_LINE_BITS;
+            l->bits[l->head] = (sim_level >> line) & 1;
+         }
+      }
+
+      //strobe: latch every line
+      lines = sim_strobe_lines[pin];
+      if(lines)
+      {
+         for(line=0; lines; line++, lines >>= 1)
+         {
+            if(lines & 1)
+            {
+               struct SIM_LINE* l = &sim_lines[line];
+               int p;
+               for(p=0; p < SIM_LINE_BITS; p++)
+                  l->latched[p] = l->bits[(l->head - p + SIM_LINE_BITS) % SIM_LINE_BITS];
+            }
+         }
+         sim_stats.frames++;
+         sim_stats.strobe_ns = sim_time;
+         sim_devices_latched();
+      }
+   }
+}
+
+static void sim_clr(uint32_t mask)
+{
+   sim_stats.gpio_writes++;
+   sim_time += sim_gpio_write_cost;
+   sim_level &= ~mask;
+}
+
+////////////////////////////////////////////
+//  i2c
+////////////////////////////////////////////
+
+static struct SIM_EXPANDER* sim_expander(int address, int* wide)
+{
+   if(address >= SIM_9555_BASE && address < SIM_9555_BASE + 8)
+   {
+      *wide = 1;
+      return &sim_9555[address - SIM_9555_BASE];
+   }
+   if(address >= SIM_VN_BASE && address < SIM_VN_BASE + 4)
+   {
+      *wide = 0;
+      return &sim_vn[address - SIM_VN_BASE];
+   }
+   return NULL;
+}
+
+//
+// the input register shows the outputs on output pins and the external levels on input pins
+//
+static unsigned int sim_expander_input(struct SIM_EXPANDER* exp)
+{
+   unsigned int config = exp->regs[3];
+   return ((exp->regs[1] & ~config) | (exp->input & config)) ^ (exp->regs[2] & config);
+}
+
+static void sim_i2c_charge(int len)
+{
+   //address byte plus data, 9 bits each, plus start and stop
+   sim_stats.i2c_transfers++;
+   sim_stats.i2c_bytes += len;
+   sim_time += ((unsigned long long)(len + 1)*9 + 2)*1000000000ull / sim_i2c_baud;
+}
+
+void sim_i2c_set_input(int address, unsigned int value)
+{
+   int wide;
+   struct SIM_EXPANDER* exp;
+
+   pthread_mutex_lock(&sim_mutex);
+   exp = sim_expander(address,&wide);
+   if(exp != NULL)
+      exp->input = value & (wide ? 0xffff : 0xff);
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+unsigned int sim_i2c_register(int address, int reg)
+{
+   int wide;
+   struct SIM_EXPANDER* exp;
+   unsigned int value = 0;
+
+   pthread_mutex_lock(&sim_mutex);
+   exp = sim_expander(address,&wide);
+   if(exp != NULL && reg == 0)
+      value = sim_expander_input(exp);
+   else if(exp != NULL && reg > 0 && reg <= 3)
+      value = exp->regs[reg];
+   pthread_mutex_unlock(&sim_mutex);
+   return value;
+}
+
+////////////////////////////////////////////
+//  backend functions
+////////////////////////////////////////////
+
+int sim_backend_init()
+{
+   sim_reset();
+   return 0;
+}
+
+int sim_backend_close()
+{
+   return 0;
+}
+
+void sim_backend_gpio_output(int pin)
+{
+   (void)pin;
+}
+
+void sim_backend_gpio_write(int pin, int level)
+{
+   if(pin < 0 || pin > 31)
+      return;
+   pthread_mutex_lock(&sim_mutex);
+   if(level)
+      sim_set(1u << pin);
+   else
+      sim_clr(1u << pin);
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+unsigned int sim_backend_gpio_write_ns()
+{
+   return sim_gpio_write_cost;
+}
+
+void sim_backend_iochain_attach(const struct IOCHAIN* chain)
+{
+   int clock = __builtin_ctz(chain->clock_mask);
+   int strobe = __builtin_ctz(chain->strobe_mask);
+
+   pthread_mutex_lock(&sim_mutex);
+   sim_clock_lines[clock] |= chain->data_all;
+   sim_strobe_lines[strobe] |= chain->data_all;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+static unsigned int sim_wait(unsigned int ns)
+{
+   return ns > sim_gpio_write_cost ? ns - sim_gpio_write_cost : 0;
+}
+
+int sim_backend_iochain_play(const struct IOCHAIN* chain, const struct IOCHAIN_OP* frame, unsigned int generation)
+{
+   const struct IOCHAIN_OP* op = frame;
+   const struct IOCHAIN_OP* end = frame + chain->chain_bits;
+   const struct IOCHAIN_TIMING* t = &chain->timing;
+   unsigned int high = t->clock_high_ns > t->hold_ns ? t->clock_high_ns : t->hold_ns;
+
+   //locked bit by bit - chains on other pins interleave like on the gpio block
+   for(; op != end; op++)
+   {
+      void (*hook)(void*);
+      void* arg;
+
+      if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+         return 1;
+      pthread_mutex_lock(&sim_mutex);
+      if(op->set)
+         sim_set(op->set);
+      sim_time += sim_wait(t->setup_ns);
+      sim_set(chain->clock_mask);
+      sim_time += sim_wait(high);
+      sim_clr(op->clr);
+      sim_time += sim_wait(t->clock_low_ns);
+      hook = sim_clock_hook;
+      arg = sim_clock_hook_arg;
+      pthread_mutex_unlock(&sim_mutex);
+
+      if(hook)
+         hook(arg);
+   }
+
+   if(__atomic_load_n(&chain->generation,__ATOMIC_ACQUIRE) != generation)
+      return 1;
+
+   pthread_mutex_lock(&sim_mutex);
+   sim_set(chain->strobe_mask);
+   sim_time += sim_wait(t->strobe_ns);
+   sim_clr(chain->strobe_mask);
+   pthread_mutex_unlock(&sim_mutex);
+   return 0;
+}
+
+//
+// play a waveform like the dma engine - done when the call returns
+//
+int sim_backend_wave_play(const struct WAVE* wave)
+{
+   int i;
+
+   pthread_mutex_lock(&sim_mutex);
+   for(i=0; i < wave->count; i++)
+   {
+      const struct WAVE_CB* cb = &wave->cb[i];
+      if(cb->kind == WAVE_SET)
+         sim_set(cb->value);
+      else if(cb->kind == WAVE_CLR)
+         sim_clr(cb->value);
+      else
+         sim_time += (unsigned long long)cb->value*wave->tick_ns;
+   }
+   pthread_mutex_unlock(&sim_mutex);
+   return 0;
+}
+
+int sim_backend_wave_busy()
+{
+   return 0;
+}
+
+void sim_backend_wave_stop()
+{
+}
+
+int sim_backend_i2c_begin()
+{
+   return 0;
+}
+
+void sim_backend_i2c_end()
+{
+}
+
+void sim_backend_i2c_set_baudrate(unsigned int baudrate)
+{
+   pthread_mutex_lock(&sim_mutex);
+   if(baudrate > 0)
+      sim_i2c_baud = baudrate;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+static int sim_i2c_write(int address, const char* data, int len)
+{
+   int wide;
+   int i;
+   struct SIM_EXPANDER* exp = sim_expander(address,&wide);
+
+   sim_i2c_charge(len);
+   if(exp == NULL || len < 1)
+      return ERR_I2C;
+
+   //first byte is the register pointer
+   exp->pointer = data[0] & (wide ? 0x7 : 0x3);
+   for(i=1; i < len; i++)
+   {
+      int reg = wide ? exp->pointer >> 1 : exp->pointer;
+      unsigned char value = data[i];
+
+      if(wide)
+      {
+         int shift = (exp->pointer & 1) * 8;
+         if(reg != 0)
+            exp->regs[reg] = (exp->regs[reg] & ~(0xffu << shift)) | ((unsigned int)value << shift);
+         //the 9555 toggles within a register pair
+         exp->pointer ^= 1;
+      }
+      else if(reg != 0)
+      {
+         exp->regs[reg] = value;
+      }
+   }
+   return 0;
+}
+
+int sim_backend_i2c_write(int address, const char* data, int len)
+{
+   int ret;
+   pthread_mutex_lock(&sim_mutex);
+   ret = sim_i2c_write(address,data,len);
+   pthread_mutex_unlock(&sim_mutex);
+   return ret;
+}
+
+static int sim_i2c_read(int address, char* data, int len)
+{
+   int wide;
+   int i;
+   struct SIM_EXPANDER* exp = sim_expander(address,&wide);
+
+   sim_i2c_charge(len);
+   if(exp == NULL)
+      return ERR_I2C;
+
+   for(i=0; i < len; i++)
+   {
+      int reg = wide ? exp->pointer >> 1 : exp->pointer;
+      unsigned int value = reg == 0 ? sim_expander_input(exp) : exp->regs[reg];
+
+      if(wide)
+      {
+         data[i] = (value >> ((exp->pointer & 1) * 8)) & 0xff;
+         exp->pointer ^= 1;
+      }
+      else
+      {
+         data[i] = value & 0xff;
+      }
+   }
+   return 0;
+}
+
+int sim_backend_i2c_read(int address, char* data, int len)
+{
+   int ret;
+   pthread_mutex_lock(&sim_mutex);
+   ret = sim_i2c_read(address,data,len);
+   pthread_mutex_unlock(&sim_mutex);
+   return ret;
+}
+
+int sim_backend_spi_begin()
+{
+   return 0;
+}
+
+void sim_backend_spi_end()
+{
+}
+
+void sim_backend_spi_configure(int mode, int bitorder, int divider)
+{
+   //the devices of the model do not check the mode
+   (void)mode;
+   (void)bitorder;
+
+   pthread_mutex_lock(&sim_mutex);
+   sim_spi_divider = divider;
+   sim_stats.spi_configures++;
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+void sim_backend_spi_transfer(const unsigned char* tx, unsigned char* rx, int len)
+{
+   unsigned long long divider;
+   int i, d;
+
+   pthread_mutex_lock(&sim_mutex);
+   divider = sim_spi_divider ? sim_spi_divider : 65536;
+   sim_stats.spi_transfers++;
+   sim_stats.spi_bytes += len;
+   sim_time += SIM_SPI_TRANSFER_NS + (unsigned long long)len*8*divider*1000000000ull/SIM_SPI_CORE_HZ;
+
+   for(i=0; i < len; i++)
+   {
+      //miso is pulled up, several selected devices pull it down together
+      unsigned char miso = 0xff;
+      unsigned char mosi = tx[i];
+      int any = 0;
+
+      for(d=0; d < sim_num_devices; d++)
+      {
+         struct SIM_DEVICE* dev = &sim_devices[d];
+         unsigned char out;
+         if(!dev->selected)
+            continue;
+
+         if(dev->type == SIM_TC)
+            out = dev->byte < 4 ? (dev->out >> (24 - 8*dev->byte)) & 0xff : 0;
+         else
+            out = dev->byte < 3 ? (dev->out >> (16 - 8*dev->byte)) & 0xff : 0;
+         dev->in = (dev->in << 8) | mosi;
+         dev->byte++;
+         miso &= out;
+         any = 1;
+      }
+      rx[i] = any ? miso : 0;
+   }
+   pthread_mutex_unlock(&sim_mutex);
+}
+
+const struct RASPIDAPTER_BACKEND backend_sim =
+{
+   "sim",
+   sim_backend_init,
+   sim_backend_close,
+   sim_backend_gpio_output,
+   sim_backend_gpio_write,
+   sim_backend_gpio_write_ns,
+   sim_backend_iochain_attach,
+   sim_backend_iochain_play,
+   sim_backend_i2c_begin,
+   sim_backend_i2c_end,
+   sim_backend_i2c_set_baudrate,
+   sim_backend_i2c_write,
+   sim_backend_i2c_read,
+   sim_backend_spi_begin,
+   sim_backend_spi_end,
+   sim_backend_spi_configure,
+   sim_backend_spi_transfer,
+   sim_backend_wave_play,
+   sim_backend_wave_busy,
+   sim_backend_wave_stop
+};
@@ -0,0 +1,110 @@
+//
+// Raspidapter Library Code
+//
+// simulator header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef RASPIDAPTER_SIM_H
+#define RASPIDAPTER_SIM_H
+
+#include "raspidapter_common.h"
+
+// the simulator backend models the shift register chains, the i2c expanders of the
+// DICE-9555 and DICE-VN, the MAX31855 of the DICE-TC and the TMC262 of the DICE-TMC.
+// Select it with raspidapter_set_backend(&backend_sim) before setup_raspidapter.
+// setup_raspidapter resets the simulator, so add the devices afterwards.
+
+// default costs charged to the virtual clock
+#define SIM_GPIO_WRITE_NS 25
+#define SIM_SPI_CORE_HZ 250000000u
+#define SIM_SPI_TRANSFER_NS 1000
+#define SIM_I2C_BAUDRATE 100000u
+
+// counters of the simulated bus traffic
+struct SIM_STATS
+{
+   unsigned long long gpio_writes;
+   unsigned long long frames;         // strobes of any chain
+   unsigned long long strobe_ns;      // virtual time of the last strobe
+   unsigned long long spi_transfers;
+   unsigned long long spi_bytes;
+   unsigned long long spi_configures;  // the spi controller programmed
+   unsigned long long i2c_transfers;
+   unsigned long long i2c_bytes;
+};
+
+// clear all devices, levels, counters and the virtual clock
+void sim_reset();
+
+// virtual time in ns - every simulated bus access is charged to it
+unsigned long long sim_now_ns();
+
+// let the virtual time pass, eg for waits of the caller
+void sim_advance_ns(unsigned long long ns);
+
+// change the cost of one gpio write
+void sim_set_gpio_write_ns(unsigned int ns);
+
+// get the bus counters
+void sim_get_stats(struct SIM_STATS* stats);
+
+// call hook(arg) after every clock cycle of the bit-bang player, NULL to remove it
+// The hook runs in the shifting thread outside the simulator lock, like an interrupt
+// between two bits - eg to trigger an emergency stop in the middle of a frame.
+void sim_set_clock_hook(void (*hook)(void* arg), void* arg);
+
+// level of a gpio pin
+int sim_gpio(int pin);
+
+// latched output of a bit of a chain group
+int sim_output(const struct IOCHAIN* chain, int bit);
+
+// add a DICE-TC in a slot - returns 0 or ERR_PARAM
+int sim_add_tc(const struct IOCHAIN* chain, int board, int slot);
+
+// set the values a MAX31855 subchip (1-3) of a DICE-TC reports
+// fault - the fault bits 0-2 of the MAX31855
+int sim_tc_set(const struct IOCHAIN* chain, int board, int slot, int chipnum, double celsius, double internal, int fault);
+
+// add a DICE-TMC in a slot - returns 0 or ERR_PARAM
+int sim_add_tmc(const struct IOCHAIN* chain, int board, int slot);
+
+// set the StallGuard reading (0-1023) and the status flags (bits 1-7 of the status) of a TMC262
+// The StallGuard flag is set by the simulator while the reading is 0.
+int sim_tmc_set_status(const struct IOCHAIN* chain, int board, int slot, int stallguard, int flags);
+
+// last value written to a TMC262 register
+// reg - 0 DRVCTRL, 1 CHOPCONF, 2 SMARTEN, 3 SGCSCONF, 4 DRVCONF
+unsigned long sim_tmc_register(const struct IOCHAIN* chain, int board, int slot, int reg);
+
+// number of datagrams a TMC262 received
+unsigned long sim_tmc_datagrams(const struct IOCHAIN* chain, int board, int slot);
+
+// microstep table position (0-1023) of a TMC262 - moved by the latched step and dir bits
+int sim_tmc_position(const struct IOCHAIN* chain, int board, int slot);
+
+// set the external levels of the input pins of an i2c expander
+void sim_i2c_set_input(int address, unsigned int value);
+
+// register of an i2c expander - 16 bit for the 9555, 8 bit for the DICE-VN expander
+// reg - 0 input, 1 output, 2 polarity, 3 config
+unsigned int sim_i2c_register(int address, int reg);
+
+#endif
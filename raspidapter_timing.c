@@ -0,0 +1,120 @@
+//
+// Raspidapter library
+//
+// timing implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "raspidapter_timing.h"
+
+#include <time.h>
+
+#define CALIBRATION_LOOPS 100000
+#define CALIBRATION_RUNS 5
+#define WARMUP_NS 20000000ull
+
+// the loop counter is volatile so the compiler can not drop the loop
+volatile unsigned int timing_sink =0;
+
+// cost of one delay loop in 1/1000 ns - safe guess until calibrated
+unsigned int timing_loop_cost = 10000;
+
+unsigned long long timing_now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return (unsigned long long)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+void timing_spin(unsigned int loops)
+{
+   while(loops--)
+   {
+      timing_sink++;
+   }
+}
+
+int timing_calibrate()
+{
+   unsigned long long start;
+   unsigned long long best = 0;
+   int i;
+
+   //warm up, so we do not measure the cpu in a low clock state
+   start = timing_now_ns();
+   while(timing_now_ns() - start < WARMUP_NS)
+   {
+      timing_spin(1000);
+   }
+
+   //take the fastest run - the slower ones got interrupted
+   for(i=0; i < CALIBRATION_RUNS; i++)
+   {
+      start = timing_now_ns();
+      timing_spin(CALIBRATION_LOOPS);
+      unsigned long long t = timing_now_ns() - start;
+      if(best == 0 || t < best)
+         best = t;
+   }
+
+   timing_loop_cost = (unsigned int)((best*1000ull)/CALIBRATION_LOOPS);
+   if(timing_loop_cost == 0)
+      timing_loop_cost = 1;
+
+   return 0;
+}
+
+unsigned int timing_loop_ps()
+{
+   return timing_loop_cost;
+}
+
+unsigned int timing_loops(unsigned int ns)
+{
+   //round up, we want at least ns
+   return (unsigned int)(((unsigned long long)ns*1000ull + timing_loop_cost - 1)/timing_loop_cost);
+}
+
+void timing_delay_ns(unsigned int ns)
+{
+   if(ns >= TIMING_CLOCK_SPIN_NS)
+   {
+      unsigned long long end = timing_now_ns() + ns;
+      while(timing_now_ns() < end)
+         ;
+      return;
+   }
+   timing_spin(timing_loops(ns));
+}
+
+void timing_wait_until(unsigned long long time_ns)
+{
+   unsigned long long now = timing_now_ns();
+
+   if(time_ns > now + TIMING_SLEEP_MARGIN_NS)
+   {
+      struct timespec ts;
+      unsigned long long wake = time_ns - TIMING_SLEEP_MARGIN_NS;
+      ts.tv_sec = wake / 1000000000ull;
+      ts.tv_nsec = wake % 1000000000ull;
+      clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0);
+   }
+   while(timing_now_ns() < time_ns)
+      ;
+}
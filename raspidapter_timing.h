@@ -0,0 +1,54 @@
+//
+// Raspidapter Library Code
+//
+// timing header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef RASPIDAPTER_TIMING_H
+#define RASPIDAPTER_TIMING_H
+
+// delays from this length on spin on the monotonic clock instead of the calibrated loop
+#define TIMING_CLOCK_SPIN_NS 2000
+
+// timing_wait_until sleeps until this long before the deadline and spins the rest
+#define TIMING_SLEEP_MARGIN_NS 50000
+
+// measure the cost of the delay loop - called by setup_raspidapter()
+// Runs a short warm up first so the cpu governor has settled on its top clock.
+int timing_calibrate();
+
+// picoseconds one delay loop takes (as measured by timing_calibrate)
+unsigned int timing_loop_ps();
+
+// current time of the monotonic clock in ns
+unsigned long long timing_now_ns();
+
+// number of delay loops for at least ns nanoseconds
+unsigned int timing_loops(unsigned int ns);
+
+// busy wait for a number of delay loops (see timing_loops)
+void timing_spin(unsigned int loops);
+
+// busy wait for at least ns nanoseconds
+void timing_delay_ns(unsigned int ns);
+
+// wait until the monotonic clock reaches time_ns - sleeps first for long waits
+void timing_wait_until(unsigned long long time_ns);
+
+#endif
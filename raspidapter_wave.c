@@ -0,0 +1,321 @@
+//
+// Raspidapter library
+//
+// waveform implementation 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "raspidapter_wave.h"
+#include "raspidapter_backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// blocks of one clock cycle: data set, delay, clock set, delay, clear, delay
+#define CB_PER_BIT 6
+// blocks of the strobe and a pause after the frame
+#define CB_PER_FRAME 4
+
+int wave_init(struct WAVE* wave, struct IOCHAIN* chain, int max_frames, unsigned int tick_ns)
+{
+   //error checking
+   if(wave == NULL || chain == NULL || chain->buffer == 0 || max_frames < 1)
+   {
+      return ERR_PARAM;
+   }
+
+   memset(wave,0,sizeof(struct WAVE));
+   wave->chain = chain;
+   wave->tick_ns = tick_ns ? tick_ns : WAVE_DEFAULT_TICK_NS;
+   wave->max_frames = max_frames;
+   wave->capacity = max_frames*(CB_PER_BIT*chain->chain_bits + CB_PER_FRAME);
+   wave->cb = malloc(wave->capacity*sizeof(struct WAVE_CB));
+   wave->images = malloc(max_frames*chain->num_words*sizeof(uint32_t));
+   if(wave->cb == NULL || wave->images == NULL)
+   {
+      wave_free(wave);
+      return ERR_INIT;
+   }
+
+   return 0;
+}
+
+void wave_free(struct WAVE* wave)
+{
+   if(wave == NULL)
+      return;
+   free(wave->cb);
+   free(wave->images);
+   wave->cb = NULL;
+   wave->images = NULL;
+   wave->count = 0;
+   wave->capacity = 0;
+   wave->frames = 0;
+   wave->max_frames = 0;
+}
+
+void wave_clear(struct WAVE* wave)
+{
+   wave->count = 0;
+   wave->frames = 0;
+}
+
+static void wave_put(struct WAVE* wave, uint32_t kind, uint32_t value)
+{
+   struct WAVE_CB* cb = &wave->cb[wave->count++];
+   cb->kind = kind;
+   cb->value = value;
+}
+
+static void wave_put_delay(struct WAVE* wave, unsigned int ns)
+{
+   //round up, we want at least ns
+   uint32_t ticks = (ns + wave->tick_ns - 1)/wave->tick_ns;
+   if(ticks)
+      wave_put(wave,WAVE_DELAY,ticks);
+}
+
+int wave_add_frame(struct WAVE* wave)
+{
+   struct IOCHAIN* chain;
+   struct IOCHAIN_OP* ops;
+   const struct IOCHAIN_TIMING* t;
+   unsigned int high;
+   uint32_t* image;
+   int i;
+
+   //error checking
+   if(wave == NULL || wave->cb == NULL)
+   {
+      return ERR_INIT;
+   }
+   chain = wave->chain;
+   if(wave->frames == wave->max_frames || wave->count + CB_PER_BIT*chain->chain_bits + CB_PER_FRAME > wave->capacity)
+   {
+      return ERR_PARAM;
+   }
+
+   t = &chain->timing;
+   high = t->clock_high_ns > t->hold_ns ? t->clock_high_ns : t->hold_ns;
+   image = wave->images + wave->frames*chain->num_words;
+
+   ops = malloc(chain->chain_bits*sizeof(struct IOCHAIN_OP));
+   if(ops == NULL)
+   {
+      return ERR_INIT;
+   }
+   iochain_snapshot(chain,image);
+   iochain_compile_image(chain,image,ops);
+
+   // the same writes as the bit-bang player, with the delays of the chain timing
+   for(i=0; i < chain->chain_bits; i++)
+   {
+      if(ops[i].set)
+         wave_put(wave,WAVE_SET,ops[i].set);
+      wave_put_delay(wave,t->setup_ns);
+      wave_put(wave,WAVE_SET,chain->clock_mask);
+      wave_put_delay(wave,high);
+      wave_put(wave,WAVE_CLR,ops[i].clr);
+      wave_put_delay(wave,t->clock_low_ns);
+   }
+   wave_put(wave,WAVE_SET,chain->strobe_mask);
+   wave_put_delay(wave,t->strobe_ns);
+   wave_put(wave,WAVE_CLR,chain->strobe_mask);
+
+   free(ops);
+   wave->frames++;
+   return 0;
+}
+
+int wave_add_delay(struct WAVE* wave, unsigned int ns)
+{
+   //error checking
+   if(wave == NULL || wave->cb == NULL)
+   {
+      return ERR_INIT;
+   }
+   if(wave->count == wave->capacity)
+   {
+      return ERR_PARAM;
+   }
+
+   wave_put_delay(wave,ns);
+   return 0;
+}
+
+//
+// shift a data bit into every chain of a register model - the first bit shifted ends at the
+// far end of the chain, like in the 74HC595 chain
+//
+static void wave_shift(const struct IOCHAIN* chain, uint32_t* reg, uint32_t level)
+{
+   int words = chain->chain_bits/IOCHAIN_WORD_BITS;
+   int k, w;
+
+   for(k=0; k < chain->numchains; k++)
+   {
+      uint32_t* r = reg + k*words;
+      for(w= words-1; w > 0; w--)
+         r[w] = (r[w] << 1) | (r[w-1] >> 31);
+      r[0] = (r[0] << 1) | ((level & chain->data_mask[k]) ? 1 : 0);
+   }
+}
+
+int wave_check(const struct WAVE* wave)
+{
+   const struct IOCHAIN* chain;
+   const struct IOCHAIN_TIMING* t;
+   uint32_t* reg;
+   uint32_t pins;
+   uint32_t level = 0;
+   unsigned long long now;
+   unsigned long long data_ns, rise_ns, fall_ns, strobe_ns;
+   unsigned int high;
+   int bytes;
+   int frame = 0;
+   int i;
+   int ret = 0;
+
+   //error checking
+   if(wave == NULL || wave->cb == NULL)
+   {
+      return ERR_INIT;
+   }
+
+   chain = wave->chain;
+   t = &chain->timing;
+   high = t->clock_high_ns > t->hold_ns ? t->clock_high_ns : t->hold_ns;
+   pins = chain->data_all | chain->clock_mask | chain->strobe_mask;
+   bytes = chain->num_words*sizeof(uint32_t);
+
+   reg = calloc(chain->num_words,sizeof(uint32_t));
+   if(reg == NULL)
+   {
+      return ERR_INIT;
+   }
+
+   // the reference is a model of the registers, independent of the frame compiler:
+   // replay the writes with their delays, shift on rising clock edges, latch on the strobe.
+   // The pins are idle and low before the wave.
+   now = 1000000000ull;
+   data_ns = rise_ns = fall_ns = strobe_ns = 0;
+   for(i=0; i < wave->count && ret == 0; i++)
+   {
+      const struct WAVE_CB* cb = &wave->cb[i];
+      uint32_t next;
+
+      if(cb->kind == WAVE_DELAY)
+      {
+         now += (unsigned long long)cb->value*wave->tick_ns;
+         continue;
+      }
+      if(cb->kind != WAVE_SET && cb->kind != WAVE_CLR)
+      {
+         ret = i+1;
+         break;
+      }
+      //only the pins of the chain group
+      if(cb->value & ~pins)
+      {
+         ret = i+1;
+         break;
+      }
+
+      next = cb->kind == WAVE_SET ? level | cb->value : level & ~cb->value;
+
+      //data may change while the clock is low, or with the falling edge after the hold time
+      if((next ^ level) & chain->data_all)
+      {
+         if((level & chain->clock_mask) && now - rise_ns < high)
+            ret = i+1;
+         data_ns = now;
+      }
+      if((next & ~level) & chain->clock_mask)
+      {
+         if(now - data_ns < t->setup_ns || now - fall_ns < t->clock_low_ns)
+            ret = i+1;
+         rise_ns = now;
+         wave_shift(chain,reg,next);
+      }
+      if((level & ~next) & chain->clock_mask)
+      {
+         if(now - rise_ns < high)
+            ret = i+1;
+         fall_ns = now;
+      }
+      if((next & ~level) & chain->strobe_mask)
+      {
+         //the latched registers have to hold the image of the frame
+         if(frame == wave->frames || memcmp(reg,wave->images + frame*chain->num_words,bytes) != 0)
+            ret = i+1;
+         frame++;
+         strobe_ns = now;
+      }
+      if((level & ~next) & chain->strobe_mask)
+      {
+         if(now - strobe_ns < t->strobe_ns)
+            ret = i+1;
+      }
+      level = next;
+   }
+
+   //every frame latched, the pins left low
+   if(ret == 0 && (frame != wave->frames || level != 0))
+      ret = wave->count+1;
+
+   free(reg);
+   return ret;
+}
+
+int wave_play(const struct WAVE* wave)
+{
+   struct IOCHAIN* chain;
+
+   //error checking
+   if(wave == NULL || wave->cb == NULL)
+   {
+      return ERR_INIT;
+   }
+   if(wave->frames == 0)
+   {
+      return 0;
+   }
+
+   //the registers hold the last frame once the waveform is done
+   chain = wave->chain;
+   return iochain_ctx_play_wave(chain,wave,wave->images + (wave->frames-1)*chain->num_words);
+}
+
+int wave_busy()
+{
+   const struct RASPIDAPTER_BACKEND* backend = raspidapter_backend();
+
+   if(backend->wave_busy == NULL)
+   {
+      return 0;
+   }
+   return backend->wave_busy();
+}
+
+int wave_wait()
+{
+   while(wave_busy())
+      ;
+   return 0;
+}
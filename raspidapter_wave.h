@@ -0,0 +1,94 @@
+//
+// Raspidapter Library Code
+//
+// waveform header 
+//
+// Copyright (C) Dominik Wenger 2015
+// No rights reserved
+// You may treat this program as if it was in the public domain
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef RASPIDAPTER_WAVE_H
+#define RASPIDAPTER_WAVE_H
+
+#include "raspidapter_common.h"
+
+// IO chain frames as gpio waveforms
+// A waveform is a list of gpio set, gpio clear and delay blocks. Backends which can,
+// play it without the cpu - the bcm2835 backend with a DMA channel paced by the PWM
+// clock. The blocks are hardware independent, so wave_check can verify them
+// on a model of the register chain.
+
+#define WAVE_SET 0      // write value to GPSET0
+#define WAVE_CLR 1      // write value to GPCLR0
+#define WAVE_DELAY 2    // wait value ticks
+
+// default pacing tick - every delay is rounded up to whole ticks
+#define WAVE_DEFAULT_TICK_NS 250
+
+struct WAVE_CB
+{
+   uint32_t kind;
+   uint32_t value;
+};
+
+struct WAVE
+{
+   struct IOCHAIN* chain;     // the chain group the frames are for
+   unsigned int tick_ns;
+
+   struct WAVE_CB* cb;
+   int count;
+   int capacity;
+
+   uint32_t* images;          // chain image of every frame, for checking and the latch state
+   int frames;
+   int max_frames;
+};
+
+// allocate a waveform for up to max_frames frames of a chain group
+// tick_ns - pacing tick, 0 for WAVE_DEFAULT_TICK_NS
+int wave_init(struct WAVE* wave, struct IOCHAIN* chain, int max_frames, unsigned int tick_ns);
+void wave_free(struct WAVE* wave);
+
+// drop all frames
+void wave_clear(struct WAVE* wave);
+
+// append the current buffer of the chain as a frame - shift and strobe
+// Use the setbit/clearbit functions to build the frames, pulse bits are not dropped.
+int wave_add_frame(struct WAVE* wave);
+
+// append a pause between frames
+int wave_add_delay(struct WAVE* wave, unsigned int ns);
+
+// replay the waveform on a model of the shift registers: every strobe has to latch the
+// image of its frame, the data setup, clock and strobe times have to meet the chain timing
+// and only the chain pins may be written
+// returns 0 if it matches, or 1 + the index of the first wrong block
+int wave_check(const struct WAVE* wave);
+
+// start playing the waveform - returns while it plays
+// The chain counts the last frame as latched. Chain updates wait until the playback is done.
+// returns ERR_ESTOP while the chain is stopped
+int wave_play(const struct WAVE* wave);
+
+// 1 while a waveform plays
+int wave_busy();
+
+// wait until the waveform is played
+int wave_wait();
+
+#endif
@@ -33,6 +33,7 @@
 #include "dice_9555.h"
 #include "dice_vn.h"
 #include "dice_tc.h"
+#include "dice_tmc.h"
 
 struct DICE dice_stk;
 struct DICE dice_9555;
@@ -197,7 +198,7 @@ int main(void)
    loopcounter++;
   }
 
-  restore_io();
+  deinit_raspidapter();
 } // main
 
 